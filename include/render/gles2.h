@@ -16,6 +16,7 @@
 #include <wlr/util/log.h>
 
 #include "render/egl.h"
+#include "util/rect_union.h"
 
 // mesa ships old GL headers that don't include this type, so for distros that use headers from
 // mesa we need to def it ourselves until they update.
@@ -29,13 +30,44 @@ struct wlr_gles2_pixel_format {
 	GLint gl_format, gl_type;
 };
 
+// Matches the OUTPUT_TRANSFORM values in output.frag
+enum wlr_gles2_output_transform {
+	WLR_GLES2_OUTPUT_TRANSFORM_NONE = 0,
+	WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D = 1,
+	// The 3D LUT is packed into a 2D texture, for drivers without 3D textures
+	WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D_PACKED = 2,
+};
+
+struct wlr_gles2_lut_uniforms {
+	GLint lut_3d;
+	GLint offset;
+	GLint scale;
+	GLint dim;
+};
+
+struct wlr_gles2_quad_shader {
+	GLuint program;
+	GLint proj;
+	GLint color;
+	GLint pos_attrib;
+	struct wlr_gles2_lut_uniforms lut;
+};
+
 struct wlr_gles2_tex_shader {
 	GLuint program;
 	GLint proj;
-	GLint tex_proj;
 	GLint tex;
 	GLint alpha;
 	GLint pos_attrib;
+	GLint texcoord_attrib;
+	struct wlr_gles2_lut_uniforms lut;
+};
+
+struct wlr_gles2_shaders {
+	struct wlr_gles2_quad_shader quad;
+	struct wlr_gles2_tex_shader tex_rgba;
+	struct wlr_gles2_tex_shader tex_rgbx;
+	struct wlr_gles2_tex_shader tex_ext;
 };
 
 struct wlr_gles2_renderer {
@@ -55,7 +87,11 @@ struct wlr_gles2_renderer {
 		bool EXT_texture_type_2_10_10_10_REV;
 		bool OES_texture_half_float_linear;
 		bool EXT_texture_norm16;
+		bool EXT_color_buffer_half_float;
 		bool EXT_disjoint_timer_query;
+		// Also requires GLES 3.0 for pixel unpack buffers and fences
+		bool EXT_buffer_storage;
+		bool OES_texture_3D;
 	} exts;
 
 	struct {
@@ -72,22 +108,45 @@ struct wlr_gles2_renderer {
 		PFNGLGETQUERYOBJECTIVEXTPROC glGetQueryObjectivEXT;
 		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 		PFNGLGETINTEGER64VEXTPROC glGetInteger64vEXT;
+		PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT;
+		PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRange;
+		PFNGLUNMAPBUFFEROESPROC glUnmapBuffer;
+		PFNGLFENCESYNCAPPLEPROC glFenceSync;
+		PFNGLCLIENTWAITSYNCAPPLEPROC glClientWaitSync;
+		PFNGLDELETESYNCAPPLEPROC glDeleteSync;
+		PFNGLTEXIMAGE3DOESPROC glTexImage3DOES;
 	} procs;
 
-	struct {
-		struct {
-			GLuint program;
-			GLint proj;
-			GLint color;
-			GLint pos_attrib;
-		} quad;
-		struct wlr_gles2_tex_shader tex_rgba;
-		struct wlr_gles2_tex_shader tex_rgbx;
-		struct wlr_gles2_tex_shader tex_ext;
-	} shaders;
+	struct wlr_gles2_shaders shaders;
+	// Same shaders, with the output color transform applied to their result.
+	// Only used to copy blend FBOs to the output.
+	struct wlr_gles2_shaders lut_shaders;
+	enum wlr_gles2_output_transform lut_output_transform;
 
 	struct wl_list buffers; // wlr_gles2_buffer.link
 	struct wl_list textures; // wlr_gles2_texture.link
+	struct wl_list color_transforms; // wlr_gles2_color_transform.link
+	struct wl_list read_pixels_requests; // wlr_gles2_read_pixels_request.link
+
+	// Render pass with a pending batch of draws, if any
+	struct wlr_gles2_render_pass *batch_pass;
+	// Number of draw calls issued by the last submitted render pass
+	size_t last_pass_draw_calls;
+
+	// Persistently mapped pixel unpack buffer, used as a ring buffer to stage
+	// shm texture uploads
+	struct {
+		GLuint pbo;
+		void *map;
+		size_t size;
+		size_t head;
+		struct wl_array in_flight; // struct wlr_gles2_staging_region
+	} staging;
+};
+
+struct wlr_gles2_staging_region {
+	GLsync fence;
+	size_t start, end;
 };
 
 struct wlr_gles2_render_timer {
@@ -110,6 +169,10 @@ struct wlr_gles2_buffer {
 	GLuint fbo;
 	GLuint tex;
 
+	// Intermediate render target for passes with a 3D LUT, created lazily
+	GLuint blend_tex;
+	GLuint blend_fbo;
+
 	struct wlr_addon addon;
 };
 
@@ -132,10 +195,45 @@ struct wlr_gles2_texture {
 	struct wlr_gles2_buffer *buffer; // for DMA-BUF imports only
 };
 
+struct wlr_gles2_color_transform {
+	struct wlr_gles2_renderer *renderer;
+	struct wl_list link; // wlr_gles2_renderer.color_transforms
+	struct wlr_addon addon;
+
+	GLenum target;
+	GLuint lut_3d;
+	size_t dim;
+};
+
+struct wlr_gles2_render_batch {
+	GLuint program;
+	GLint proj, pos_attrib, texcoord_attrib;
+	GLint tex_uniform, alpha_uniform, color_uniform;
+	struct wlr_gles2_lut_uniforms lut;
+
+	GLenum target;
+	GLuint tex;
+	enum wlr_scale_filter_mode filter_mode;
+	enum wlr_render_blend_mode blend_mode;
+	float color[4]; // color for quads, alpha in color[3] for textures
+
+	struct wl_array verts; // GLfloat x, y, u, v
+};
+
 struct wlr_gles2_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_gles2_buffer *buffer;
+	GLuint fbo;
+	// With a 3D LUT, draws go to the blend FBO of the buffer, and the updated
+	// region is copied through the LUT to this FBO on submit. 0 otherwise.
+	GLuint output_fbo;
+	struct rect_union updated_region;
 	float projection_matrix[9];
+	// Consecutive draws sharing the same state are merged into this batch
+	struct wlr_gles2_render_batch batch;
+	size_t draw_calls;
+	struct wlr_color_transform *color_transform;
+	struct wlr_gles2_color_transform *gles2_color_transform; // may be NULL
 	struct wlr_egl_context prev_ctx;
 	struct wlr_gles2_render_timer *timer;
 	struct wlr_drm_syncobj_timeline *signal_timeline;
@@ -151,6 +249,7 @@ void get_gles2_shm_formats(const struct wlr_gles2_renderer *renderer,
 	struct wlr_drm_format_set *out);
 
 GLuint gles2_buffer_get_fbo(struct wlr_gles2_buffer *buffer);
+GLuint gles2_buffer_get_blend_fbo(struct wlr_gles2_buffer *buffer);
 
 struct wlr_gles2_renderer *gles2_get_renderer(
 	struct wlr_renderer *wlr_renderer);
@@ -164,14 +263,31 @@ struct wlr_gles2_buffer *gles2_buffer_get_or_create(struct wlr_gles2_renderer *r
 struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	struct wlr_buffer *buffer);
 void gles2_texture_destroy(struct wlr_gles2_texture *texture);
+void gles2_staging_finish(struct wlr_gles2_renderer *renderer);
+/**
+ * Release the GPU resources of read-back requests outliving the renderer.
+ * Their copies fail from then on.
+ */
+void gles2_read_pixels_requests_finish(struct wlr_gles2_renderer *renderer);
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 	const char *file, const char *func);
 #define push_gles2_debug(renderer) push_gles2_debug_(renderer, _WLR_FILENAME, __func__)
 void pop_gles2_debug(struct wlr_gles2_renderer *renderer);
 
+/**
+ * Submit the pending batch of draws of the current render pass, if any. Must
+ * be called before GL state used by the batch is modified.
+ */
+void gles2_flush_render_batch(struct wlr_gles2_renderer *renderer);
+
+struct wlr_gles2_color_transform *gles2_color_transform_get_or_create(
+	struct wlr_gles2_renderer *renderer, struct wlr_color_transform *transform);
+void gles2_color_transform_destroy(struct wlr_gles2_color_transform *transform);
+
 struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *buffer,
 	struct wlr_egl_context *prev_ctx, struct wlr_gles2_render_timer *timer,
+	struct wlr_color_transform *color_transform,
 	struct wlr_drm_syncobj_timeline *signal_timeline, uint64_t signal_point);
 
 #endif
@@ -21,6 +21,9 @@ struct wlr_pixman_renderer {
 	struct wl_list textures; // wlr_pixman_texture.link
 
 	struct wlr_drm_format_set drm_formats;
+
+	// Worker threads compositing render passes, NULL if single-threaded
+	struct thread_pool *thread_pool;
 };
 
 struct wlr_pixman_buffer {
@@ -44,11 +47,29 @@ struct wlr_pixman_texture {
 
 	void *data; // if created via texture_from_pixels
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
+
+	// The texture with the last transform and scale it was drawn with applied
+	struct {
+		bool valid; // the fields below describe the last draw
+		enum wl_output_transform transform;
+		enum wlr_scale_filter_mode filter_mode;
+		struct wlr_box src_box;
+		int dst_width, dst_height;
+		pixman_image_t *image; // NULL until drawn the same way twice
+	} transform_cache;
+};
+
+struct wlr_pixman_render_timer {
+	struct wlr_render_timer base;
+	int64_t start_nsec; // CLOCK_MONOTONIC
+	int duration_nsec; // -1 until the render pass is submitted
+	struct wlr_pixman_render_timer_durations durations;
 };
 
 struct wlr_pixman_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_pixman_buffer *buffer;
+	struct wlr_pixman_render_timer *timer; // may be NULL
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
@@ -58,7 +79,12 @@ const uint32_t *get_pixman_drm_formats(size_t *len);
 bool begin_pixman_data_ptr_access(struct wlr_buffer *buffer, pixman_image_t **image_ptr,
 	uint32_t flags);
 
+void pixman_texture_invalidate_transform_cache(struct wlr_pixman_texture *texture);
+
+struct wlr_pixman_render_timer *pixman_get_render_timer(
+	struct wlr_render_timer *timer);
+
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-	struct wlr_pixman_buffer *buffer);
+	struct wlr_pixman_buffer *buffer, struct wlr_pixman_render_timer *timer);
 
 #endif
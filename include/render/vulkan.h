@@ -9,6 +9,7 @@
 #include <wlr/render/wlr_texture.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/interface.h>
+#include <wlr/render/vulkan.h>
 #include <wlr/util/addon.h>
 #include "util/rect_union.h"
 
@@ -42,11 +43,16 @@ struct wlr_vk_device {
 
 	bool implicit_sync_interop;
 	bool sampler_ycbcr_conversion;
+	bool pipeline_creation_feedback;
 
-	// we only ever need one queue for rendering and transfer commands
 	uint32_t queue_family;
 	VkQueue queue;
 
+	// Dedicated queue for texture uploads, VK_NULL_HANDLE if the device has
+	// no suitable queue family. In that case the queue above is used.
+	uint32_t transfer_queue_family;
+	VkQueue transfer_queue;
+
 	struct {
 		PFN_vkGetMemoryFdPropertiesKHR vkGetMemoryFdPropertiesKHR;
 		PFN_vkWaitSemaphoresKHR vkWaitSemaphoresKHR;
@@ -190,6 +196,7 @@ struct wlr_vk_render_format_setup {
 	bool use_blending_buffer;
 	VkRenderPass render_pass;
 
+	// Created on first use, see setup_get_or_create_output_pipeline()
 	VkPipeline output_pipe_srgb;
 	VkPipeline output_pipe_lut3d;
 
@@ -246,8 +253,6 @@ struct wlr_vk_command_buffer {
 	uint64_t timeline_point;
 	// Textures to destroy after the command buffer completes
 	struct wl_list destroy_textures; // wlr_vk_texture.destroy_link
-	// Staging shared buffers to release after the command buffer completes
-	struct wl_list stage_buffers; // wlr_vk_shared_buffer.link
 	// Color transform to unref after the command buffer completes
 	struct wlr_color_transform *color_transform;
 
@@ -256,6 +261,7 @@ struct wlr_vk_command_buffer {
 };
 
 #define VULKAN_COMMAND_BUFFERS_CAP 64
+#define VULKAN_TRANSFER_COMMAND_BUFFERS_CAP 8
 
 // Vulkan wlr_renderer implementation on top of a wlr_vk_device.
 struct wlr_vk_renderer {
@@ -272,6 +278,16 @@ struct wlr_vk_renderer {
 
 	struct wl_list pipeline_layouts; // struct wlr_vk_pipeline_layout.link
 
+	// Pipelines are created lazily on first use, through this cache which is
+	// persisted on disk across runs
+	struct {
+		VkPipelineCache cache;
+		char *path; // NULL if the cache isn't persisted
+		bool dirty; // new pipelines were added since it was last saved
+		// Render passes submitted since a pipeline was last added
+		int settled_passes;
+	} pipeline_cache;
+
 	// for blend->output subpass
 	VkPipelineLayout output_pipe_layout;
 	VkDescriptorSetLayout output_ds_srgb_layout;
@@ -306,15 +322,35 @@ struct wlr_vk_renderer {
 
 	struct wl_list color_transforms; // wlr_vk_color_transform.link
 
+	struct wl_list read_pixels_requests; // wlr_vk_read_pixels_request.link
+
 	// Pool of command buffers
 	struct wlr_vk_command_buffer command_buffers[VULKAN_COMMAND_BUFFERS_CAP];
 
 	struct {
 		struct wlr_vk_command_buffer *cb;
 		uint64_t last_timeline_point;
-		struct wl_list buffers; // wlr_vk_shared_buffer.link
+		// Allocations are made from the first buffer, the others have been
+		// replaced by a bigger one and are destroyed once idle
+		struct wl_list buffers; // wlr_vk_stage_buffer.link
+		VkDeviceSize budget; // maximum size of all buffers
+		struct wlr_vk_staging_stats stats;
 	} stage;
 
+	// Texture uploads on the dedicated transfer queue, if any. The transfer
+	// command buffer is submitted along with the stage command buffer, which
+	// waits for it. Resources used by uploads are tied to the stage command
+	// buffer.
+	struct {
+		VkCommandPool command_pool;
+		VkSemaphore timeline_semaphore;
+		uint64_t timeline_point;
+		struct wlr_vk_command_buffer command_buffers[VULKAN_TRANSFER_COMMAND_BUFFERS_CAP];
+		struct wlr_vk_command_buffer *cb;
+		// Point on the render timeline to wait for before running cb
+		uint64_t wait_point;
+	} transfer;
+
 	struct {
 		bool initialized;
 		uint32_t drm_format;
@@ -348,6 +384,9 @@ struct wlr_vk_texture_view {
 struct wlr_vk_pipeline *setup_get_or_create_pipeline(
 	struct wlr_vk_render_format_setup *setup,
 	const struct wlr_vk_pipeline_key *key);
+VkPipeline setup_get_or_create_output_pipeline(
+	struct wlr_vk_render_format_setup *setup,
+	enum wlr_vk_output_transform transform);
 struct wlr_vk_pipeline_layout *get_or_create_pipeline_layout(
 	struct wlr_vk_renderer *renderer,
 	const struct wlr_vk_pipeline_layout_key *key);
@@ -355,6 +394,16 @@ struct wlr_vk_texture_view *vulkan_texture_get_or_create_view(
 	struct wlr_vk_texture *texture,
 	const struct wlr_vk_pipeline_layout *layout);
 
+// On-disk pipeline cache, stored under $XDG_CACHE_HOME/wlroots
+bool vulkan_init_pipeline_cache(struct wlr_vk_renderer *renderer);
+void vulkan_save_pipeline_cache(struct wlr_vk_renderer *renderer);
+// Create a pipeline through the cache, marking it dirty on cache misses
+VkResult vulkan_create_cached_pipeline(struct wlr_vk_renderer *renderer,
+	VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline);
+// Save the cache once no new pipelines were needed for a while
+void vulkan_pipeline_cache_handle_pass(struct wlr_vk_renderer *renderer);
+void vulkan_finish_pipeline_cache(struct wlr_vk_renderer *renderer);
+
 // Creates a vulkan renderer for the given device.
 struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev);
 
@@ -367,6 +416,17 @@ VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer);
 // finished execution.
 bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer);
 
+// Gets a command buffer in recording state for texture uploads. Uses the
+// dedicated transfer queue if there is one, and the stage command buffer
+// otherwise.
+VkCommandBuffer vulkan_record_transfer_cb(struct wlr_vk_renderer *renderer);
+
+// Submits the pending transfer command buffer, if any. wait is filled with
+// the semaphore the next graphics submission has to wait for, or zeroed if
+// there is nothing to wait for.
+bool vulkan_submit_transfer_cb(struct wlr_vk_renderer *renderer,
+	VkSemaphoreSubmitInfoKHR *wait);
+
 struct wlr_vk_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_vk_renderer *renderer;
@@ -386,10 +446,16 @@ struct wlr_vk_render_pass *vulkan_begin_render_pass(struct wlr_vk_renderer *rend
 // Suballocates a buffer span with the given size that can be mapped
 // and used as staging buffer. The allocation is implicitly released when the
 // stage cb has finished execution. The start of the span will be a multiple
-// of the given alignment.
+// of the given alignment. May wait for previous submissions if the staging
+// budget is exhausted.
 struct wlr_vk_buffer_span vulkan_get_stage_span(
 	struct wlr_vk_renderer *renderer, VkDeviceSize size,
 	VkDeviceSize alignment);
+// Ties all stage allocations that weren't submitted yet to the given
+// point on the renderer timeline. Must be called after the stage cb has been
+// submitted.
+void vulkan_stage_fence(struct wlr_vk_renderer *renderer,
+	uint64_t timeline_point);
 
 // Tries to allocate a texture descriptor set. Will additionally
 // return the pool it was allocated from when successful (for freeing it later).
@@ -427,6 +493,10 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 	uint32_t drm_format, uint32_t stride,
 	uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
 	uint32_t dst_x, uint32_t dst_y, void *data);
+struct wlr_texture_read_pixels_request *vulkan_read_pixels_async(
+	struct wlr_vk_texture *texture, struct wl_event_loop *loop,
+	uint32_t drm_format, uint32_t width, uint32_t height,
+	uint32_t src_x, uint32_t src_y);
 
 // State (e.g. image texture) associated with a surface.
 struct wlr_vk_texture {
@@ -438,6 +508,7 @@ struct wlr_vk_texture {
 	const struct wlr_vk_format *format;
 	enum wlr_vk_texture_transform transform;
 	struct wlr_vk_command_buffer *last_used_cb; // to track when it can be destroyed
+	struct wlr_vk_command_buffer *last_read_cb; // last graphics cb sampling it
 	bool dmabuf_imported;
 	bool owned; // if dmabuf_imported: whether we have ownership of the image
 	bool transitioned; // if dma_imported: whether we transitioned it away from preinit
@@ -476,20 +547,28 @@ struct wlr_vk_allocation {
 	VkDeviceSize size;
 };
 
-// List of suballocated staging buffers.
+struct wlr_vk_stage_fence {
+	uint64_t end; // stage buffer head at submission time
+	uint64_t timeline_point;
+};
+
+// Ring buffer suballocated for staging.
 // Used to upload to/read from device local images.
-struct wlr_vk_shared_buffer {
-	struct wl_list link; // wlr_vk_renderer.stage.buffers or wlr_vk_command_buffer.stage_buffers
+struct wlr_vk_stage_buffer {
+	struct wl_list link; // wlr_vk_renderer.stage.buffers
 	VkBuffer buffer;
 	VkDeviceMemory memory;
 	VkDeviceSize buf_size;
 	void *cpu_mapping;
-	struct wl_array allocs; // struct wlr_vk_allocation
+	// Offsets only ever grow and are taken modulo buf_size. [tail, head) is
+	// in use, [submitted, head) hasn't been submitted yet.
+	uint64_t head, tail, submitted;
+	struct wl_array fences; // struct wlr_vk_stage_fence, oldest first
 };
 
 // Suballocated range on a buffer.
 struct wlr_vk_buffer_span {
-	struct wlr_vk_shared_buffer *buffer;
+	struct wlr_vk_stage_buffer *buffer;
 	struct wlr_vk_allocation alloc;
 };
 
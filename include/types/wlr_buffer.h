@@ -59,6 +59,25 @@ bool dmabuf_buffer_drop(struct wlr_dmabuf_buffer *buffer);
  */
 bool buffer_is_opaque(struct wlr_buffer *buffer);
 
+/**
+ * Get a DMA-BUF to import the buffer into a texture.
+ *
+ * Unlike wlr_buffer_get_dmabuf(), this may also succeed for shared memory
+ * buffers when wlr_shm_set_udmabuf() is enabled: the DMA-BUF then aliases the
+ * client's memory. This must only be used to create textures, the buffer
+ * can't be treated as a DMA-BUF otherwise (e.g. for rendering or scan-out).
+ */
+bool buffer_get_texture_dmabuf(struct wlr_buffer *buffer,
+	struct wlr_dmabuf_attributes *attribs);
+
+/**
+ * Wrap the pages backing a shared memory buffer into a DMA-BUF via udmabuf.
+ * Returns false if the buffer isn't a wlr_shm buffer, or if it doesn't allow
+ * it. See buffer_get_texture_dmabuf().
+ */
+bool shm_buffer_get_udmabuf(struct wlr_buffer *buffer,
+	struct wlr_dmabuf_attributes *attribs);
+
 /**
  * Creates a struct wlr_client_buffer from a given struct wlr_buffer by creating
  * a texture from it, and copying its struct wl_resource.
@@ -73,5 +92,42 @@ struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
  */
 bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
 	struct wlr_buffer *next, const pixman_region32_t *damage);
+/**
+ * Creates a struct wlr_client_buffer without a texture. The buffer is kept
+ * locked, and the texture is created on the first
+ * wlr_client_buffer_get_texture() call.
+ */
+struct wlr_client_buffer *wlr_client_buffer_create_deferred(
+	struct wlr_buffer *buffer, struct wlr_renderer *renderer);
+/**
+ * Like wlr_client_buffer_apply_damage(), but only record the new contents and
+ * damage. They are uploaded on the next wlr_client_buffer_get_texture() call.
+ *
+ * If an upload was already pending, saved_bytes is set to the number of bytes
+ * which won't be copied thanks to merging both uploads.
+ */
+bool wlr_client_buffer_defer_damage(struct wlr_client_buffer *client_buffer,
+	struct wlr_buffer *next, const pixman_region32_t *damage,
+	size_t *saved_bytes);
+/**
+ * Get the number of bytes the pending upload would copy. Returns 0 if nothing
+ * is pending or if the buffer would be imported instead of copied.
+ */
+size_t wlr_client_buffer_get_pending_upload_size(
+	struct wlr_client_buffer *client_buffer);
+/**
+ * Start evicting the buffer's texture to free up GPU memory. The contents are
+ * read back asynchronously, and once they are ready the texture is destroyed
+ * from the event loop. They are kept in system memory and uploaded again by
+ * wlr_client_buffer_get_texture().
+ *
+ * Contents of a pending upload are merged into the read-back, and if they
+ * replace the whole buffer the texture is destroyed right away.
+ *
+ * New contents cancel the eviction. Fails if the texture is imported from a
+ * DMA-BUF or if an eviction is already in progress.
+ */
+bool wlr_client_buffer_evict_texture(struct wlr_client_buffer *client_buffer,
+	struct wl_event_loop *loop);
 
 #endif
@@ -12,6 +12,7 @@ bool output_pending_enabled(struct wlr_output *output,
 bool output_pick_format(struct wlr_output *output,
 	const struct wlr_drm_format_set *display_formats,
 	struct wlr_drm_format *format, uint32_t fmt);
+int output_swapchain_idle_trim_from_env(void);
 bool output_ensure_buffer(struct wlr_output *output,
 	struct wlr_output_state *state, bool *new_back_buffer);
 
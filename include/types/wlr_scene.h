@@ -7,4 +7,22 @@ struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node);
 
 void scene_surface_set_clip(struct wlr_scene_surface *surface, struct wlr_box *clip);
 
+/**
+ * Damage the visible area of a scene buffer on all outputs.
+ */
+void scene_buffer_damage_visible(struct wlr_scene_buffer *scene_buffer);
+
+/**
+ * Update wlr_scene_buffer.scanned_opaque from the contents of buffer, which
+ * only changed within damage since the last call. Scans are rate-limited, and
+ * only damaged tiles are scanned again.
+ *
+ * Returns 0 if the contents have been scanned. Otherwise the scan was
+ * deferred: it should be done again with the same contents and an empty
+ * damage after the returned number of milliseconds.
+ */
+int scene_buffer_scan_opaque(struct wlr_scene_buffer *scene_buffer,
+	struct wlr_buffer *buffer, const pixman_region32_t *damage);
+void scene_buffer_reset_scanned_opaque(struct wlr_scene_buffer *scene_buffer);
+
 #endif
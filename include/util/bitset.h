@@ -0,0 +1,41 @@
+#ifndef UTIL_BITSET_H
+#define UTIL_BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <wayland-util.h>
+
+/**
+ * A dynamically sized set of small integers, stored as an array of 64-bit
+ * words in a struct wl_array. Bits past the end of the array are zero, so an
+ * initialized empty wl_array is an empty set.
+ */
+
+#define BITSET_NONE ((size_t)-1)
+
+/**
+ * Add bit to the set, growing it if necessary. Returns false on allocation
+ * failure.
+ */
+bool bitset_set(struct wl_array *set, size_t bit);
+
+bool bitset_test(const struct wl_array *set, size_t bit);
+
+bool bitset_empty(const struct wl_array *set);
+
+bool bitset_equal(const struct wl_array *a, const struct wl_array *b);
+
+/**
+ * Return the first bit greater or equal to start that is set in exactly one of
+ * a and b, or BITSET_NONE if there is none.
+ */
+size_t bitset_next_diff(const struct wl_array *a, const struct wl_array *b,
+	size_t start);
+
+/**
+ * Return the first bit greater or equal to start that is set, or BITSET_NONE
+ * if there is none.
+ */
+size_t bitset_next(const struct wl_array *set, size_t start);
+
+#endif
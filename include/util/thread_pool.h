@@ -0,0 +1,36 @@
+#ifndef UTIL_THREAD_POOL_H
+#define UTIL_THREAD_POOL_H
+
+#include <stddef.h>
+
+/**
+ * A fixed-size pool of worker threads running fork-join jobs.
+ *
+ * The calling thread always takes part in the work, so a pool created with
+ * zero threads simply runs jobs serially. Worker threads block all signals.
+ */
+struct thread_pool;
+
+/**
+ * Create a pool with the given number of worker threads. Returns NULL on
+ * failure.
+ */
+struct thread_pool *thread_pool_create(size_t n_threads);
+
+void thread_pool_destroy(struct thread_pool *pool);
+
+/**
+ * Return the number of threads participating in a job, including the caller.
+ */
+size_t thread_pool_get_concurrency(struct thread_pool *pool);
+
+/**
+ * Call func(i, data) for each i in [0, n) and wait for all calls to return.
+ *
+ * Calls may run concurrently and in any order. Must not be called
+ * recursively from within func.
+ */
+void thread_pool_run(struct thread_pool *pool, size_t n,
+	void (*func)(size_t i, void *data), void *data);
+
+#endif
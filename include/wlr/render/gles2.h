@@ -34,6 +34,10 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl);
 struct wlr_egl *wlr_gles2_renderer_get_egl(struct wlr_renderer *renderer);
 bool wlr_gles2_renderer_check_ext(struct wlr_renderer *renderer, const char *ext);
 GLuint wlr_gles2_renderer_get_buffer_fbo(struct wlr_renderer *renderer, struct wlr_buffer *buffer);
+/**
+ * Get the number of draw calls issued by the last submitted render pass.
+ */
+size_t wlr_gles2_renderer_get_last_pass_draw_calls(struct wlr_renderer *renderer);
 
 struct wlr_gles2_texture_attribs {
 	GLenum target; /* either GL_TEXTURE_2D or GL_TEXTURE_EXTERNAL_OES */
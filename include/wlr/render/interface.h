@@ -43,11 +43,32 @@ struct wlr_texture_impl {
 		const struct wlr_texture_read_pixels_options *options);
 	uint32_t (*preferred_read_format)(struct wlr_texture *texture);
 	void (*destroy)(struct wlr_texture *texture);
+	// Optional, returning NULL falls back to a synchronous read_pixels call
+	struct wlr_texture_read_pixels_request *(*read_pixels_async)(
+		struct wlr_texture *texture, struct wl_event_loop *loop,
+		const struct wlr_texture_read_pixels_async_options *options);
 };
 
 void wlr_texture_init(struct wlr_texture *texture, struct wlr_renderer *rendener,
 	const struct wlr_texture_impl *impl, uint32_t width, uint32_t height);
 
+struct wlr_texture_read_pixels_request_impl {
+	bool (*copy)(struct wlr_texture_read_pixels_request *request,
+		void *data, uint32_t stride);
+	void (*destroy)(struct wlr_texture_read_pixels_request *request);
+};
+
+/**
+ * Initialize a read-back request. It becomes ready once sync_file_fd is
+ * signalled, or on the next event loop iteration if sync_file_fd is -1. Takes
+ * ownership of sync_file_fd, even on failure.
+ */
+bool wlr_texture_read_pixels_request_init(
+	struct wlr_texture_read_pixels_request *request,
+	const struct wlr_texture_read_pixels_request_impl *impl,
+	struct wl_event_loop *loop, uint32_t format, uint32_t width,
+	uint32_t height, int sync_file_fd);
+
 struct wlr_render_pass {
 	const struct wlr_render_pass_impl *impl;
 };
@@ -86,5 +107,8 @@ void wlr_texture_read_pixels_options_get_src_box(
 	const struct wlr_texture *texture, struct wlr_box *box);
 void *wlr_texture_read_pixel_options_get_data(
 	const struct wlr_texture_read_pixels_options *options);
+void wlr_texture_read_pixels_async_options_get_src_box(
+	const struct wlr_texture_read_pixels_async_options *options,
+	const struct wlr_texture *texture, struct wlr_box *box);
 
 #endif
@@ -12,13 +12,35 @@
 #include <pixman.h>
 #include <wlr/render/wlr_renderer.h>
 
+struct wlr_pixman_render_timer_durations {
+	int64_t composite_nsec; // time spent drawing textures
+	int64_t fill_nsec; // time spent drawing rects
+};
+
 struct wlr_renderer *wlr_pixman_renderer_create(void);
 
 bool wlr_renderer_is_pixman(struct wlr_renderer *wlr_renderer);
+bool wlr_render_timer_is_pixman(struct wlr_render_timer *timer);
 bool wlr_texture_is_pixman(struct wlr_texture *texture);
 
 pixman_image_t *wlr_pixman_renderer_get_buffer_image(
     struct wlr_renderer *wlr_renderer, struct wlr_buffer *wlr_buffer);
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture);
 
+/**
+ * Get the CPU time spent on each kind of operation during the last render
+ * pass measured by the timer. wlr_render_timer_get_duration_ns() returns the
+ * duration of the whole render pass.
+ */
+void wlr_pixman_render_timer_get_durations(struct wlr_render_timer *timer,
+    struct wlr_pixman_render_timer_durations *durations);
+
+/**
+ * Set the number of threads compositing render passes, including the calling
+ * thread. Large operations are split into horizontal bands composited in
+ * parallel. Defaults to 1, which disables multi-threading.
+ */
+bool wlr_pixman_renderer_set_threads(struct wlr_renderer *wlr_renderer,
+    size_t n_threads);
+
 #endif
@@ -2,6 +2,7 @@
 #define WLR_RENDER_SWAPCHAIN_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <wayland-server-core.h>
 #include <wlr/render/drm_format_set.h>
 
@@ -10,6 +11,7 @@
 struct wlr_swapchain_slot {
 	struct wlr_buffer *buffer;
 	bool acquired; // waiting for release
+	int64_t last_acquired_msec; // CLOCK_MONOTONIC
 
 	struct wl_listener release;
 };
@@ -22,6 +24,18 @@ struct wlr_swapchain {
 
 	struct wlr_swapchain_slot slots[WLR_SWAPCHAIN_CAP];
 
+	struct {
+		uint64_t allocations; // buffers allocated
+		uint64_t trims; // idle buffers released
+	} stats;
+
+	// private state
+
+	int idle_trim_msec; // 0 if disabled
+	size_t idle_trim_min_buffers;
+	struct wl_event_source *idle_trim_timer;
+	int64_t idle_trim_deadline_msec; // 0 if the timer is disarmed
+
 	struct wl_listener allocator_destroy;
 };
 
@@ -42,5 +56,21 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain);
  */
 bool wlr_swapchain_has_buffer(struct wlr_swapchain *swapchain,
 	struct wlr_buffer *buffer);
+/**
+ * Release buffers which haven't been acquired for idle_msec milliseconds,
+ * keeping at least min_buffers allocated.
+ *
+ * The swapchain allocates buffers on demand, up to WLR_SWAPCHAIN_CAP, when
+ * all existing buffers are in use. Trimming lets it shrink back once the
+ * pipelining pressure goes away. The idle buffers are checked on each
+ * acquire, and if loop is non-NULL, a timer also trims them when the
+ * swapchain isn't used at all. The timer only runs while there are more
+ * than min_buffers buffers.
+ *
+ * Buffers still locked by someone else (e.g. the backend, while being
+ * scanned out) are never trimmed. Setting idle_msec to 0 disables trimming.
+ */
+void wlr_swapchain_set_idle_trim(struct wlr_swapchain *swapchain,
+	struct wl_event_loop *loop, int idle_msec, size_t min_buffers);
 
 #endif
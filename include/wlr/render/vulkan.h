@@ -18,6 +18,13 @@ struct wlr_vk_image_attribs {
 	VkFormat format;
 };
 
+struct wlr_vk_staging_stats {
+	uint64_t bytes_uploaded; // total size of all staging allocations
+	uint64_t bytes_allocated; // device memory currently used for staging
+	uint64_t high_water_mark; // maximum number of staging bytes in use at once
+	uint64_t stalls; // number of times an allocation had to wait for the GPU
+};
+
 struct wlr_renderer *wlr_vk_renderer_create_with_drm_fd(int drm_fd);
 
 VkInstance wlr_vk_renderer_get_instance(struct wlr_renderer *renderer);
@@ -25,6 +32,16 @@ VkPhysicalDevice wlr_vk_renderer_get_physical_device(struct wlr_renderer *render
 VkDevice wlr_vk_renderer_get_device(struct wlr_renderer *renderer);
 uint32_t wlr_vk_renderer_get_queue_family(struct wlr_renderer *renderer);
 
+/**
+ * Set the maximum amount of device memory used for staging buffers. When the
+ * budget is exhausted, uploads wait for previous frames to complete. Defaults
+ * to 256 MiB.
+ */
+void wlr_vk_renderer_set_staging_budget(struct wlr_renderer *renderer,
+	uint64_t budget);
+void wlr_vk_renderer_get_staging_stats(struct wlr_renderer *renderer,
+	struct wlr_vk_staging_stats *stats);
+
 bool wlr_renderer_is_vk(struct wlr_renderer *wlr_renderer);
 bool wlr_texture_is_vk(struct wlr_texture *texture);
 
@@ -56,6 +56,8 @@ struct wlr_renderer {
 	// private state
 
 	const struct wlr_renderer_impl *impl;
+
+	size_t texture_budget; // in bytes, 0 if unlimited
 };
 
 /**
@@ -98,6 +100,19 @@ bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
  */
 int wlr_renderer_get_drm_fd(struct wlr_renderer *r);
 
+/**
+ * Set the amount of memory textures may use, in bytes. 0 means unlimited,
+ * which is the default.
+ *
+ * The budget is enforced by struct wlr_scene: when exceeded, the textures of
+ * scene buffers which aren't visible on any output are evicted in least
+ * recently used order, and re-created when they become visible again.
+ * Evictions happen from the event loop after frames have been built, a few
+ * textures at a time, and read textures back asynchronously when the renderer
+ * supports it. Texture sizes are estimated at 4 bytes per pixel.
+ */
+void wlr_renderer_set_texture_budget(struct wlr_renderer *r, size_t budget);
+
 /**
  * Destroys the renderer.
  *
@@ -18,6 +18,7 @@
 struct wlr_buffer;
 struct wlr_renderer;
 struct wlr_texture_impl;
+struct wlr_texture_read_pixels_request_impl;
 
 struct wlr_texture {
 	const struct wlr_texture_impl *impl;
@@ -42,6 +43,62 @@ struct wlr_texture_read_pixels_options {
 bool wlr_texture_read_pixels(struct wlr_texture *texture,
 	const struct wlr_texture_read_pixels_options *options);
 
+struct wlr_texture_read_pixels_async_options {
+	/** Format used for the pixel data */
+	uint32_t format;
+	/** Source box of the texture to read from. If empty, the full texture is assumed. */
+	struct wlr_box src_box;
+};
+
+/**
+ * An asynchronous read-back started with wlr_texture_read_pixels_async().
+ */
+struct wlr_texture_read_pixels_request {
+	const struct wlr_texture_read_pixels_request_impl *impl;
+
+	uint32_t format;
+	uint32_t width, height;
+	bool ready;
+
+	struct {
+		struct wl_signal ready;
+	} events;
+
+	// private state
+
+	struct wl_event_source *event_source;
+	int sync_file_fd;
+	bool emitting_ready, destroy_pending;
+};
+
+/**
+ * Start reading pixels from the texture into a staging buffer, without waiting
+ * for the renderer to finish. The ready event is emitted from the event loop
+ * once the pixels can be retrieved with wlr_texture_read_pixels_request_copy().
+ *
+ * The texture may be destroyed before the request is ready. Returns NULL on
+ * failure.
+ */
+struct wlr_texture_read_pixels_request *wlr_texture_read_pixels_async(
+	struct wlr_texture *texture, struct wl_event_loop *loop,
+	const struct wlr_texture_read_pixels_async_options *options);
+
+/**
+ * Copy the pixels of a ready request into memory. `stride` is in bytes.
+ */
+bool wlr_texture_read_pixels_request_copy(
+	struct wlr_texture_read_pixels_request *request, void *data,
+	uint32_t stride);
+
+/**
+ * Destroy the request, cancelling it if it isn't ready yet.
+ *
+ * This may be called from a ready event listener: the request is then freed
+ * once all listeners have been notified.
+ */
+void wlr_texture_read_pixels_request_destroy(
+	struct wlr_texture_read_pixels_request *request);
+
 uint32_t wlr_texture_preferred_read_format(struct wlr_texture *texture);
 
 /**
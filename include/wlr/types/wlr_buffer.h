@@ -16,6 +16,7 @@
 
 struct wlr_buffer;
 struct wlr_renderer;
+struct wlr_texture_read_pixels_request;
 
 struct wlr_shm_attributes {
 	int fd;
@@ -141,6 +142,9 @@ struct wlr_client_buffer {
 	/**
 	 * The buffer's texture, if any. A buffer will not have a texture if the
 	 * client destroys the buffer before it has been released.
+	 *
+	 * The texture may be out of date if uploads are deferred, use
+	 * wlr_client_buffer_get_texture() to access it.
 	 */
 	struct wlr_texture *texture;
 	/**
@@ -154,6 +158,14 @@ struct wlr_client_buffer {
 	struct wl_listener renderer_destroy;
 
 	size_t n_ignore_locks;
+
+	struct wlr_renderer *renderer; // NULL if destroyed
+	// Buffer whose contents haven't been uploaded to the texture yet, locked
+	struct wlr_buffer *pending;
+	pixman_region32_t pending_damage;
+	// Read-back of the texture before evicting it, NULL if none
+	struct wlr_texture_read_pixels_request *evict_request;
+	struct wl_listener evict_ready;
 };
 
 /**
@@ -162,4 +174,11 @@ struct wlr_client_buffer {
  */
 struct wlr_client_buffer *wlr_client_buffer_get(struct wlr_buffer *buffer);
 
+/**
+ * Get the client buffer's texture, uploading pending contents first if
+ * necessary. Returns NULL if the buffer has no texture.
+ */
+struct wlr_texture *wlr_client_buffer_get_texture(
+	struct wlr_client_buffer *client_buffer);
+
 #endif
@@ -267,10 +267,24 @@ struct wlr_surface {
 
 struct wlr_renderer;
 
+/**
+ * Texture upload statistics, see wlr_compositor_set_deferred_upload().
+ */
+struct wlr_compositor_upload_stats {
+	uint64_t uploads_deferred; // commits whose upload was deferred
+	uint64_t uploads_skipped; // deferred uploads superseded before happening
+	uint64_t bytes_saved; // bytes not copied thanks to skipped uploads
+};
+
 struct wlr_compositor {
 	struct wl_global *global;
 	struct wlr_renderer *renderer; // may be NULL
 
+	// private state
+
+	bool deferred_upload;
+	struct wlr_compositor_upload_stats upload_stats;
+
 	struct wl_listener display_destroy;
 	struct wl_listener renderer_destroy;
 
@@ -563,4 +577,25 @@ struct wlr_compositor *wlr_compositor_create(struct wl_display *display,
 void wlr_compositor_set_renderer(struct wlr_compositor *compositor,
 	struct wlr_renderer *renderer);
 
+/**
+ * Defer texture uploads until the texture is needed.
+ *
+ * When enabled, client buffers are not uploaded on surface commit. Instead,
+ * the buffer is kept locked and damage accumulates until the texture is
+ * accessed, e.g. via wlr_surface_get_texture() or when a struct wlr_scene
+ * node displaying the surface is rendered. Surfaces which aren't visible on
+ * any output don't cost uploads, but their buffers are only released once
+ * they become visible or are replaced by a newer commit.
+ *
+ * Disabled by default.
+ */
+void wlr_compositor_set_deferred_upload(struct wlr_compositor *compositor,
+	bool deferred);
+
+/**
+ * Get texture upload statistics.
+ */
+void wlr_compositor_get_upload_stats(struct wlr_compositor *compositor,
+	struct wlr_compositor_upload_stats *stats);
+
 #endif
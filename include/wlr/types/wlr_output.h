@@ -214,6 +214,7 @@ struct wlr_output {
 	struct wlr_allocator *allocator;
 	struct wlr_renderer *renderer;
 	struct wlr_swapchain *swapchain;
+	int swapchain_idle_trim_msec; // 0 if disabled
 
 	struct wl_listener display_destroy;
 
@@ -314,6 +315,16 @@ struct wlr_output_mode *wlr_output_preferred_mode(struct wlr_output *output);
  */
 void wlr_output_set_name(struct wlr_output *output, const char *name);
 void wlr_output_set_description(struct wlr_output *output, const char *desc);
+/**
+ * Release primary swapchain buffers which haven't been used for idle_msec
+ * milliseconds, down to two buffers. Setting idle_msec to 0 disables
+ * trimming.
+ *
+ * This applies to the output's own swapchain and to swapchains created by
+ * wlr_output_configure_primary_swapchain(). The default is taken from the
+ * WLR_SWAPCHAIN_IDLE_TRIM environment variable.
+ */
+void wlr_output_set_swapchain_idle_trim(struct wlr_output *output, int idle_msec);
 /**
  * Schedule a done event.
  *
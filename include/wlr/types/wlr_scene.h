@@ -91,6 +91,22 @@ struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	// private state
+
+	// Bounding box of all enabled descendants, relative to this tree. Only
+	// valid if bounds_dirty is false.
+	struct wlr_box bounds;
+	bool bounds_dirty;
+
+	// Offscreen cache, see wlr_scene_tree_set_cached()
+	bool cached;
+	bool cache_dirty;
+	float cache_scale;
+	struct wlr_buffer *cache_buffer;
+	struct wlr_texture *cache_texture;
+
+	struct wl_listener cache_renderer_destroy;
 };
 
 /** The root scene-graph node. */
@@ -103,14 +119,55 @@ struct wlr_scene {
 	struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1;
 	struct wlr_gamma_control_manager_v1 *gamma_control_manager_v1;
 
+	// Read-only statistics about the last visibility update
+	struct {
+		// Number of nodes intersecting the updated region
+		size_t visibility_nodes_visited;
+		// Number of nodes whose visible region actually changed
+		size_t visibility_nodes_updated;
+	} stats;
+
+	// Read-only statistics about texture evictions, see
+	// wlr_renderer_set_texture_budget()
+	struct {
+		uint64_t textures_evicted;
+		uint64_t bytes_evicted;
+	} texture_stats;
+
 	// private state
 
 	struct wl_listener linux_dmabuf_v1_destroy;
 	struct wl_listener gamma_control_manager_v1_destroy;
 	struct wl_listener gamma_control_manager_v1_set_gamma;
 
+	// Updates deferred by wlr_scene_transaction_begin()
+	int transaction_depth;
+	pixman_region32_t transaction_update_region;
+	pixman_region32_t transaction_damage;
+
+	// Incremented whenever the structure of the scene (node visibility,
+	// stacking order, position or size) changes
+	uint64_t generation;
+
+	// Scene buffers whose texture has been rendered, most recently used first
+	struct wl_list textures; // wlr_scene_buffer.texture_link
+	// Enforces texture budgets after frames have been built
+	struct wl_event_source *texture_budget_idle;
+
+	// Worker threads for wlr_scene_outputs_prepare(), created lazily
+	struct thread_pool *thread_pool;
+
+	// Boxes of the enabled outputs sorted by x coordinate, rebuilt lazily
+	struct wl_array output_boxes; // struct scene_output_box
+	int output_boxes_max_width;
+	bool output_boxes_dirty;
+	// Outputs indexed by wlr_scene_output.index, may contain NULL entries
+	struct wl_array outputs_by_index; // struct wlr_scene_output *
+
 	enum wlr_scene_debug_damage_option debug_damage_option;
 	bool direct_scanout;
+	bool output_layers;
+	bool alpha_scan;
 	bool calculate_visibility;
 	bool highlight_transparent_region;
 };
@@ -133,6 +190,10 @@ struct wlr_scene_surface {
 	struct wl_listener frame_done;
 	struct wl_listener surface_destroy;
 	struct wl_listener surface_commit;
+
+	// Buffer whose alpha scan was deferred by the rate limit, locked
+	struct wlr_buffer *scan_buffer;
+	struct wl_event_source *scan_timer;
 };
 
 /** A scene-graph node displaying a solid-colored rectangle */
@@ -187,8 +248,10 @@ struct wlr_scene_buffer {
 
 	// private state
 
-	uint64_t active_outputs;
+	struct wl_array active_outputs; // bitset of wlr_scene_output.index
+	struct wl_list primary_output_link; // wlr_scene_output.primary_buffers
 	struct wlr_texture *texture;
+	struct wl_list texture_link; // wlr_scene.textures
 	struct wlr_linux_dmabuf_feedback_v1_init_options prev_feedback_options;
 
 	bool own_buffer;
@@ -198,6 +261,13 @@ struct wlr_scene_buffer {
 	struct wlr_drm_syncobj_timeline *wait_timeline;
 	uint64_t wait_point;
 
+	// Opaque region derived from the alpha channel of the buffer contents, in
+	// buffer-local coordinates, see WLR_SCENE_ENABLE_ALPHA_SCAN
+	pixman_region32_t scanned_opaque;
+	pixman_region32_t scan_pending; // damage not scanned yet
+	int scanned_width, scanned_height;
+	int64_t last_scan_msec;
+
 	struct wl_listener buffer_release;
 	struct wl_listener renderer_destroy;
 };
@@ -221,7 +291,7 @@ struct wlr_scene_output {
 
 	pixman_region32_t pending_commit_damage;
 
-	uint8_t index;
+	size_t index;
 	bool prev_scanout;
 
 	bool gamma_lut_changed;
@@ -233,7 +303,24 @@ struct wlr_scene_output {
 
 	struct wl_list damage_highlight_regions;
 
+	// Scene buffers whose primary output is this output
+	struct wl_list primary_buffers; // wlr_scene_buffer.primary_output_link
+
 	struct wl_array render_list;
+	// Scene generation and output geometry the render list was built for
+	uint64_t render_list_generation;
+	struct wlr_box render_list_box;
+	float render_list_scale;
+	enum wl_output_transform render_list_transform;
+	// Union of the opaque regions of the render list, in buffer-local
+	// coordinates
+	pixman_region32_t render_list_opaque;
+	// Set by wlr_scene_outputs_prepare(), cleared when the output is damaged
+	// or once the next frame has been built
+	bool render_list_prepared;
+
+	struct wl_array layers; // struct wlr_output_layer_state
+	int layers_offloaded;
 
 	struct wlr_drm_syncobj_timeline *in_timeline;
 	uint64_t in_point;
@@ -325,6 +412,34 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
  */
 struct wlr_scene *wlr_scene_create(void);
 
+/**
+ * Get the estimated amount of texture memory used by a client's surfaces in
+ * the scene, in bytes. Only textures which are currently allocated are
+ * accounted, once even if several surfaces show the same buffer.
+ */
+size_t wlr_scene_get_client_texture_memory(struct wlr_scene *scene,
+	struct wl_client *client);
+
+/**
+ * Start batching scene-graph updates.
+ *
+ * Until the matching wlr_scene_transaction_commit() call, node mutations
+ * (position, stacking, parent, enabled state, size, etc.) don't recompute
+ * visibility, output enter/leave events and output damage individually.
+ * Instead, a single pass is performed over the union of all affected regions
+ * when the transaction is committed. This is useful when many nodes are
+ * changed at once, e.g. on a workspace switch.
+ *
+ * Transactions can be nested, in which case the updates are applied when the
+ * outermost transaction is committed. The scene should not be rendered while
+ * a transaction is in progress.
+ */
+void wlr_scene_transaction_begin(struct wlr_scene *scene);
+/**
+ * Apply the updates deferred since wlr_scene_transaction_begin().
+ */
+void wlr_scene_transaction_commit(struct wlr_scene *scene);
+
 /**
  * Handles linux_dmabuf_v1 feedback for all surfaces in the scene.
  *
@@ -347,6 +462,19 @@ void wlr_scene_set_gamma_control_manager_v1(struct wlr_scene *scene,
  */
 struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent);
 
+/**
+ * Enable or disable offscreen caching for a tree.
+ *
+ * A cached tree is rendered once into an offscreen buffer, which is re-used
+ * until a node inside the tree changes. The tree is then drawn as a single
+ * texture instead of node by node. This is useful for sub-trees made of many
+ * nodes which seldom change, such as server-side decorations or panels.
+ *
+ * The cache is rendered at the scale of the output being rendered, so a tree
+ * displayed on outputs with different scales is re-rendered for each of them.
+ */
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached);
+
 /**
  * Add a node displaying a single surface to the scene-graph.
  *
@@ -562,6 +690,21 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output,
 bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	struct wlr_output_state *state, const struct wlr_scene_output_state_options *options);
 
+/**
+ * Prepare the render lists of multiple outputs of the same scene ahead of
+ * wlr_scene_output_commit() or wlr_scene_output_build_state().
+ *
+ * The render lists and the occlusion culling data are built in parallel on
+ * worker threads, using the current state of each output. Rendering and
+ * buffer submission still happen on the calling thread when the outputs are
+ * committed. The results are used by the next frame built for each output,
+ * unless the output is damaged in between. Calling this function is optional:
+ * it is only useful for compositors driving several outputs with complex
+ * scenes at once.
+ */
+void wlr_scene_outputs_prepare(struct wlr_scene_output *const *scene_outputs,
+	size_t scene_outputs_len);
+
 /**
  * Retrieve the duration in nanoseconds between the last wlr_scene_output_commit() call and the end
  * of its operations, including those on the GPU that may have finished after the call returned.
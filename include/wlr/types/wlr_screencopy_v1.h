@@ -10,6 +10,7 @@
 #define WLR_TYPES_WLR_SCREENCOPY_V1_H
 
 #include <stdbool.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/box.h>
@@ -55,6 +56,12 @@ struct wlr_screencopy_frame_v1 {
 	struct wl_listener output_enable;
 
 	void *data;
+
+	// private state
+
+	struct wlr_texture_read_pixels_request *read_pixels;
+	struct wl_listener read_pixels_ready;
+	struct timespec when;
 };
 
 struct wlr_screencopy_manager_v1 *wlr_screencopy_manager_v1_create(
@@ -9,10 +9,25 @@
 #ifndef WLR_TYPES_WLR_SHM_H
 #define WLR_TYPES_WLR_SHM_H
 
+#include <stdbool.h>
 #include <wayland-server-core.h>
 
 struct wlr_renderer;
 
+/**
+ * Shared memory pool statistics.
+ *
+ * A pool is sealed if the client has sealed its file with F_SEAL_SHRINK. The
+ * file then can't be truncated under the compositor, so accessing buffers
+ * from such pools skips installing a SIGBUS handler.
+ */
+struct wlr_shm_stats {
+	size_t pools; // live pools
+	size_t sealed_pools; // live pools which are currently sealed
+	uint64_t accesses; // buffer data pointer accesses
+	uint64_t sealed_accesses; // accesses which skipped the SIGBUS handler
+};
+
 /**
  * Shared memory buffer interface.
  *
@@ -30,6 +45,10 @@ struct wlr_shm {
 	uint32_t *formats;
 	size_t formats_len;
 
+	struct wlr_shm_stats stats;
+	bool udmabuf;
+	struct wl_list pools; // wlr_shm_pool.link
+
 	struct wl_listener display_destroy;
 };
 
@@ -50,4 +69,24 @@ struct wlr_shm *wlr_shm_create(struct wl_display *display, uint32_t version,
 struct wlr_shm *wlr_shm_create_with_renderer(struct wl_display *display,
 	uint32_t version, struct wlr_renderer *renderer);
 
+/**
+ * Enable zero-copy import of shared memory buffers.
+ *
+ * When enabled, textures created from buffers of pools sealed with
+ * F_SEAL_SHRINK import a DMA-BUF created via /dev/udmabuf, so that renderers
+ * can sample from the client's memory directly instead of uploading it on each
+ * commit. The buffers are still regular shared memory buffers otherwise, e.g.
+ * wlr_buffer_get_dmabuf() fails for them. Buffers imported this way are only
+ * released once the renderer is done with them. Renderers fall back to copying
+ * if the import fails.
+ *
+ * Only applies to pools created afterwards. Disabled by default.
+ */
+void wlr_shm_set_udmabuf(struct wlr_shm *shm, bool enabled);
+
+/**
+ * Get shared memory pool statistics.
+ */
+void wlr_shm_get_stats(struct wlr_shm *shm, struct wlr_shm_stats *stats);
+
 #endif
@@ -15,3 +15,7 @@ int dmabuf_export_sync_file(int dmabuf_fd, uint32_t flags) {
 	wlr_log(WLR_ERROR, "DMA-BUF sync_file export IOCTL not available on this system");
 	return false;
 }
+
+int dmabuf_create_from_memfd(int memfd, uint64_t offset, uint64_t size) {
+	return -1;
+}
@@ -1,12 +1,19 @@
+#include <fcntl.h>
 #include <linux/dma-buf.h>
 #include <linux/version.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/utsname.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 
+#include "config.h"
 #include "render/dmabuf.h"
 
+#if HAVE_UDMABUF
+#include <linux/udmabuf.h>
+#endif
+
 bool dmabuf_check_sync_file_import_export(void) {
 	/* Unfortunately there's no better way to check the availability of the
 	 * IOCTL than to check the kernel version. See the discussion at:
@@ -97,3 +104,29 @@ int dmabuf_export_sync_file(int dmabuf_fd, uint32_t flags) {
 	}
 	return data.fd;
 }
+
+int dmabuf_create_from_memfd(int memfd, uint64_t offset, uint64_t size) {
+#if HAVE_UDMABUF
+	int udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (udmabuf_fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open /dev/udmabuf");
+		return -1;
+	}
+
+	struct udmabuf_create create = {
+		.memfd = memfd,
+		.flags = UDMABUF_FLAGS_CLOEXEC,
+		.offset = offset,
+		.size = size,
+	};
+	int dmabuf_fd = drmIoctl(udmabuf_fd, UDMABUF_CREATE, &create);
+	if (dmabuf_fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "drmIoctl(UDMABUF_CREATE) failed");
+	}
+	close(udmabuf_fd);
+	return dmabuf_fd;
+#else
+	wlr_log(WLR_DEBUG, "udmabuf is unavailable");
+	return -1;
+#endif
+}
@@ -1,19 +1,22 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <pixman.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <wlr/render/color.h>
 #include <wlr/render/drm_syncobj.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/util/transform.h>
+#include "render/color.h"
 #include "render/egl.h"
 #include "render/gles2.h"
 #include "types/wlr_matrix.h"
 
-#define MAX_QUADS 86 // 4kb
-
 static const struct wlr_render_pass_impl render_pass_impl;
 
+static void apply_lut_3d(struct wlr_gles2_render_pass *pass);
+
 static struct wlr_gles2_render_pass *get_render_pass(struct wlr_render_pass *wlr_pass) {
 	assert(wlr_pass->impl == &render_pass_impl);
 	struct wlr_gles2_render_pass *pass = wl_container_of(wlr_pass, pass, base);
@@ -26,6 +29,12 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_gles2_render_timer *timer = pass->timer;
 	bool ok = false;
 
+	if (pass->output_fbo != 0) {
+		apply_lut_3d(pass);
+	}
+	gles2_flush_render_batch(renderer);
+	renderer->last_pass_draw_calls = pass->draw_calls;
+
 	push_gles2_debug(renderer);
 
 	if (timer) {
@@ -70,13 +79,171 @@ out:
 	wlr_egl_restore_context(&pass->prev_ctx);
 
 	wlr_drm_syncobj_timeline_unref(pass->signal_timeline);
+	wlr_color_transform_unref(pass->color_transform);
 	wlr_buffer_unlock(pass->buffer->buffer);
+	wl_array_release(&pass->batch.verts);
+	rect_union_finish(&pass->updated_region);
 	free(pass);
 
 	return ok;
 }
 
-static void render(const struct wlr_box *box, const pixman_region32_t *clip, GLint attrib) {
+static void setup_blending(enum wlr_render_blend_mode mode) {
+	switch (mode) {
+	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
+		glEnable(GL_BLEND);
+		break;
+	case WLR_RENDER_BLEND_MODE_NONE:
+		glDisable(GL_BLEND);
+		break;
+	}
+}
+
+static void setup_filtering(GLenum target, enum wlr_scale_filter_mode mode) {
+	switch (mode) {
+	case WLR_SCALE_FILTER_BILINEAR:
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		break;
+	case WLR_SCALE_FILTER_NEAREST:
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		break;
+	}
+}
+
+/**
+ * Get the 3D LUT applied to the output of the pass, if any.
+ */
+static struct wlr_gles2_color_transform *get_lut_3d(
+		struct wlr_gles2_render_pass *pass) {
+	struct wlr_gles2_color_transform *transform = pass->gles2_color_transform;
+	if (transform == NULL || transform->lut_3d == 0) {
+		return NULL;
+	}
+	return transform;
+}
+
+static void flush_batch(struct wlr_gles2_render_pass *pass) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	struct wlr_gles2_render_batch *batch = &pass->batch;
+	if (batch->verts.size == 0) {
+		return;
+	}
+
+	push_gles2_debug(renderer);
+
+	// Other operations may have bound another framebuffer in the meantime
+	glBindFramebuffer(GL_FRAMEBUFFER, pass->fbo);
+	glViewport(0, 0, pass->buffer->buffer->width, pass->buffer->buffer->height);
+
+	setup_blending(batch->blend_mode);
+	glUseProgram(batch->program);
+	glUniformMatrix3fv(batch->proj, 1, GL_FALSE, pass->projection_matrix);
+
+	if (batch->tex != 0) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(batch->target, batch->tex);
+		setup_filtering(batch->target, batch->filter_mode);
+		glUniform1i(batch->tex_uniform, 0);
+		glUniform1f(batch->alpha_uniform, batch->color[3]);
+	} else {
+		glUniform4f(batch->color_uniform, batch->color[0], batch->color[1],
+			batch->color[2], batch->color[3]);
+	}
+
+	// Only the final copy of the blend FBO uses a LUT program
+	struct wlr_gles2_color_transform *lut_3d =
+		batch->lut.lut_3d >= 0 ? get_lut_3d(pass) : NULL;
+	if (lut_3d != NULL) {
+		// Same mapping of [0, 1] to the texel centers as the Vulkan renderer
+		float dim = lut_3d->dim;
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(lut_3d->target, lut_3d->lut_3d);
+		glUniform1i(batch->lut.lut_3d, 1);
+		glUniform1f(batch->lut.offset, 0.5f / dim);
+		glUniform1f(batch->lut.scale, (dim - 1) / dim);
+		if (batch->lut.dim >= 0) {
+			glUniform1f(batch->lut.dim, dim);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	const GLfloat *verts = batch->verts.data;
+	GLsizei stride = 4 * sizeof(GLfloat);
+	glEnableVertexAttribArray(batch->pos_attrib);
+	glVertexAttribPointer(batch->pos_attrib, 2, GL_FLOAT, GL_FALSE, stride, verts);
+	if (batch->texcoord_attrib >= 0) {
+		glEnableVertexAttribArray(batch->texcoord_attrib);
+		glVertexAttribPointer(batch->texcoord_attrib, 2, GL_FLOAT, GL_FALSE,
+			stride, verts + 2);
+	}
+
+	glDrawArrays(GL_TRIANGLES, 0, batch->verts.size / stride);
+	pass->draw_calls++;
+
+	if (batch->texcoord_attrib >= 0) {
+		glDisableVertexAttribArray(batch->texcoord_attrib);
+	}
+	glDisableVertexAttribArray(batch->pos_attrib);
+
+	if (batch->tex != 0) {
+		glBindTexture(batch->target, 0);
+	}
+	if (lut_3d != NULL) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(lut_3d->target, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	pop_gles2_debug(renderer);
+
+	batch->verts.size = 0;
+	renderer->batch_pass = NULL;
+}
+
+void gles2_flush_render_batch(struct wlr_gles2_renderer *renderer) {
+	if (renderer->batch_pass != NULL) {
+		flush_batch(renderer->batch_pass);
+	}
+}
+
+/**
+ * Make the batch of the pass use the given state, submitting the pending
+ * draws first if they use a different one.
+ */
+static void prepare_batch(struct wlr_gles2_render_pass *pass,
+		const struct wlr_gles2_render_batch *state) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	struct wlr_gles2_render_batch *batch = &pass->batch;
+
+	// A nested render pass may have left draws pending
+	if (renderer->batch_pass != NULL && renderer->batch_pass != pass) {
+		flush_batch(renderer->batch_pass);
+	}
+
+	if (batch->verts.size > 0 &&
+			batch->program == state->program &&
+			batch->target == state->target &&
+			batch->tex == state->tex &&
+			batch->filter_mode == state->filter_mode &&
+			batch->blend_mode == state->blend_mode &&
+			memcmp(batch->color, state->color, sizeof(batch->color)) == 0) {
+		return;
+	}
+
+	flush_batch(pass);
+
+	struct wl_array verts = batch->verts;
+	*batch = *state;
+	batch->verts = verts;
+}
+
+static void batch_add_quads(struct wlr_gles2_render_pass *pass,
+		const struct wlr_box *box, const pixman_region32_t *clip,
+		const float tex_matrix[static 9]) {
+	struct wlr_gles2_render_batch *batch = &pass->batch;
+
 	pixman_region32_t region;
 	pixman_region32_init_rect(&region, box->x, box->y, box->width, box->height);
 
@@ -91,52 +258,47 @@ static void render(const struct wlr_box *box, const pixman_region32_t *clip, GLi
 		return;
 	}
 
-	glEnableVertexAttribArray(attrib);
-
-	for (int i = 0; i < rects_len;) {
-		int batch = rects_len - i < MAX_QUADS ? rects_len - i : MAX_QUADS;
-		int batch_end = batch + i;
-
-		size_t vert_index = 0;
-		GLfloat verts[MAX_QUADS * 6 * 2];
-		for (; i < batch_end; i++) {
-			const pixman_box32_t *rect = &rects[i];
-
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
+	GLfloat *verts = wl_array_add(&batch->verts,
+		rects_len * 6 * 4 * sizeof(GLfloat));
+	if (verts == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		pixman_region32_fini(&region);
+		return;
+	}
+
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		if (pass->output_fbo != 0) {
+			rect_union_add(&pass->updated_region, *rect);
 		}
 
-		glVertexAttribPointer(attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glDrawArrays(GL_TRIANGLES, 0, batch * 6);
+		const int corners[6][2] = {
+			{ rect->x1, rect->y1 },
+			{ rect->x2, rect->y1 },
+			{ rect->x1, rect->y2 },
+			{ rect->x2, rect->y1 },
+			{ rect->x2, rect->y2 },
+			{ rect->x1, rect->y2 },
+		};
+
+		for (size_t j = 0; j < 6; j++) {
+			GLfloat x = corners[j][0], y = corners[j][1];
+			GLfloat u = (x - box->x) / box->width;
+			GLfloat v = (y - box->y) / box->height;
+
+			*verts++ = x;
+			*verts++ = y;
+			*verts++ = tex_matrix[0] * u + tex_matrix[1] * v + tex_matrix[2];
+			*verts++ = tex_matrix[3] * u + tex_matrix[4] * v + tex_matrix[5];
+		}
 	}
 
-	glDisableVertexAttribArray(attrib);
-
+	pass->buffer->renderer->batch_pass = pass;
 	pixman_region32_fini(&region);
 }
 
-static void set_proj_matrix(GLint loc, float proj[9], const struct wlr_box *box) {
-	float gl_matrix[9];
-	wlr_matrix_identity(gl_matrix);
-	wlr_matrix_translate(gl_matrix, box->x, box->y);
-	wlr_matrix_scale(gl_matrix, box->width, box->height);
-	wlr_matrix_multiply(gl_matrix, proj, gl_matrix);
-	glUniformMatrix3fv(loc, 1, GL_FALSE, gl_matrix);
-}
-
-static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
-		const struct wlr_fbox *box) {
-	float tex_matrix[9];
+static void get_tex_matrix(float tex_matrix[static 9],
+		enum wl_output_transform trans, const struct wlr_fbox *box) {
 	wlr_matrix_identity(tex_matrix);
 	wlr_matrix_translate(tex_matrix, box->x, box->y);
 	wlr_matrix_scale(tex_matrix, box->width, box->height);
@@ -150,19 +312,6 @@ static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
 		wlr_matrix_transform(tex_matrix, trans);
 	}
 	wlr_matrix_translate(tex_matrix, -.5, -.5);
-
-	glUniformMatrix3fv(loc, 1, GL_FALSE, tex_matrix);
-}
-
-static void setup_blending(enum wlr_render_blend_mode mode) {
-	switch (mode) {
-	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
-		glEnable(GL_BLEND);
-		break;
-	case WLR_RENDER_BLEND_MODE_NONE:
-		glDisable(GL_BLEND);
-		break;
-	}
 }
 
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
@@ -170,22 +319,23 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_gles2_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
 	struct wlr_gles2_texture *texture = gles2_get_texture(options->texture);
+	const struct wlr_gles2_shaders *shaders = &renderer->shaders;
 
-	struct wlr_gles2_tex_shader *shader = NULL;
+	const struct wlr_gles2_tex_shader *shader = NULL;
 
 	switch (texture->target) {
 	case GL_TEXTURE_2D:
 		if (texture->has_alpha) {
-			shader = &renderer->shaders.tex_rgba;
+			shader = &shaders->tex_rgba;
 		} else {
-			shader = &renderer->shaders.tex_rgbx;
+			shader = &shaders->tex_rgbx;
 		}
 		break;
 	case GL_TEXTURE_EXTERNAL_OES:
 		// EGL_EXT_image_dma_buf_import_modifiers requires
 		// GL_OES_EGL_image_external
 		assert(renderer->exts.OES_egl_image_external);
-		shader = &renderer->shaders.tex_ext;
+		shader = &shaders->tex_ext;
 		break;
 	default:
 		abort();
@@ -202,9 +352,10 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	src_fbox.width /= options->texture->width;
 	src_fbox.height /= options->texture->height;
 
-	push_gles2_debug(renderer);
-
 	if (options->wait_timeline != NULL) {
+		// The wait only applies to commands issued after it
+		flush_batch(pass);
+
 		int sync_file_fd =
 			wlr_drm_syncobj_timeline_export_sync_file(options->wait_timeline, options->wait_point);
 		if (sync_file_fd < 0) {
@@ -224,56 +375,91 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		}
 	}
 
-	setup_blending(!texture->has_alpha && alpha == 1.0 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(shader->program);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->tex);
+	prepare_batch(pass, &(struct wlr_gles2_render_batch){
+		.program = shader->program,
+		.proj = shader->proj,
+		.pos_attrib = shader->pos_attrib,
+		.texcoord_attrib = shader->texcoord_attrib,
+		.tex_uniform = shader->tex,
+		.alpha_uniform = shader->alpha,
+		.lut = shader->lut,
+		.target = texture->target,
+		.tex = texture->tex,
+		.filter_mode = options->filter_mode,
+		.blend_mode = !texture->has_alpha && alpha == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode,
+		.color = { 0, 0, 0, alpha },
+	});
 
-	switch (options->filter_mode) {
-	case WLR_SCALE_FILTER_BILINEAR:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		break;
-	case WLR_SCALE_FILTER_NEAREST:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		break;
-	}
-
-	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
-	set_proj_matrix(shader->proj, pass->projection_matrix, &dst_box);
-	set_tex_matrix(shader->tex_proj, options->transform, &src_fbox);
-
-	render(&dst_box, options->clip, shader->pos_attrib);
-
-	glBindTexture(texture->target, 0);
-	pop_gles2_debug(renderer);
+	float tex_matrix[9];
+	get_tex_matrix(tex_matrix, options->transform, &src_fbox);
+	batch_add_quads(pass, &dst_box, options->clip, tex_matrix);
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_gles2_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	const struct wlr_gles2_quad_shader *shader =
+		&pass->buffer->renderer->shaders.quad;
 
 	const struct wlr_render_color *color = &options->color;
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
-	push_gles2_debug(renderer);
-	setup_blending(color->a == 1.0 ? WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(renderer->shaders.quad.program);
-
-	set_proj_matrix(renderer->shaders.quad.proj, pass->projection_matrix, &box);
-	glUniform4f(renderer->shaders.quad.color, color->r, color->g, color->b, color->a);
-
-	render(&box, options->clip, renderer->shaders.quad.pos_attrib);
+	prepare_batch(pass, &(struct wlr_gles2_render_batch){
+		.program = shader->program,
+		.proj = shader->proj,
+		.pos_attrib = shader->pos_attrib,
+		.texcoord_attrib = -1,
+		.color_uniform = shader->color,
+		.lut = shader->lut,
+		.blend_mode = color->a == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode,
+		.color = { color->r, color->g, color->b, color->a },
+	});
+
+	float identity[9];
+	wlr_matrix_identity(identity);
+	batch_add_quads(pass, &box, options->clip, identity);
+}
 
-	pop_gles2_debug(renderer);
+/**
+ * Copy the region updated by the pass from the blend FBO to the output
+ * through the 3D LUT. The LUT is applied after blending, so translucent
+ * content is transformed exactly like opaque content.
+ */
+static void apply_lut_3d(struct wlr_gles2_render_pass *pass) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	struct wlr_buffer *wlr_buffer = pass->buffer->buffer;
+	const struct wlr_gles2_tex_shader *shader = &renderer->lut_shaders.tex_rgba;
+
+	// Draws of the pass must land in the blend FBO first
+	flush_batch(pass);
+
+	const pixman_region32_t *updated = rect_union_evaluate(&pass->updated_region);
+	pass->fbo = pass->output_fbo;
+	pass->output_fbo = 0;
+
+	prepare_batch(pass, &(struct wlr_gles2_render_batch){
+		.program = shader->program,
+		.proj = shader->proj,
+		.pos_attrib = shader->pos_attrib,
+		.texcoord_attrib = shader->texcoord_attrib,
+		.tex_uniform = shader->tex,
+		.alpha_uniform = shader->alpha,
+		.lut = shader->lut,
+		.target = GL_TEXTURE_2D,
+		.tex = pass->buffer->blend_tex,
+		.filter_mode = WLR_SCALE_FILTER_NEAREST,
+		.blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+		.color = { 0, 0, 0, 1 },
+	});
+
+	// The blend FBO has the same layout as the output
+	struct wlr_box box = { .width = wlr_buffer->width, .height = wlr_buffer->height };
+	float identity[9];
+	wlr_matrix_identity(identity);
+	batch_add_quads(pass, &box, updated, identity);
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -297,6 +483,7 @@ static const char *reset_status_str(GLenum status) {
 
 struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *buffer,
 		struct wlr_egl_context *prev_ctx, struct wlr_gles2_render_timer *timer,
+		struct wlr_color_transform *color_transform,
 		struct wlr_drm_syncobj_timeline *signal_timeline, uint64_t signal_point) {
 	struct wlr_gles2_renderer *renderer = buffer->renderer;
 	struct wlr_buffer *wlr_buffer = buffer->buffer;
@@ -310,11 +497,33 @@ struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *b
 		}
 	}
 
+	// Draws of a parent render pass must land before this one starts
+	gles2_flush_render_batch(renderer);
+
 	GLint fbo = gles2_buffer_get_fbo(buffer);
 	if (!fbo) {
 		return NULL;
 	}
 
+	struct wlr_gles2_color_transform *gles2_color_transform = NULL;
+	if (color_transform != NULL) {
+		gles2_color_transform =
+			gles2_color_transform_get_or_create(renderer, color_transform);
+		if (gles2_color_transform == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create color transform");
+			return NULL;
+		}
+	}
+
+	// 3D LUTs are applied once the pass is done blending
+	GLuint blend_fbo = 0;
+	if (gles2_color_transform != NULL && gles2_color_transform->lut_3d != 0) {
+		blend_fbo = gles2_buffer_get_blend_fbo(buffer);
+		if (!blend_fbo) {
+			return NULL;
+		}
+	}
+
 	struct wlr_gles2_render_pass *pass = calloc(1, sizeof(*pass));
 	if (pass == NULL) {
 		return NULL;
@@ -323,7 +532,19 @@ struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *b
 	wlr_render_pass_init(&pass->base, &render_pass_impl);
 	wlr_buffer_lock(wlr_buffer);
 	pass->buffer = buffer;
+	if (blend_fbo != 0) {
+		pass->fbo = blend_fbo;
+		pass->output_fbo = fbo;
+	} else {
+		pass->fbo = fbo;
+	}
+	rect_union_init(&pass->updated_region);
 	pass->timer = timer;
+	if (color_transform != NULL) {
+		pass->color_transform = wlr_color_transform_ref(color_transform);
+		pass->gles2_color_transform = gles2_color_transform;
+	}
+	wl_array_init(&pass->batch.verts);
 	pass->prev_ctx = *prev_ctx;
 	if (signal_timeline != NULL) {
 		pass->signal_timeline = wlr_drm_syncobj_timeline_ref(signal_timeline);
@@ -334,7 +555,7 @@ struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *b
 		WL_OUTPUT_TRANSFORM_FLIPPED_180);
 
 	push_gles2_debug(renderer);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, pass->fbo);
 
 	glViewport(0, 0, wlr_buffer->width, wlr_buffer->height);
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -16,6 +16,7 @@
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
+#include "render/color.h"
 #include "render/egl.h"
 #include "render/gles2.h"
 #include "render/pixel_format.h"
@@ -27,6 +28,7 @@
 #include "tex_rgba_frag_src.h"
 #include "tex_rgbx_frag_src.h"
 #include "tex_external_frag_src.h"
+#include "output_frag_src.h"
 
 static const struct wlr_renderer_impl renderer_impl;
 static const struct wlr_render_timer_impl render_timer_impl;
@@ -59,11 +61,15 @@ static void destroy_buffer(struct wlr_gles2_buffer *buffer) {
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_make_current(buffer->renderer->egl, &prev_ctx);
 
+	gles2_flush_render_batch(buffer->renderer);
+
 	push_gles2_debug(buffer->renderer);
 
 	glDeleteFramebuffers(1, &buffer->fbo);
 	glDeleteRenderbuffers(1, &buffer->rbo);
 	glDeleteTextures(1, &buffer->tex);
+	glDeleteFramebuffers(1, &buffer->blend_fbo);
+	glDeleteTextures(1, &buffer->blend_tex);
 
 	pop_gles2_debug(buffer->renderer);
 
@@ -123,6 +129,76 @@ GLuint gles2_buffer_get_fbo(struct wlr_gles2_buffer *buffer) {
 	return buffer->fbo;
 }
 
+GLuint gles2_buffer_get_blend_fbo(struct wlr_gles2_buffer *buffer) {
+	if (buffer->blend_fbo) {
+		return buffer->blend_fbo;
+	}
+
+	struct wlr_gles2_renderer *renderer = buffer->renderer;
+
+	// Blending happens before the LUT is applied, so an 8-bit blend FBO
+	// would band. Prefer higher precision formats if they are renderable.
+	struct {
+		bool supported;
+		GLint internal_format;
+		GLenum type;
+		const char *name;
+	} candidates[] = {
+		{
+			renderer->exts.OES_texture_half_float_linear &&
+				renderer->exts.EXT_color_buffer_half_float,
+			GL_RGBA, GL_HALF_FLOAT_OES, "half-float",
+		},
+		{
+			renderer->exts.EXT_texture_norm16,
+			GL_RGBA16_EXT, GL_UNSIGNED_SHORT, "16-bit",
+		},
+		{ true, GL_RGBA, GL_UNSIGNED_BYTE, "8-bit" },
+	};
+
+	push_gles2_debug(renderer);
+
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		if (!candidates[i].supported) {
+			continue;
+		}
+
+		// Holds the same sRGB-encoded values the buffer would without a LUT
+		glGenTextures(1, &buffer->blend_tex);
+		glBindTexture(GL_TEXTURE_2D, buffer->blend_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, candidates[i].internal_format,
+			buffer->buffer->width, buffer->buffer->height, 0, GL_RGBA,
+			candidates[i].type, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &buffer->blend_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, buffer->blend_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, buffer->blend_tex, 0);
+		GLenum fb_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (fb_status == GL_FRAMEBUFFER_COMPLETE) {
+			wlr_log(WLR_DEBUG, "Created %s blend FBO", candidates[i].name);
+			break;
+		}
+
+		wlr_log(WLR_DEBUG, "Failed to create %s blend FBO", candidates[i].name);
+		glDeleteFramebuffers(1, &buffer->blend_fbo);
+		glDeleteTextures(1, &buffer->blend_tex);
+		buffer->blend_fbo = 0;
+		buffer->blend_tex = 0;
+	}
+
+	if (buffer->blend_fbo == 0) {
+		wlr_log(WLR_ERROR, "Failed to create blend FBO");
+	}
+
+	pop_gles2_debug(renderer);
+
+	return buffer->blend_fbo;
+}
+
 struct wlr_gles2_buffer *gles2_buffer_get_or_create(struct wlr_gles2_renderer *renderer,
 		struct wlr_buffer *wlr_buffer) {
 	struct wlr_addon *addon =
@@ -166,6 +242,152 @@ error_buffer:
 	return NULL;
 }
 
+void gles2_color_transform_destroy(struct wlr_gles2_color_transform *transform) {
+	wl_list_remove(&transform->link);
+	wlr_addon_finish(&transform->addon);
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_make_current(transform->renderer->egl, &prev_ctx);
+
+	gles2_flush_render_batch(transform->renderer);
+
+	push_gles2_debug(transform->renderer);
+	glDeleteTextures(1, &transform->lut_3d);
+	pop_gles2_debug(transform->renderer);
+
+	wlr_egl_restore_context(&prev_ctx);
+
+	free(transform);
+}
+
+static void handle_color_transform_destroy(struct wlr_addon *addon) {
+	struct wlr_gles2_color_transform *transform =
+		wl_container_of(addon, transform, addon);
+	gles2_color_transform_destroy(transform);
+}
+
+static const struct wlr_addon_interface color_transform_addon_impl = {
+	.name = "wlr_gles2_color_transform",
+	.destroy = handle_color_transform_destroy,
+};
+
+static bool upload_lut_3d(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_color_transform *transform,
+		const struct wlr_color_transform_lut3d *lut_3d) {
+	size_t dim = lut_3d->dim_len;
+	bool packed = renderer->lut_output_transform ==
+		WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D_PACKED;
+
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (packed && dim * dim > (size_t)max_size) {
+		wlr_log(WLR_ERROR, "3D LUT of size %zu exceeds the maximum texture size",
+			dim);
+		return false;
+	}
+
+	// Use 16-bit channels if possible, 8-bit quantization is visible on
+	// smooth gradients
+	bool norm16 = renderer->exts.EXT_texture_norm16;
+	size_t bytes_per_channel = norm16 ? sizeof(uint16_t) : sizeof(uint8_t);
+	size_t len = dim * dim * dim * 4;
+	void *data = malloc(len * bytes_per_channel);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	for (size_t b_index = 0; b_index < dim; b_index++) {
+		for (size_t g_index = 0; g_index < dim; g_index++) {
+			for (size_t r_index = 0; r_index < dim; r_index++) {
+				size_t sample_index = r_index + dim * g_index + dim * dim * b_index;
+				size_t src_offset = 3 * sample_index;
+
+				// Packed LUTs have the blue slices side by side on each row
+				size_t dst_index = packed ?
+					r_index + dim * b_index + dim * dim * g_index : sample_index;
+				size_t dst_offset = 4 * dst_index;
+
+				for (size_t i = 0; i < 4; i++) {
+					float v = i < 3 ? lut_3d->lut_3d[src_offset + i] : 1;
+					v = v < 0 ? 0 : (v > 1 ? 1 : v);
+					if (norm16) {
+						((uint16_t *)data)[dst_offset + i] = v * UINT16_MAX + 0.5f;
+					} else {
+						((uint8_t *)data)[dst_offset + i] = v * UINT8_MAX + 0.5f;
+					}
+				}
+			}
+		}
+	}
+
+	GLint internal_format = norm16 ? GL_RGBA16_EXT : GL_RGBA;
+	GLenum type = norm16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+
+	push_gles2_debug(renderer);
+
+	transform->target = packed ? GL_TEXTURE_2D : GL_TEXTURE_3D_OES;
+	glGenTextures(1, &transform->lut_3d);
+	glBindTexture(transform->target, transform->lut_3d);
+	glTexParameteri(transform->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(transform->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(transform->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(transform->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (packed) {
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, dim * dim, dim, 0,
+			GL_RGBA, type, data);
+	} else {
+		glTexParameteri(GL_TEXTURE_3D_OES, GL_TEXTURE_WRAP_R_OES, GL_CLAMP_TO_EDGE);
+		renderer->procs.glTexImage3DOES(GL_TEXTURE_3D_OES, 0, internal_format,
+			dim, dim, dim, 0, GL_RGBA, type, data);
+	}
+	glBindTexture(transform->target, 0);
+
+	pop_gles2_debug(renderer);
+
+	free(data);
+
+	transform->dim = dim;
+	return true;
+}
+
+struct wlr_gles2_color_transform *gles2_color_transform_get_or_create(
+		struct wlr_gles2_renderer *renderer, struct wlr_color_transform *wlr_transform) {
+	struct wlr_addon *addon = wlr_addon_find(&wlr_transform->addons, renderer,
+		&color_transform_addon_impl);
+	if (addon) {
+		struct wlr_gles2_color_transform *transform =
+			wl_container_of(addon, transform, addon);
+		return transform;
+	}
+
+	struct wlr_gles2_color_transform *transform = calloc(1, sizeof(*transform));
+	if (transform == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	transform->renderer = renderer;
+
+	switch (wlr_transform->type) {
+	case COLOR_TRANSFORM_SRGB:
+		// Nothing to do, the GLES2 renderer blends sRGB-encoded values
+		break;
+	case COLOR_TRANSFORM_LUT_3D:
+		if (!upload_lut_3d(renderer, transform,
+				wlr_color_transform_lut3d_from_base(wlr_transform))) {
+			free(transform);
+			return NULL;
+		}
+		break;
+	}
+
+	wlr_addon_init(&transform->addon, &wlr_transform->addons, renderer,
+		&color_transform_addon_impl);
+	wl_list_insert(&renderer->color_transforms, &transform->link);
+
+	return transform;
+}
+
 static const struct wlr_drm_format_set *gles2_get_texture_formats(
 		struct wlr_renderer *wlr_renderer, uint32_t buffer_caps) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
@@ -201,6 +423,14 @@ struct wlr_egl *wlr_gles2_renderer_get_egl(struct wlr_renderer *wlr_renderer) {
 	return renderer->egl;
 }
 
+static void delete_shaders(struct wlr_gles2_shaders *shaders) {
+	glDeleteProgram(shaders->quad.program);
+	glDeleteProgram(shaders->tex_rgba.program);
+	glDeleteProgram(shaders->tex_rgbx.program);
+	glDeleteProgram(shaders->tex_ext.program);
+	*shaders = (struct wlr_gles2_shaders){0};
+}
+
 static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
 
@@ -216,11 +446,18 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		destroy_buffer(buffer);
 	}
 
+	struct wlr_gles2_color_transform *color_transform, *color_transform_tmp;
+	wl_list_for_each_safe(color_transform, color_transform_tmp,
+			&renderer->color_transforms, link) {
+		gles2_color_transform_destroy(color_transform);
+	}
+
+	gles2_staging_finish(renderer);
+	gles2_read_pixels_requests_finish(renderer);
+
 	push_gles2_debug(renderer);
-	glDeleteProgram(renderer->shaders.quad.program);
-	glDeleteProgram(renderer->shaders.tex_rgba.program);
-	glDeleteProgram(renderer->shaders.tex_rgbx.program);
-	glDeleteProgram(renderer->shaders.tex_ext.program);
+	delete_shaders(&renderer->shaders);
+	delete_shaders(&renderer->lut_shaders);
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.KHR_debug) {
@@ -261,7 +498,8 @@ static struct wlr_render_pass *gles2_begin_buffer_pass(struct wlr_renderer *wlr_
 	}
 
 	struct wlr_gles2_render_pass *pass = begin_gles2_buffer_pass(buffer,
-		&prev_ctx, timer, options->signal_timeline, options->signal_point);
+		&prev_ctx, timer, options->color_transform,
+		options->signal_timeline, options->signal_point);
 	if (!pass) {
 		return NULL;
 	}
@@ -278,6 +516,9 @@ GLuint wlr_gles2_renderer_get_buffer_fbo(struct wlr_renderer *wlr_renderer,
 		return 0;
 	}
 
+	// The caller is about to issue its own GL commands
+	gles2_flush_render_batch(renderer);
+
 	struct wlr_gles2_buffer *buffer = gles2_buffer_get_or_create(renderer, wlr_buffer);
 	if (buffer) {
 		fbo = gles2_buffer_get_fbo(buffer);
@@ -287,6 +528,11 @@ GLuint wlr_gles2_renderer_get_buffer_fbo(struct wlr_renderer *wlr_renderer,
 	return fbo;
 }
 
+size_t wlr_gles2_renderer_get_last_pass_draw_calls(struct wlr_renderer *wlr_renderer) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	return renderer->last_pass_draw_calls;
+}
+
 static struct wlr_render_timer *gles2_render_timer_create(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
 	if (!renderer->exts.EXT_disjoint_timer_query) {
@@ -408,11 +654,11 @@ static void gles2_log(GLenum src, GLenum type, GLuint id, GLenum severity,
 }
 
 static GLuint compile_shader(struct wlr_gles2_renderer *renderer,
-		GLenum type, const GLchar *src) {
+		GLenum type, const GLchar *const *srcs, GLsizei srcs_len) {
 	push_gles2_debug(renderer);
 
 	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &src, NULL);
+	glShaderSource(shader, srcs_len, srcs, NULL);
 	glCompileShader(shader);
 
 	GLint ok;
@@ -428,15 +674,34 @@ static GLuint compile_shader(struct wlr_gles2_renderer *renderer,
 }
 
 static GLuint link_program(struct wlr_gles2_renderer *renderer,
-		const GLchar *vert_src, const GLchar *frag_src) {
+		const GLchar *vert_src, const GLchar *frag_src,
+		enum wlr_gles2_output_transform output_transform) {
 	push_gles2_debug(renderer);
 
-	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, vert_src);
+	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, &vert_src, 1);
 	if (!vert) {
 		goto error;
 	}
 
-	GLuint frag = compile_shader(renderer, GL_FRAGMENT_SHADER, frag_src);
+	const GLchar *frag_prefix = NULL;
+	switch (output_transform) {
+	case WLR_GLES2_OUTPUT_TRANSFORM_NONE:
+		frag_prefix = "#define OUTPUT_TRANSFORM 0\n";
+		break;
+	case WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D:
+		frag_prefix = "#extension GL_OES_texture_3D : require\n"
+			"#define OUTPUT_TRANSFORM 1\n";
+		break;
+	case WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D_PACKED:
+		frag_prefix = "#define OUTPUT_TRANSFORM 2\n";
+		break;
+	}
+
+	// The output transform is appended to the fragment shader, which calls
+	// it through a forward declaration
+	const GLchar *frag_srcs[] = { frag_prefix, frag_src, output_frag_src };
+	GLuint frag = compile_shader(renderer, GL_FRAGMENT_SHADER,
+		frag_srcs, sizeof(frag_srcs) / sizeof(frag_srcs[0]));
 	if (!frag) {
 		glDeleteShader(vert);
 		goto error;
@@ -468,6 +733,61 @@ error:
 	return 0;
 }
 
+static void get_lut_uniforms(GLuint prog, struct wlr_gles2_lut_uniforms *lut) {
+	lut->lut_3d = glGetUniformLocation(prog, "lut_3d");
+	lut->offset = glGetUniformLocation(prog, "lut_3d_offset");
+	lut->scale = glGetUniformLocation(prog, "lut_3d_scale");
+	lut->dim = glGetUniformLocation(prog, "lut_3d_dim");
+}
+
+static bool link_tex_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_tex_shader *shader, const GLchar *frag_src,
+		enum wlr_gles2_output_transform output_transform) {
+	GLuint prog;
+	shader->program = prog =
+		link_program(renderer, common_vert_src, frag_src, output_transform);
+	if (!shader->program) {
+		return false;
+	}
+	shader->proj = glGetUniformLocation(prog, "proj");
+	shader->tex = glGetUniformLocation(prog, "tex");
+	shader->alpha = glGetUniformLocation(prog, "alpha");
+	shader->pos_attrib = glGetAttribLocation(prog, "pos");
+	shader->texcoord_attrib = glGetAttribLocation(prog, "texcoord");
+	get_lut_uniforms(prog, &shader->lut);
+	return true;
+}
+
+static bool link_shaders(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_shaders *shaders,
+		enum wlr_gles2_output_transform output_transform) {
+	GLuint prog;
+	shaders->quad.program = prog = link_program(renderer,
+		common_vert_src, quad_frag_src, output_transform);
+	if (!shaders->quad.program) {
+		return false;
+	}
+	shaders->quad.proj = glGetUniformLocation(prog, "proj");
+	shaders->quad.color = glGetUniformLocation(prog, "color");
+	shaders->quad.pos_attrib = glGetAttribLocation(prog, "pos");
+	get_lut_uniforms(prog, &shaders->quad.lut);
+
+	if (!link_tex_shader(renderer, &shaders->tex_rgba,
+			tex_rgba_frag_src, output_transform)) {
+		return false;
+	}
+	if (!link_tex_shader(renderer, &shaders->tex_rgbx,
+			tex_rgbx_frag_src, output_transform)) {
+		return false;
+	}
+	if (renderer->exts.OES_egl_image_external && !link_tex_shader(renderer,
+			&shaders->tex_ext, tex_external_frag_src, output_transform)) {
+		return false;
+	}
+
+	return true;
+}
+
 static bool check_gl_ext(const char *exts, const char *ext) {
 	size_t extlen = strlen(ext);
 	const char *end = exts + strlen(exts);
@@ -532,6 +852,9 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->color_transforms);
+	wl_list_init(&renderer->read_pixels_requests);
+	wl_array_init(&renderer->staging.in_flight);
 
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
@@ -571,6 +894,9 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 	renderer->exts.EXT_texture_norm16 =
 		check_gl_ext(exts_str, "GL_EXT_texture_norm16");
 
+	renderer->exts.EXT_color_buffer_half_float =
+		check_gl_ext(exts_str, "GL_EXT_color_buffer_half_float");
+
 	if (check_gl_ext(exts_str, "GL_KHR_debug")) {
 		renderer->exts.KHR_debug = true;
 		load_gl_proc(&renderer->procs.glDebugMessageCallbackKHR,
@@ -620,6 +946,24 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		}
 	}
 
+	int gles_major = 0, gles_minor = 0;
+	sscanf((const char *)glGetString(GL_VERSION), "OpenGL ES %d.%d",
+		&gles_major, &gles_minor);
+	if (gles_major >= 3 && check_gl_ext(exts_str, "GL_EXT_buffer_storage")) {
+		renderer->exts.EXT_buffer_storage = true;
+		load_gl_proc(&renderer->procs.glBufferStorageEXT, "glBufferStorageEXT");
+		load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRange");
+		load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBuffer");
+		load_gl_proc(&renderer->procs.glFenceSync, "glFenceSync");
+		load_gl_proc(&renderer->procs.glClientWaitSync, "glClientWaitSync");
+		load_gl_proc(&renderer->procs.glDeleteSync, "glDeleteSync");
+	}
+
+	if (check_gl_ext(exts_str, "GL_OES_texture_3D")) {
+		renderer->exts.OES_texture_3D = true;
+		load_gl_proc(&renderer->procs.glTexImage3DOES, "glTexImage3DOES");
+	}
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -634,49 +978,22 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	push_gles2_debug(renderer);
 
-	GLuint prog;
-	renderer->shaders.quad.program = prog =
-		link_program(renderer, common_vert_src, quad_frag_src);
-	if (!renderer->shaders.quad.program) {
-		goto error;
-	}
-	renderer->shaders.quad.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.quad.color = glGetUniformLocation(prog, "color");
-	renderer->shaders.quad.pos_attrib = glGetAttribLocation(prog, "pos");
-
-	renderer->shaders.tex_rgba.program = prog =
-		link_program(renderer, common_vert_src, tex_rgba_frag_src);
-	if (!renderer->shaders.tex_rgba.program) {
+	if (!link_shaders(renderer, &renderer->shaders,
+			WLR_GLES2_OUTPUT_TRANSFORM_NONE)) {
 		goto error;
 	}
-	renderer->shaders.tex_rgba.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgba.tex_proj = glGetUniformLocation(prog, "tex_proj");
-	renderer->shaders.tex_rgba.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgba.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgba.pos_attrib = glGetAttribLocation(prog, "pos");
 
-	renderer->shaders.tex_rgbx.program = prog =
-		link_program(renderer, common_vert_src, tex_rgbx_frag_src);
-	if (!renderer->shaders.tex_rgbx.program) {
-		goto error;
-	}
-	renderer->shaders.tex_rgbx.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgbx.tex_proj = glGetUniformLocation(prog, "tex_proj");
-	renderer->shaders.tex_rgbx.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgbx.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgbx.pos_attrib = glGetAttribLocation(prog, "pos");
-
-	if (renderer->exts.OES_egl_image_external) {
-		renderer->shaders.tex_ext.program = prog =
-			link_program(renderer, common_vert_src, tex_external_frag_src);
-		if (!renderer->shaders.tex_ext.program) {
-			goto error;
-		}
-		renderer->shaders.tex_ext.proj = glGetUniformLocation(prog, "proj");
-		renderer->shaders.tex_ext.tex_proj = glGetUniformLocation(prog, "tex_proj");
-		renderer->shaders.tex_ext.tex = glGetUniformLocation(prog, "tex");
-		renderer->shaders.tex_ext.alpha = glGetUniformLocation(prog, "alpha");
-		renderer->shaders.tex_ext.pos_attrib = glGetAttribLocation(prog, "pos");
+	// 3D LUTs are sampled from a 3D texture if possible, or else from a 2D
+	// texture with the blue slices laid out side by side
+	renderer->lut_output_transform = renderer->exts.OES_texture_3D ?
+		WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D : WLR_GLES2_OUTPUT_TRANSFORM_LUT_3D_PACKED;
+	if (link_shaders(renderer, &renderer->lut_shaders,
+			renderer->lut_output_transform)) {
+		renderer->wlr_renderer.features.output_color_transform = true;
+	} else {
+		wlr_log(WLR_INFO, "Failed to set up color transform shaders, "
+			"output color transforms are not supported");
+		delete_shaders(&renderer->lut_shaders);
 	}
 
 	pop_gles2_debug(renderer);
@@ -695,10 +1012,7 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 	return &renderer->wlr_renderer;
 
 error:
-	glDeleteProgram(renderer->shaders.quad.program);
-	glDeleteProgram(renderer->shaders.tex_rgba.program);
-	glDeleteProgram(renderer->shaders.tex_rgbx.program);
-	glDeleteProgram(renderer->shaders.tex_ext.program);
+	delete_shaders(&renderer->shaders);
 
 	pop_gles2_debug(renderer);
 
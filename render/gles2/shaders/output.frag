@@ -0,0 +1,61 @@
+// Appended to the fragment shaders. OUTPUT_TRANSFORM is defined by the
+// renderer and matches enum wlr_gles2_output_transform.
+#define OUTPUT_TRANSFORM_NONE 0
+#define OUTPUT_TRANSFORM_LUT_3D 1
+#define OUTPUT_TRANSFORM_LUT_3D_PACKED 2
+
+#if OUTPUT_TRANSFORM != OUTPUT_TRANSFORM_NONE
+uniform float lut_3d_offset;
+uniform float lut_3d_scale;
+
+float srgb_channel_to_linear(float x) {
+	return max(x / 12.92, pow((x + 0.055) / 1.055, 2.4));
+}
+#endif
+
+#if OUTPUT_TRANSFORM == OUTPUT_TRANSFORM_LUT_3D
+uniform mediump sampler3D lut_3d;
+
+vec3 sample_lut_3d(vec3 rgb) {
+	vec3 pos = lut_3d_offset + rgb * lut_3d_scale;
+	return texture3D(lut_3d, pos).rgb;
+}
+#elif OUTPUT_TRANSFORM == OUTPUT_TRANSFORM_LUT_3D_PACKED
+// The blue slices of the LUT are laid out side by side along the x axis of a
+// 2D texture, the interpolation between slices is done here
+uniform sampler2D lut_3d;
+uniform float lut_3d_dim;
+
+vec3 sample_lut_3d(vec3 rgb) {
+	vec2 pos = lut_3d_offset + rgb.rg * lut_3d_scale;
+	float b = rgb.b * (lut_3d_dim - 1.0);
+	float b0 = floor(b);
+	float b1 = min(b0 + 1.0, lut_3d_dim - 1.0);
+	vec3 c0 = texture2D(lut_3d, vec2((b0 + pos.x) / lut_3d_dim, pos.y)).rgb;
+	vec3 c1 = texture2D(lut_3d, vec2((b1 + pos.x) / lut_3d_dim, pos.y)).rgb;
+	return mix(c0, c1, b - b0);
+}
+#endif
+
+vec4 output_transform(vec4 color) {
+#if OUTPUT_TRANSFORM == OUTPUT_TRANSFORM_NONE
+	return color;
+#else
+	if (color.a == 0.0) {
+		return vec4(0.0);
+	}
+	// Convert from pre-multiplied alpha to straight alpha
+	vec3 rgb = clamp(color.rgb / color.a, 0.0, 1.0);
+
+	// The LUT maps linear values to the output color space
+	rgb = vec3(
+		srgb_channel_to_linear(rgb.r),
+		srgb_channel_to_linear(rgb.g),
+		srgb_channel_to_linear(rgb.b)
+	);
+	rgb = sample_lut_3d(rgb);
+
+	// Back to pre-multiplied alpha
+	return vec4(rgb * color.a, color.a);
+#endif
+}
@@ -8,6 +8,8 @@ varying vec4 v_color;
 varying vec2 v_texcoord;
 uniform vec4 color;
 
+vec4 output_transform(vec4 color);
+
 void main() {
-	gl_FragColor = color;
+	gl_FragColor = output_transform(color);
 }
@@ -10,6 +10,8 @@ varying vec2 v_texcoord;
 uniform samplerExternalOES texture0;
 uniform float alpha;
 
+vec4 output_transform(vec4 color);
+
 void main() {
-	gl_FragColor = texture2D(texture0, v_texcoord) * alpha;
+	gl_FragColor = output_transform(texture2D(texture0, v_texcoord) * alpha);
 }
@@ -8,6 +8,8 @@ varying vec2 v_texcoord;
 uniform sampler2D tex;
 uniform float alpha;
 
+vec4 output_transform(vec4 color);
+
 void main() {
-	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha;
+	gl_FragColor = output_transform(vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha);
 }
@@ -4,6 +4,8 @@
 #include <GLES2/gl2ext.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
 #include <wlr/render/egl.h>
@@ -14,6 +16,7 @@
 #include "render/gles2.h"
 #include "render/pixel_format.h"
 #include "types/wlr_buffer.h"
+#include "util/array.h"
 
 static const struct wlr_texture_impl texture_impl;
 
@@ -28,6 +31,246 @@ struct wlr_gles2_texture *gles2_get_texture(
 	return texture;
 }
 
+// Size of the staging ring buffer for shm uploads
+#define STAGING_SIZE (16 * 1024 * 1024)
+// Damage is uploaded as its bounding box when that is at most this many
+// times bigger than the damage itself, or when it has too many rectangles
+#define DAMAGE_COALESCE_RATIO 2
+#define DAMAGE_MAX_RECTS 8
+
+static bool staging_init(struct wlr_gles2_renderer *renderer) {
+	if (renderer->staging.map != NULL) {
+		return true;
+	}
+
+	GLuint pbo;
+	glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, pbo);
+	renderer->procs.glBufferStorageEXT(GL_PIXEL_UNPACK_BUFFER_NV, STAGING_SIZE,
+		NULL, GL_MAP_WRITE_BIT_EXT | GL_MAP_PERSISTENT_BIT_EXT |
+		GL_MAP_COHERENT_BIT_EXT);
+	void *map = renderer->procs.glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_NV, 0,
+		STAGING_SIZE, GL_MAP_WRITE_BIT_EXT | GL_MAP_PERSISTENT_BIT_EXT |
+		GL_MAP_COHERENT_BIT_EXT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+	if (map == NULL) {
+		wlr_log(WLR_ERROR, "Failed to map staging buffer, "
+			"disabling streaming uploads");
+		glDeleteBuffers(1, &pbo);
+		renderer->exts.EXT_buffer_storage = false;
+		return false;
+	}
+
+	renderer->staging.pbo = pbo;
+	renderer->staging.map = map;
+	renderer->staging.size = STAGING_SIZE;
+	renderer->staging.head = 0;
+	return true;
+}
+
+void gles2_staging_finish(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_staging_region *region;
+	wl_array_for_each(region, &renderer->staging.in_flight) {
+		renderer->procs.glDeleteSync(region->fence);
+	}
+	wl_array_release(&renderer->staging.in_flight);
+
+	if (renderer->staging.map != NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, renderer->staging.pbo);
+		renderer->procs.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_NV);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		glDeleteBuffers(1, &renderer->staging.pbo);
+	}
+}
+
+// Release the regions of the ring the GPU is done reading from
+static void staging_retire(struct wlr_gles2_renderer *renderer) {
+	struct wl_array *in_flight = &renderer->staging.in_flight;
+	struct wlr_gles2_staging_region *regions = in_flight->data;
+	size_t len = in_flight->size / sizeof(*regions);
+
+	size_t retired = 0;
+	while (retired < len) {
+		GLenum status = renderer->procs.glClientWaitSync(
+			regions[retired].fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED_APPLE) {
+			break;
+		}
+		renderer->procs.glDeleteSync(regions[retired].fence);
+		retired++;
+	}
+
+	if (retired > 0) {
+		array_remove_at(in_flight, 0, retired * sizeof(*regions));
+	}
+	if (in_flight->size == 0) {
+		renderer->staging.head = 0;
+	}
+}
+
+/**
+ * Allocate len bytes from the staging ring. pending_start is the start of the
+ * part of the ring written by the current upload which hasn't been recorded
+ * as in-flight yet, or NULL if nothing has been written so far.
+ */
+static bool staging_alloc(struct wlr_gles2_renderer *renderer, size_t len,
+		const size_t *pending_start, size_t *offset) {
+	// Keep copies 16-byte aligned
+	len = (len + 15) & ~(size_t)15;
+
+	struct wl_array *in_flight = &renderer->staging.in_flight;
+	size_t head = renderer->staging.head;
+	size_t size = renderer->staging.size;
+
+	size_t tail;
+	if (in_flight->size > 0) {
+		const struct wlr_gles2_staging_region *oldest = in_flight->data;
+		tail = oldest->start;
+	} else if (pending_start != NULL) {
+		tail = *pending_start;
+	} else {
+		// Nothing is in use, start over from the beginning
+		if (len > size) {
+			return false;
+		}
+		*offset = 0;
+		renderer->staging.head = len;
+		return true;
+	}
+
+	if (head >= tail) {
+		if (len <= size - head) {
+			*offset = head;
+		} else if (len < tail) {
+			*offset = 0;
+		} else {
+			return false;
+		}
+	} else if (len < tail - head) {
+		*offset = head;
+	} else {
+		return false;
+	}
+
+	renderer->staging.head = *offset + len;
+	return true;
+}
+
+// Mark [start, end) as in use until the GPU is done with the commands issued
+// so far
+static void staging_push_region(struct wlr_gles2_renderer *renderer,
+		size_t start, size_t end) {
+	struct wlr_gles2_staging_region *region =
+		wl_array_add(&renderer->staging.in_flight, sizeof(*region));
+	GLsync fence = renderer->procs.glFenceSync(
+		GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0);
+	if (region == NULL) {
+		// Can't track the region, wait for the GPU instead
+		renderer->procs.glClientWaitSync(fence,
+			GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, UINT64_MAX);
+		renderer->procs.glDeleteSync(fence);
+		return;
+	}
+	*region = (struct wlr_gles2_staging_region){
+		.fence = fence,
+		.start = start,
+		.end = end,
+	};
+}
+
+static bool gles2_texture_upload_staged(struct wlr_gles2_texture *texture,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, const void *data,
+		size_t stride, const pixman_box32_t *rects, int rects_len) {
+	struct wlr_gles2_renderer *renderer = texture->renderer;
+	if (!renderer->exts.EXT_buffer_storage || !staging_init(renderer)) {
+		return false;
+	}
+
+	staging_retire(renderer);
+
+	size_t start = 0;
+	bool ok = true, issued = false;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, renderer->staging.pbo);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		int width = rect->x2 - rect->x1;
+		int height = rect->y2 - rect->y1;
+		size_t row_size = (size_t)width * drm_fmt->bytes_per_block;
+
+		size_t prev_head = renderer->staging.head;
+		size_t offset;
+		if (!staging_alloc(renderer, row_size * height,
+				issued ? &start : NULL, &offset)) {
+			ok = false;
+			break;
+		}
+		if (!issued) {
+			start = offset;
+		} else if (offset != prev_head) {
+			// The ring wrapped around, the region written so far ends here
+			staging_push_region(renderer, start, prev_head);
+			start = offset;
+		}
+
+		const char *src = (const char *)data + rect->y1 * stride +
+			rect->x1 * drm_fmt->bytes_per_block;
+		char *dst = (char *)renderer->staging.map + offset;
+		if (row_size == stride) {
+			memcpy(dst, src, row_size * height);
+		} else {
+			for (int y = 0; y < height; y++) {
+				memcpy(dst + y * row_size, src + y * stride, row_size);
+			}
+		}
+
+		// The copy to the texture happens asynchronously on the GPU
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x1, rect->y1, width, height,
+			fmt->gl_format, fmt->gl_type, (const void *)(uintptr_t)offset);
+		issued = true;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	if (issued) {
+		staging_push_region(renderer, start, renderer->staging.head);
+	}
+
+	return ok;
+}
+
+/**
+ * Reduce the number of uploads for fragmented damage by uploading its
+ * bounding box instead, if that doesn't waste too much bandwidth.
+ */
+static const pixman_box32_t *coalesce_damage(const pixman_region32_t *damage,
+		int *rects_len) {
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, rects_len);
+	if (*rects_len <= 1) {
+		return rects;
+	}
+
+	const pixman_box32_t *extents = pixman_region32_extents(damage);
+	uint64_t extents_area = (uint64_t)(extents->x2 - extents->x1) *
+		(extents->y2 - extents->y1);
+	uint64_t damage_area = 0;
+	for (int i = 0; i < *rects_len; i++) {
+		damage_area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	}
+
+	if (*rects_len > DAMAGE_MAX_RECTS ||
+			extents_area <= DAMAGE_COALESCE_RATIO * damage_area) {
+		*rects_len = 1;
+		return extents;
+	}
+	return rects;
+}
+
 static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
@@ -70,12 +313,20 @@ static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_make_current(texture->renderer->egl, &prev_ctx);
 
+	// Draws referencing the previous contents must be issued first
+	gles2_flush_render_batch(texture->renderer);
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
 
 	int rects_len = 0;
-	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+	const pixman_box32_t *rects = coalesce_damage(damage, &rects_len);
+
+	if (gles2_texture_upload_staged(texture, fmt, drm_fmt, data, stride,
+			rects, rects_len)) {
+		rects_len = 0;
+	}
 
 	for (int i = 0; i < rects_len; i++) {
 		pixman_box32_t rect = rects[i];
@@ -113,6 +364,8 @@ void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
 		struct wlr_egl_context prev_ctx;
 		wlr_egl_make_current(texture->renderer->egl, &prev_ctx);
 
+		gles2_flush_render_batch(texture->renderer);
+
 		push_gles2_debug(texture->renderer);
 
 		glDeleteTextures(1, &texture->tex);
@@ -164,24 +417,19 @@ static bool gles2_texture_bind(struct wlr_gles2_texture *texture) {
 	return true;
 }
 
-static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
-		const struct wlr_texture_read_pixels_options *options) {
-	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
-
-	struct wlr_box src;
-	wlr_texture_read_pixels_options_get_src_box(options, wlr_texture, &src);
-
+static const struct wlr_gles2_pixel_format *get_read_format(
+		struct wlr_gles2_texture *texture, uint32_t drm_format) {
 	const struct wlr_gles2_pixel_format *fmt =
-		get_gles2_format_from_drm(options->format);
+		get_gles2_format_from_drm(drm_format);
 	if (fmt == NULL || !is_gles2_pixel_format_supported(texture->renderer, fmt)) {
-		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, options->format);
-		return false;
+		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, drm_format);
+		return NULL;
 	}
 
 	if (fmt->gl_format == GL_BGRA_EXT && !texture->renderer->exts.EXT_read_format_bgra) {
 		wlr_log(WLR_ERROR,
 			"Cannot read pixels: missing GL_EXT_read_format_bgra extension");
-		return false;
+		return NULL;
 	}
 
 	const struct wlr_pixel_format_info *drm_fmt =
@@ -189,8 +437,25 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 	assert(drm_fmt);
 	if (pixel_format_info_pixels_per_block(drm_fmt) != 1) {
 		wlr_log(WLR_ERROR, "Cannot read pixels: block formats are not supported");
+		return NULL;
+	}
+
+	return fmt;
+}
+
+static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
+		const struct wlr_texture_read_pixels_options *options) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	struct wlr_box src;
+	wlr_texture_read_pixels_options_get_src_box(options, wlr_texture, &src);
+
+	const struct wlr_gles2_pixel_format *fmt = get_read_format(texture, options->format);
+	if (fmt == NULL) {
 		return false;
 	}
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
 
 	push_gles2_debug(texture->renderer);
 	struct wlr_egl_context prev_ctx;
@@ -198,6 +463,8 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 		return false;
 	}
 
+	gles2_flush_render_batch(texture->renderer);
+
 	if (!gles2_texture_bind(texture)) {
 		return false;
 	}
@@ -232,6 +499,186 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 	return glGetError() == GL_NO_ERROR;
 }
 
+struct wlr_gles2_read_pixels_request {
+	struct wlr_texture_read_pixels_request base;
+	struct wlr_gles2_renderer *renderer; // NULL if destroyed
+	struct wl_list link; // wlr_gles2_renderer.read_pixels_requests
+	GLuint pbo;
+	uint32_t stride; // of the rows in pbo
+};
+
+static struct wlr_gles2_read_pixels_request *get_read_pixels_request(
+		struct wlr_texture_read_pixels_request *wlr_request) {
+	struct wlr_gles2_read_pixels_request *request =
+		wl_container_of(wlr_request, request, base);
+	return request;
+}
+
+static bool gles2_read_pixels_request_copy(
+		struct wlr_texture_read_pixels_request *wlr_request, void *data,
+		uint32_t stride) {
+	struct wlr_gles2_read_pixels_request *request =
+		get_read_pixels_request(wlr_request);
+	struct wlr_gles2_renderer *renderer = request->renderer;
+	size_t size = (size_t)request->stride * wlr_request->height;
+
+	if (renderer == NULL) {
+		wlr_log(WLR_ERROR, "Renderer destroyed before read-back was copied");
+		return false;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	if (!wlr_egl_make_current(renderer->egl, &prev_ctx)) {
+		return false;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, request->pbo);
+	const char *src = renderer->procs.glMapBufferRange(GL_PIXEL_PACK_BUFFER_NV,
+		0, size, GL_MAP_READ_BIT_EXT);
+	if (src != NULL) {
+		char *dst = data;
+		for (uint32_t y = 0; y < wlr_request->height; y++) {
+			memcpy(dst + y * stride, src + y * request->stride, request->stride);
+		}
+		renderer->procs.glUnmapBuffer(GL_PIXEL_PACK_BUFFER_NV);
+	} else {
+		wlr_log(WLR_ERROR, "Failed to map read-back buffer");
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	wlr_egl_restore_context(&prev_ctx);
+	return src != NULL;
+}
+
+static void gles2_read_pixels_request_destroy(
+		struct wlr_texture_read_pixels_request *wlr_request) {
+	struct wlr_gles2_read_pixels_request *request =
+		get_read_pixels_request(wlr_request);
+
+	if (request->renderer != NULL) {
+		struct wlr_egl_context prev_ctx;
+		wlr_egl_make_current(request->renderer->egl, &prev_ctx);
+		glDeleteBuffers(1, &request->pbo);
+		wlr_egl_restore_context(&prev_ctx);
+	}
+
+	wl_list_remove(&request->link);
+	free(request);
+}
+
+void gles2_read_pixels_requests_finish(struct wlr_gles2_renderer *renderer) {
+	// The EGL context is current
+	struct wlr_gles2_read_pixels_request *request, *tmp;
+	wl_list_for_each_safe(request, tmp, &renderer->read_pixels_requests, link) {
+		glDeleteBuffers(1, &request->pbo);
+		request->renderer = NULL;
+		wl_list_remove(&request->link);
+		wl_list_init(&request->link);
+	}
+}
+
+static const struct wlr_texture_read_pixels_request_impl read_pixels_request_impl = {
+	.copy = gles2_read_pixels_request_copy,
+	.destroy = gles2_read_pixels_request_destroy,
+};
+
+static struct wlr_texture_read_pixels_request *gles2_texture_read_pixels_async(
+		struct wlr_texture *wlr_texture, struct wl_event_loop *loop,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+	struct wlr_gles2_renderer *renderer = texture->renderer;
+
+	// Reading into a pixel pack buffer needs GLES 3
+	if (!renderer->exts.EXT_buffer_storage) {
+		return NULL;
+	}
+
+	struct wlr_box src;
+	wlr_texture_read_pixels_async_options_get_src_box(options, wlr_texture, &src);
+
+	const struct wlr_gles2_pixel_format *fmt = get_read_format(texture, options->format);
+	if (fmt == NULL) {
+		return NULL;
+	}
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+
+	struct wlr_gles2_read_pixels_request *request = calloc(1, sizeof(*request));
+	if (request == NULL) {
+		return NULL;
+	}
+	request->renderer = renderer;
+	request->stride = pixel_format_info_min_stride(drm_fmt, src.width);
+	wl_list_init(&request->link);
+
+	push_gles2_debug(renderer);
+	struct wlr_egl_context prev_ctx;
+	if (!wlr_egl_make_current(renderer->egl, &prev_ctx)) {
+		free(request);
+		return NULL;
+	}
+
+	gles2_flush_render_batch(renderer);
+
+	if (!gles2_texture_bind(texture)) {
+		wlr_egl_restore_context(&prev_ctx);
+		pop_gles2_debug(renderer);
+		free(request);
+		return NULL;
+	}
+
+	glGetError(); // Clear the error flag
+
+	glGenBuffers(1, &request->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, request->pbo);
+	renderer->procs.glBufferStorageEXT(GL_PIXEL_PACK_BUFFER_NV,
+		(size_t)request->stride * src.height, NULL, GL_MAP_READ_BIT_EXT);
+
+	// With a pack buffer bound, the pointer is an offset into the buffer
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(src.x, src.y, src.width, src.height, fmt->gl_format,
+		fmt->gl_type, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	int sync_file_fd = -1;
+	EGLSyncKHR sync = wlr_egl_create_sync(renderer->egl, -1);
+	if (sync != EGL_NO_SYNC_KHR) {
+		sync_file_fd = wlr_egl_dup_fence_fd(renderer->egl, sync);
+		wlr_egl_destroy_sync(renderer->egl, sync);
+	}
+	if (sync_file_fd < 0) {
+		// Without a sync file, the request is ready on the next event loop
+		// iteration
+		glFinish();
+	}
+
+	bool ok = glGetError() == GL_NO_ERROR;
+	if (!ok) {
+		glDeleteBuffers(1, &request->pbo);
+	}
+
+	wlr_egl_restore_context(&prev_ctx);
+	pop_gles2_debug(renderer);
+
+	if (!ok) {
+		if (sync_file_fd >= 0) {
+			close(sync_file_fd);
+		}
+		free(request);
+		return NULL;
+	}
+
+	if (!wlr_texture_read_pixels_request_init(&request->base,
+			&read_pixels_request_impl, loop, options->format, src.width,
+			src.height, sync_file_fd)) {
+		gles2_read_pixels_request_destroy(&request->base);
+		return NULL;
+	}
+
+	wl_list_insert(&renderer->read_pixels_requests, &request->link);
+	return &request->base;
+}
+
 static uint32_t gles2_texture_preferred_read_format(struct wlr_texture *wlr_texture) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
 
@@ -278,6 +725,7 @@ static const struct wlr_texture_impl texture_impl = {
 	.read_pixels = gles2_texture_read_pixels,
 	.preferred_read_format = gles2_texture_preferred_read_format,
 	.destroy = handle_gles2_texture_destroy,
+	.read_pixels_async = gles2_texture_read_pixels_async,
 };
 
 static struct wlr_gles2_texture *gles2_texture_create(
@@ -417,17 +865,21 @@ struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	uint32_t format;
 	size_t stride;
 	struct wlr_dmabuf_attributes dmabuf;
-	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
-		return gles2_texture_from_dmabuf(renderer, buffer, &dmabuf);
-	} else if (wlr_buffer_begin_data_ptr_access(buffer,
+	if (buffer_get_texture_dmabuf(buffer, &dmabuf)) {
+		struct wlr_texture *tex = gles2_texture_from_dmabuf(renderer, buffer, &dmabuf);
+		if (tex != NULL) {
+			return tex;
+		}
+		// Buffers which also expose their pixels can still be copied
+	}
+	if (wlr_buffer_begin_data_ptr_access(buffer,
 			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
 		struct wlr_texture *tex = gles2_texture_from_pixels(wlr_renderer,
 			format, stride, buffer->width, buffer->height, data);
 		wlr_buffer_end_data_ptr_access(buffer);
 		return tex;
-	} else {
-		return NULL;
 	}
+	return NULL;
 }
 
 void wlr_gles2_texture_get_attribs(struct wlr_texture *wlr_texture,
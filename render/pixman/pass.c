@@ -1,6 +1,14 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <time.h>
+#include <wlr/util/box.h>
 #include "render/pixman.h"
+#include "util/thread_pool.h"
+#include "util/time.h"
+
+// Operations smaller than this aren't worth splitting between threads
+#define PARALLEL_MIN_PIXELS (256 * 256)
+#define BAND_MIN_HEIGHT 32
 
 static const struct wlr_render_pass_impl render_pass_impl;
 
@@ -16,9 +24,19 @@ static struct wlr_pixman_texture *get_texture(struct wlr_texture *wlr_texture) {
 	return texture;
 }
 
+static int64_t get_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
 static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 
+	if (pass->timer != NULL) {
+		pass->timer->duration_nsec = get_time_nsec() - pass->timer->start_nsec;
+	}
+
 	wlr_buffer_end_data_ptr_access(pass->buffer->buffer);
 	wlr_buffer_unlock(pass->buffer->buffer);
 	free(pass);
@@ -36,19 +54,280 @@ static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	abort();
 }
 
+// A single pixman_image_composite32() call, which may be split into bands
+struct composite_op {
+	pixman_op_t op;
+	pixman_image_t *src; // NULL for a solid fill with src_color
+	struct pixman_color src_color;
+	const struct pixman_transform *src_transform; // may be NULL
+	pixman_filter_t src_filter;
+	bool has_mask;
+	struct pixman_color mask_color;
+	const pixman_region32_t *clip; // may be NULL
+	int32_t src_x, src_y;
+	struct wlr_box dst_box;
+};
+
+struct composite_band {
+	pixman_image_t *src, *mask, *dst;
+};
+
+struct composite_job {
+	const struct composite_op *op;
+	struct wlr_box box; // visible part of op->dst_box
+	struct composite_band *bands;
+	size_t bands_len;
+};
+
+static void composite_band_iterator(size_t i, void *data) {
+	const struct composite_job *job = data;
+	const struct composite_op *op = job->op;
+	const struct composite_band *band = &job->bands[i];
+
+	int32_t y0 = (int64_t)job->box.height * i / job->bands_len;
+	int32_t y1 = (int64_t)job->box.height * (i + 1) / job->bands_len;
+	int32_t dx = job->box.x - op->dst_box.x;
+	int32_t dy = job->box.y - op->dst_box.y + y0;
+	pixman_image_composite32(op->op, band->src, band->mask, band->dst,
+		op->src_x + dx, op->src_y + dy, 0, 0,
+		job->box.x, job->box.y + y0, job->box.width, y1 - y0);
+}
+
+// Creates an image sharing the pixels of a bits image, so that each thread
+// can use its own image state
+static pixman_image_t *wrap_bits_image(pixman_image_t *image) {
+	return pixman_image_create_bits(pixman_image_get_format(image),
+		pixman_image_get_width(image), pixman_image_get_height(image),
+		pixman_image_get_data(image), pixman_image_get_stride(image));
+}
+
+static bool init_composite_band(struct composite_band *band,
+		const struct composite_op *op, pixman_image_t *dst) {
+	band->dst = wrap_bits_image(dst);
+	if (band->dst == NULL || (op->clip != NULL &&
+			!pixman_image_set_clip_region32(band->dst, (pixman_region32_t *)op->clip))) {
+		return false;
+	}
+
+	if (op->src != NULL) {
+		band->src = wrap_bits_image(op->src);
+		if (band->src != NULL && op->src_transform != NULL) {
+			pixman_image_set_transform(band->src, op->src_transform);
+			pixman_image_set_filter(band->src, op->src_filter, NULL, 0);
+		}
+	} else {
+		band->src = pixman_image_create_solid_fill(&op->src_color);
+	}
+	if (band->src == NULL) {
+		return false;
+	}
+
+	if (op->has_mask) {
+		band->mask = pixman_image_create_solid_fill(&op->mask_color);
+		if (band->mask == NULL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void finish_composite_band(struct composite_band *band) {
+	if (band->src != NULL) {
+		pixman_image_unref(band->src);
+	}
+	if (band->mask != NULL) {
+		pixman_image_unref(band->mask);
+	}
+	if (band->dst != NULL) {
+		pixman_image_unref(band->dst);
+	}
+}
+
+static bool composite_parallel(struct wlr_pixman_render_pass *pass,
+		const struct composite_op *op, const struct wlr_box *box) {
+	struct thread_pool *pool = pass->buffer->renderer->thread_pool;
+	if (pool == NULL || (int64_t)box->width * box->height < PARALLEL_MIN_PIXELS) {
+		return false;
+	}
+
+	size_t bands_len = thread_pool_get_concurrency(pool);
+	size_t max_bands = box->height / BAND_MIN_HEIGHT;
+	if (bands_len > max_bands) {
+		bands_len = max_bands;
+	}
+	if (bands_len <= 1) {
+		return false;
+	}
+
+	struct composite_band *bands = calloc(bands_len, sizeof(*bands));
+	if (bands == NULL) {
+		return false;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < bands_len && ok; i++) {
+		ok = init_composite_band(&bands[i], op, pass->buffer->image);
+	}
+
+	if (ok) {
+		struct composite_job job = {
+			.op = op,
+			.box = *box,
+			.bands = bands,
+			.bands_len = bands_len,
+		};
+		thread_pool_run(pool, bands_len, composite_band_iterator, &job);
+	}
+
+	for (size_t i = 0; i < bands_len; i++) {
+		finish_composite_band(&bands[i]);
+	}
+	free(bands);
+	return ok;
+}
+
+static void composite(struct wlr_pixman_render_pass *pass,
+		const struct composite_op *op) {
+	struct wlr_pixman_buffer *buffer = pass->buffer;
+
+	// Only the part of the operation inside the buffer and the clip region
+	// needs to be split between threads
+	struct wlr_box box = {
+		.width = buffer->buffer->width,
+		.height = buffer->buffer->height,
+	};
+	if (op->clip != NULL) {
+		const pixman_box32_t *extents =
+			pixman_region32_extents((pixman_region32_t *)op->clip);
+		struct wlr_box clip_box = {
+			.x = extents->x1,
+			.y = extents->y1,
+			.width = extents->x2 - extents->x1,
+			.height = extents->y2 - extents->y1,
+		};
+		wlr_box_intersection(&box, &box, &clip_box);
+	}
+	if (!wlr_box_intersection(&box, &box, &op->dst_box)) {
+		return;
+	}
+
+	if (composite_parallel(pass, op, &box)) {
+		return;
+	}
+
+	pixman_image_t *src = op->src;
+	if (src != NULL) {
+		pixman_image_set_transform(src, op->src_transform);
+		if (op->src_transform != NULL) {
+			pixman_image_set_filter(src, op->src_filter, NULL, 0);
+		}
+	} else {
+		src = pixman_image_create_solid_fill(&op->src_color);
+	}
+
+	pixman_image_t *mask = NULL;
+	if (op->has_mask) {
+		mask = pixman_image_create_solid_fill(&op->mask_color);
+	}
+
+	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)op->clip);
+	pixman_image_composite32(op->op, src, mask, buffer->image,
+		op->src_x, op->src_y, 0, 0, op->dst_box.x, op->dst_box.y,
+		op->dst_box.width, op->dst_box.height);
+	pixman_image_set_clip_region32(buffer->image, NULL);
+
+	if (op->src != NULL) {
+		pixman_image_set_transform(src, NULL);
+	} else {
+		pixman_image_unref(src);
+	}
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
+}
+
+static bool can_cache_format(pixman_format_code_t format) {
+	// Transformed images are cached as a8r8g8b8
+	return PIXMAN_FORMAT_A(format) <= 8 && PIXMAN_FORMAT_R(format) <= 8 &&
+		PIXMAN_FORMAT_G(format) <= 8 && PIXMAN_FORMAT_B(format) <= 8;
+}
+
+/**
+ * Get the texture with the source transform of the operation applied, so
+ * that it can be copied without resampling. The image is only created when
+ * the texture is drawn the same way a second time, so that content which
+ * changes every frame doesn't pay for it. Returns NULL if there's no such
+ * image.
+ */
+static pixman_image_t *get_transformed_image(struct wlr_pixman_texture *texture,
+		const struct wlr_render_texture_options *options,
+		const struct composite_op *op, const struct wlr_box *src_box) {
+	int width = op->dst_box.width, height = op->dst_box.height;
+	if (width <= 0 || height <= 0) {
+		return NULL;
+	}
+
+	bool match = texture->transform_cache.valid &&
+		texture->transform_cache.transform == options->transform &&
+		texture->transform_cache.filter_mode == options->filter_mode &&
+		wlr_box_equal(&texture->transform_cache.src_box, src_box) &&
+		texture->transform_cache.dst_width == width &&
+		texture->transform_cache.dst_height == height;
+	if (!match) {
+		pixman_texture_invalidate_transform_cache(texture);
+		texture->transform_cache.valid = true;
+		texture->transform_cache.transform = options->transform;
+		texture->transform_cache.filter_mode = options->filter_mode;
+		texture->transform_cache.src_box = *src_box;
+		texture->transform_cache.dst_width = width;
+		texture->transform_cache.dst_height = height;
+		return NULL;
+	}
+
+	if (texture->transform_cache.image != NULL) {
+		return texture->transform_cache.image;
+	}
+	if (!can_cache_format(texture->format)) {
+		return NULL;
+	}
+
+	pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+		width, height, NULL, 0);
+	if (image == NULL) {
+		return NULL;
+	}
+
+	// Pixels outside of the source are written as transparent, like when
+	// compositing from the texture directly
+	pixman_image_set_transform(texture->image, op->src_transform);
+	pixman_image_set_filter(texture->image, op->src_filter, NULL, 0);
+	pixman_image_composite32(PIXMAN_OP_SRC, texture->image, NULL, image,
+		0, 0, 0, 0, 0, 0, width, height);
+	pixman_image_set_transform(texture->image, NULL);
+
+	texture->transform_cache.image = image;
+	return image;
+}
+
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_texture_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_pixman_texture *texture = get_texture(options->texture);
 	struct wlr_pixman_buffer *buffer = pass->buffer;
 
+	int64_t start_nsec = pass->timer != NULL ? get_time_nsec() : 0;
+
 	if (texture->buffer != NULL && !begin_pixman_data_ptr_access(texture->buffer,
 			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
 		return;
 	}
 
-	pixman_op_t op = get_pixman_blending(options->blend_mode);
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
+	struct composite_op op = {
+		.op = get_pixman_blending(options->blend_mode),
+		.src = texture->image,
+		.clip = options->clip,
+	};
 
 	struct wlr_fbox src_fbox;
 	wlr_render_texture_options_get_src_box(options, &src_fbox);
@@ -62,12 +341,12 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_box dst_box;
 	wlr_render_texture_options_get_dst_box(options, &dst_box);
 
-	pixman_image_t *mask = NULL;
 	float alpha = wlr_render_texture_options_get_alpha(options);
 	if (alpha != 1) {
-		mask = pixman_image_create_solid_fill(&(struct pixman_color){
+		op.has_mask = true;
+		op.mask_color = (struct pixman_color){
 			.alpha = 0xFFFF * alpha,
-		});
+		};
 	}
 
 	// Rotate the source size into destination coordinates
@@ -155,14 +434,14 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		pixman_transform_translate(&transform, NULL,
 			pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
 
-		pixman_image_set_transform(texture->image, &transform);
+		op.src_transform = &transform;
 
 		switch (options->filter_mode) {
 		case WLR_SCALE_FILTER_BILINEAR:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+			op.src_filter = PIXMAN_FILTER_BILINEAR;
 			break;
 		case WLR_SCALE_FILTER_NEAREST:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+			op.src_filter = PIXMAN_FILTER_NEAREST;
 			break;
 		}
 
@@ -171,58 +450,61 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		// width,height part of source crop is done here by the width and height we pass:
 		// because of the scaling, cropping at the end by dst_box.{width,height} is
 		// equivalent to if we cropped at the start by src_box.{width,height}.
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			0, 0, // source x,y
-			0, 0, // mask x,y
-			dst_box.x, dst_box.y, // dest x,y
-			dst_box.width, dst_box.height // composite width,height
-		);
-
-		pixman_image_set_transform(texture->image, NULL);
+		op.dst_box = dst_box;
+
+		pixman_image_t *transformed = get_transformed_image(texture,
+			options, &op, &src_box);
+		if (transformed != NULL) {
+			op.src = transformed;
+			op.src_transform = NULL;
+		}
+
+		composite(pass, &op);
 	} else {
 		// No transforms or crop needed, just a straight blit from the source
-		pixman_image_set_transform(texture->image, NULL);
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			src_box.x, src_box.y, 0, 0, dst_box.x, dst_box.y,
-			src_box.width, src_box.height);
+		op.src_x = src_box.x;
+		op.src_y = src_box.y;
+		op.dst_box = (struct wlr_box){
+			.x = dst_box.x,
+			.y = dst_box.y,
+			.width = src_box.width,
+			.height = src_box.height,
+		};
+		composite(pass, &op);
 	}
 
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
 	if (texture->buffer != NULL) {
 		wlr_buffer_end_data_ptr_access(texture->buffer);
 	}
 
-	if (mask != NULL) {
-		pixman_image_unref(mask);
+	if (pass->timer != NULL) {
+		pass->timer->durations.composite_nsec += get_time_nsec() - start_nsec;
 	}
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_pixman_buffer *buffer = pass->buffer;
-	struct wlr_box box;
-	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
-
-	pixman_op_t op = get_pixman_blending(options->color.a == 1 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	struct pixman_color color = {
-		.red = options->color.r * 0xFFFF,
-		.green = options->color.g * 0xFFFF,
-		.blue = options->color.b * 0xFFFF,
-		.alpha = options->color.a * 0xFFFF,
+	int64_t start_nsec = pass->timer != NULL ? get_time_nsec() : 0;
+
+	struct composite_op op = {
+		.op = get_pixman_blending(options->color.a == 1 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode),
+		.src_color = {
+			.red = options->color.r * 0xFFFF,
+			.green = options->color.g * 0xFFFF,
+			.blue = options->color.b * 0xFFFF,
+			.alpha = options->color.a * 0xFFFF,
+		},
+		.clip = options->clip,
 	};
+	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &op.dst_box);
 
-	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
-
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
-	pixman_image_composite32(op, fill, NULL, buffer->image,
-		0, 0, 0, 0, box.x, box.y, box.width, box.height);
-	pixman_image_set_clip_region32(buffer->image, NULL);
+	composite(pass, &op);
 
-	pixman_image_unref(fill);
+	if (pass->timer != NULL) {
+		pass->timer->durations.fill_nsec += get_time_nsec() - start_nsec;
+	}
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -232,7 +514,7 @@ static const struct wlr_render_pass_impl render_pass_impl = {
 };
 
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-		struct wlr_pixman_buffer *buffer) {
+		struct wlr_pixman_buffer *buffer, struct wlr_pixman_render_timer *timer) {
 	struct wlr_pixman_render_pass *pass = calloc(1, sizeof(*pass));
 	if (pass == NULL) {
 		return NULL;
@@ -249,5 +531,20 @@ struct wlr_pixman_render_pass *begin_pixman_render_pass(
 	wlr_buffer_lock(buffer->buffer);
 	pass->buffer = buffer;
 
+	// The contents of textures created from this buffer are about to change
+	struct wlr_pixman_texture *texture;
+	wl_list_for_each(texture, &buffer->renderer->textures, link) {
+		if (texture->buffer == buffer->buffer) {
+			pixman_texture_invalidate_transform_cache(texture);
+		}
+	}
+
+	if (timer != NULL) {
+		timer->start_nsec = get_time_nsec();
+		timer->duration_nsec = -1;
+		timer->durations = (struct wlr_pixman_render_timer_durations){0};
+		pass->timer = timer;
+	}
+
 	return pass;
 }
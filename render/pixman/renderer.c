@@ -9,13 +9,26 @@
 
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/thread_pool.h"
 
 static const struct wlr_renderer_impl renderer_impl;
+static const struct wlr_render_timer_impl render_timer_impl;
 
 bool wlr_renderer_is_pixman(struct wlr_renderer *wlr_renderer) {
 	return wlr_renderer->impl == &renderer_impl;
 }
 
+bool wlr_render_timer_is_pixman(struct wlr_render_timer *timer) {
+	return timer->impl == &render_timer_impl;
+}
+
+struct wlr_pixman_render_timer *pixman_get_render_timer(
+		struct wlr_render_timer *wlr_timer) {
+	assert(wlr_render_timer_is_pixman(wlr_timer));
+	struct wlr_pixman_render_timer *timer = wl_container_of(wlr_timer, timer, base);
+	return timer;
+}
+
 static struct wlr_pixman_renderer *get_renderer(
 		struct wlr_renderer *wlr_renderer) {
 	assert(wlr_renderer_is_pixman(wlr_renderer));
@@ -80,9 +93,18 @@ static struct wlr_pixman_texture *get_texture(
 	return texture;
 }
 
+void pixman_texture_invalidate_transform_cache(struct wlr_pixman_texture *texture) {
+	if (texture->transform_cache.image != NULL) {
+		pixman_image_unref(texture->transform_cache.image);
+	}
+	texture->transform_cache.image = NULL;
+	texture->transform_cache.valid = false;
+}
+
 static void texture_destroy(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	wl_list_remove(&texture->link);
+	pixman_texture_invalidate_transform_cache(texture);
 	pixman_image_unref(texture->image);
 	wlr_buffer_unlock(texture->buffer);
 	free(texture->data);
@@ -289,6 +311,10 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 
 	wlr_drm_format_set_finish(&renderer->drm_formats);
 
+	if (renderer->thread_pool != NULL) {
+		thread_pool_destroy(renderer->thread_pool);
+	}
+
 	free(renderer);
 }
 
@@ -304,19 +330,54 @@ static struct wlr_render_pass *pixman_begin_buffer_pass(struct wlr_renderer *wlr
 		return NULL;
 	}
 
-	struct wlr_pixman_render_pass *pass = begin_pixman_render_pass(buffer);
+	struct wlr_pixman_render_timer *timer = NULL;
+	if (options->timer) {
+		timer = pixman_get_render_timer(options->timer);
+	}
+
+	struct wlr_pixman_render_pass *pass = begin_pixman_render_pass(buffer, timer);
 	if (pass == NULL) {
 		return NULL;
 	}
 	return &pass->base;
 }
 
+static struct wlr_render_timer *pixman_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_render_timer *timer = calloc(1, sizeof(*timer));
+	if (!timer) {
+		return NULL;
+	}
+	timer->base.impl = &render_timer_impl;
+	timer->duration_nsec = -1;
+	return &timer->base;
+}
+
+static int pixman_get_render_time(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = pixman_get_render_timer(wlr_timer);
+	if (timer->duration_nsec < 0) {
+		wlr_log(WLR_ERROR, "timer was read before the render pass was submitted");
+	}
+	return timer->duration_nsec;
+}
+
+static void pixman_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = pixman_get_render_timer(wlr_timer);
+	free(timer);
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.get_texture_formats = pixman_get_texture_formats,
 	.get_render_formats = pixman_get_render_formats,
 	.texture_from_buffer = pixman_texture_from_buffer,
 	.destroy = pixman_destroy,
 	.begin_buffer_pass = pixman_begin_buffer_pass,
+	.render_timer_create = pixman_render_timer_create,
+};
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = pixman_get_render_time,
+	.destroy = pixman_render_timer_destroy,
 };
 
 struct wlr_renderer *wlr_pixman_renderer_create(void) {
@@ -361,3 +422,30 @@ pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	return texture->image;
 }
+
+void wlr_pixman_render_timer_get_durations(struct wlr_render_timer *wlr_timer,
+		struct wlr_pixman_render_timer_durations *durations) {
+	struct wlr_pixman_render_timer *timer = pixman_get_render_timer(wlr_timer);
+	*durations = timer->durations;
+}
+
+bool wlr_pixman_renderer_set_threads(struct wlr_renderer *wlr_renderer,
+		size_t n_threads) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+
+	struct thread_pool *pool = NULL;
+	if (n_threads > 1) {
+		// The thread running the render pass takes part in the work
+		pool = thread_pool_create(n_threads - 1);
+		if (pool == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create pixman renderer threads");
+			return false;
+		}
+	}
+
+	if (renderer->thread_pool != NULL) {
+		thread_pool_destroy(renderer->thread_pool);
+	}
+	renderer->thread_pool = pool;
+	return true;
+}
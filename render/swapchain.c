@@ -5,6 +5,7 @@
 #include <wlr/types/wlr_buffer.h>
 #include "render/allocator/allocator.h"
 #include "render/drm_format_set.h"
+#include "util/time.h"
 
 static void swapchain_handle_allocator_destroy(struct wl_listener *listener,
 		void *data) {
@@ -52,6 +53,9 @@ void wlr_swapchain_destroy(struct wlr_swapchain *swapchain) {
 	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
 		slot_reset(&swapchain->slots[i]);
 	}
+	if (swapchain->idle_trim_timer != NULL) {
+		wl_event_source_remove(swapchain->idle_trim_timer);
+	}
 	wl_list_remove(&swapchain->allocator_destroy.link);
 	wlr_drm_format_finish(&swapchain->format);
 	free(swapchain);
@@ -70,6 +74,7 @@ static struct wlr_buffer *slot_acquire(struct wlr_swapchain *swapchain,
 	assert(slot->buffer != NULL);
 
 	slot->acquired = true;
+	slot->last_acquired_msec = get_current_time_msec();
 
 	slot->release.notify = slot_handle_release;
 	wl_signal_add(&slot->buffer->events.release, &slot->release);
@@ -77,17 +82,133 @@ static struct wlr_buffer *slot_acquire(struct wlr_swapchain *swapchain,
 	return wlr_buffer_lock(slot->buffer);
 }
 
+static size_t swapchain_buffer_count(struct wlr_swapchain *swapchain) {
+	size_t n = 0;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].buffer != NULL) {
+			n++;
+		}
+	}
+	return n;
+}
+
+static void swapchain_trim(struct wlr_swapchain *swapchain) {
+	if (swapchain->idle_trim_msec <= 0) {
+		return;
+	}
+
+	int64_t deadline = get_current_time_msec() - swapchain->idle_trim_msec;
+	size_t n_buffers = swapchain_buffer_count(swapchain);
+	while (n_buffers > swapchain->idle_trim_min_buffers) {
+		// Release the least recently used idle buffer first. Dropping it
+		// destroys the buffer, which removes it from any damage ring: a
+		// buffer allocated later on is then treated as fully damaged.
+		struct wlr_swapchain_slot *oldest = NULL;
+		for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+			struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+			if (slot->buffer == NULL || slot->acquired ||
+					slot->last_acquired_msec > deadline) {
+				continue;
+			}
+			if (oldest == NULL ||
+					slot->last_acquired_msec < oldest->last_acquired_msec) {
+				oldest = slot;
+			}
+		}
+		if (oldest == NULL) {
+			break;
+		}
+
+		slot_reset(oldest);
+		n_buffers--;
+		swapchain->stats.trims++;
+	}
+}
+
+static void idle_trim_timer_update(struct wlr_swapchain *swapchain) {
+	swapchain->idle_trim_deadline_msec = 0;
+	if (swapchain->idle_trim_timer == NULL) {
+		return;
+	}
+	if (swapchain_buffer_count(swapchain) <= swapchain->idle_trim_min_buffers) {
+		wl_event_source_timer_update(swapchain->idle_trim_timer, 0);
+		return;
+	}
+
+	// Wake up when the least recently used idle buffer expires. Buffers
+	// which are still acquired are checked again a full period later.
+	int64_t now = get_current_time_msec();
+	int64_t deadline = now + swapchain->idle_trim_msec;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer == NULL || slot->acquired) {
+			continue;
+		}
+		int64_t expiry = slot->last_acquired_msec + swapchain->idle_trim_msec;
+		if (expiry < deadline) {
+			deadline = expiry;
+		}
+	}
+	if (deadline <= now) {
+		deadline = now + 1;
+	}
+
+	swapchain->idle_trim_deadline_msec = deadline;
+	wl_event_source_timer_update(swapchain->idle_trim_timer, deadline - now);
+}
+
+static int handle_idle_trim_timer(void *data) {
+	struct wlr_swapchain *swapchain = data;
+	swapchain_trim(swapchain);
+	idle_trim_timer_update(swapchain);
+	return 0;
+}
+
+void wlr_swapchain_set_idle_trim(struct wlr_swapchain *swapchain,
+		struct wl_event_loop *loop, int idle_msec, size_t min_buffers) {
+	if (swapchain->idle_trim_timer != NULL) {
+		wl_event_source_remove(swapchain->idle_trim_timer);
+		swapchain->idle_trim_timer = NULL;
+	}
+	swapchain->idle_trim_deadline_msec = 0;
+
+	swapchain->idle_trim_msec = idle_msec > 0 ? idle_msec : 0;
+	swapchain->idle_trim_min_buffers = min_buffers;
+	if (swapchain->idle_trim_msec == 0 || loop == NULL) {
+		return;
+	}
+
+	swapchain->idle_trim_timer = wl_event_loop_add_timer(loop,
+		handle_idle_trim_timer, swapchain);
+	if (swapchain->idle_trim_timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create swapchain idle trim timer");
+		return;
+	}
+	idle_trim_timer_update(swapchain);
+}
+
 struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain) {
-	struct wlr_swapchain_slot *free_slot = NULL;
+	// Acquiring only refreshes the slot timestamps, the timer re-arms
+	// itself from them once it fires
+	swapchain_trim(swapchain);
+
+	// Prefer the most recently used buffer, so that buffers only needed
+	// under pipelining pressure become idle and can be trimmed
+	struct wlr_swapchain_slot *free_slot = NULL, *reuse_slot = NULL;
 	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
 		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
 		if (slot->acquired) {
 			continue;
 		}
-		if (slot->buffer != NULL) {
-			return slot_acquire(swapchain, slot);
+		if (slot->buffer == NULL) {
+			free_slot = slot;
+		} else if (reuse_slot == NULL ||
+				slot->last_acquired_msec > reuse_slot->last_acquired_msec) {
+			reuse_slot = slot;
 		}
-		free_slot = slot;
+	}
+	if (reuse_slot != NULL) {
+		return slot_acquire(swapchain, reuse_slot);
 	}
 	if (free_slot == NULL) {
 		wlr_log(WLR_ERROR, "No free output buffer slot");
@@ -105,7 +226,13 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain) {
 		wlr_log(WLR_ERROR, "Failed to allocate buffer");
 		return NULL;
 	}
-	return slot_acquire(swapchain, free_slot);
+	swapchain->stats.allocations++;
+	struct wlr_buffer *buffer = slot_acquire(swapchain, free_slot);
+	if (swapchain->idle_trim_deadline_msec == 0) {
+		// The timer is disarmed while there is nothing to trim
+		idle_trim_timer_update(swapchain);
+	}
+	return buffer;
 }
 
 bool wlr_swapchain_has_buffer(struct wlr_swapchain *swapchain,
@@ -130,11 +130,13 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 		};
 		mat3_to_mat4(final_matrix, vert_pcr_data.mat4);
 
-		if (pass->color_transform) {
-			bind_pipeline(pass, render_buffer->plain.render_setup->output_pipe_lut3d);
-		} else {
-			bind_pipeline(pass, render_buffer->plain.render_setup->output_pipe_srgb);
+		VkPipeline output_pipe = setup_get_or_create_output_pipeline(
+			render_buffer->plain.render_setup, pass->color_transform ?
+			WLR_VK_OUTPUT_TRANSFORM_LUT3D : WLR_VK_OUTPUT_TRANSFORM_INVERSE_SRGB);
+		if (output_pipe == VK_NULL_HANDLE) {
+			goto error;
 		}
+		bind_pipeline(pass, output_pipe);
 		vkCmdPushConstants(render_cb->vk, renderer->output_pipe_layout,
 			VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vert_pcr_data), &vert_pcr_data);
 		vkCmdPushConstants(render_cb->vk, renderer->output_pipe_layout,
@@ -335,10 +337,16 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	free(acquire_barriers);
 	free(release_barriers);
 
-	// No semaphores needed here.
-	// We don't need a semaphore from the stage/transfer submission
-	// to the render submissions since they are on the same queue
-	// and we have a renderpass dependency for that.
+	// Uploads on the dedicated transfer queue run concurrently with
+	// previously submitted rendering, the stage submission waits for them
+	VkSemaphoreSubmitInfoKHR transfer_wait;
+	if (!vulkan_submit_transfer_cb(renderer, &transfer_wait)) {
+		goto error;
+	}
+
+	// We don't need a semaphore from the stage submission to the render
+	// submissions since they are on the same queue and we have a
+	// renderpass dependency for that.
 	uint64_t stage_timeline_point = vulkan_end_command_buffer(stage_cb, renderer);
 	if (stage_timeline_point == 0) {
 		goto error;
@@ -361,18 +369,21 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 		.pSignalSemaphoreInfos = &stage_signal,
 	};
 
-	VkSemaphoreSubmitInfoKHR stage_wait;
+	VkSemaphoreSubmitInfoKHR stage_wait[2];
+	uint32_t stage_wait_len = 0;
 	if (renderer->stage.last_timeline_point > 0) {
-		stage_wait = (VkSemaphoreSubmitInfoKHR){
+		stage_wait[stage_wait_len++] = (VkSemaphoreSubmitInfoKHR){
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
 			.semaphore = renderer->timeline_semaphore,
 			.value = renderer->stage.last_timeline_point,
 			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
 		};
-
-		stage_submit.waitSemaphoreInfoCount = 1;
-		stage_submit.pWaitSemaphoreInfos = &stage_wait;
 	}
+	if (transfer_wait.semaphore != VK_NULL_HANDLE) {
+		stage_wait[stage_wait_len++] = transfer_wait;
+	}
+	stage_submit.waitSemaphoreInfoCount = stage_wait_len;
+	stage_submit.pWaitSemaphoreInfos = stage_wait;
 
 	renderer->stage.last_timeline_point = stage_timeline_point;
 
@@ -437,19 +448,14 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 
 	free(render_wait);
 
-	struct wlr_vk_shared_buffer *stage_buf, *stage_buf_tmp;
-	wl_list_for_each_safe(stage_buf, stage_buf_tmp, &renderer->stage.buffers, link) {
-		if (stage_buf->allocs.size == 0) {
-			continue;
-		}
-		wl_list_remove(&stage_buf->link);
-		wl_list_insert(&stage_cb->stage_buffers, &stage_buf->link);
-	}
+	vulkan_stage_fence(renderer, stage_timeline_point);
 
 	if (!vulkan_sync_render_buffer(renderer, render_buffer, render_cb)) {
 		wlr_log(WLR_ERROR, "Failed to sync render buffer");
 	}
 
+	vulkan_pipeline_cache_handle_pass(renderer);
+
 	wlr_color_transform_unref(pass->color_transform);
 	wlr_buffer_unlock(render_buffer->wlr_buffer);
 	rect_union_finish(&pass->updated_region);
@@ -699,6 +705,7 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	}
 
 	texture->last_used_cb = pass->command_buffer;
+	texture->last_read_cb = pass->command_buffer;
 
 	pixman_region32_fini(&clip);
 }
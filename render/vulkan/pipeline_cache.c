@@ -0,0 +1,295 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "render/vulkan.h"
+#include "util/env.h"
+
+// Number of render passes without any new pipeline after which the cache is
+// considered settled and saved
+#define SETTLED_PASSES 120
+
+// Same layout as VkPipelineCacheHeaderVersionOne
+struct pipeline_cache_header {
+	uint32_t header_size;
+	uint32_t header_version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+};
+
+static void format_uuid(char out[static 2 * VK_UUID_SIZE + 1],
+		const uint8_t uuid[static VK_UUID_SIZE]) {
+	for (size_t i = 0; i < VK_UUID_SIZE; i++) {
+		sprintf(&out[2 * i], "%02x", uuid[i]);
+	}
+}
+
+static bool make_dir(const char *path) {
+	if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		wlr_log_errno(WLR_DEBUG, "Failed to create directory %s", path);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Get the path of the cache file for the device, creating its parent
+ * directories. The file name contains the driver and device UUIDs, so that
+ * driver updates and other GPUs don't pick up unrelated caches.
+ */
+static char *get_cache_path(VkPhysicalDevice phdev) {
+	char dir[PATH_MAX];
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home != NULL && xdg_cache_home[0] == '/') {
+		snprintf(dir, sizeof(dir), "%s", xdg_cache_home);
+	} else {
+		const char *home = getenv("HOME");
+		if (home == NULL || home[0] != '/') {
+			return NULL;
+		}
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+		if (!make_dir(dir)) {
+			return NULL;
+		}
+	}
+
+	size_t dir_len = strlen(dir);
+	snprintf(dir + dir_len, sizeof(dir) - dir_len, "/wlroots");
+	if (!make_dir(dir)) {
+		return NULL;
+	}
+
+	VkPhysicalDeviceIDProperties id_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+	};
+	VkPhysicalDeviceProperties2 props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &id_props,
+	};
+	vkGetPhysicalDeviceProperties2(phdev, &props);
+
+	char driver_uuid[2 * VK_UUID_SIZE + 1], device_uuid[2 * VK_UUID_SIZE + 1];
+	format_uuid(driver_uuid, id_props.driverUUID);
+	format_uuid(device_uuid, id_props.deviceUUID);
+
+	char path[PATH_MAX];
+	int n = snprintf(path, sizeof(path), "%s/vulkan-pipeline-cache-%s-%s",
+		dir, driver_uuid, device_uuid);
+	if (n < 0 || (size_t)n >= sizeof(path)) {
+		return NULL;
+	}
+	return strdup(path);
+}
+
+static bool check_header(VkPhysicalDevice phdev, const void *data, size_t size) {
+	struct pipeline_cache_header header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(phdev, &props);
+
+	return header.header_size >= sizeof(header) &&
+		header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header.vendor_id == props.vendorID &&
+		header.device_id == props.deviceID &&
+		memcmp(header.pipeline_cache_uuid, props.pipelineCacheUUID,
+			VK_UUID_SIZE) == 0;
+}
+
+static void *read_cache_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			wlr_log_errno(WLR_DEBUG, "Failed to open %s", path);
+		}
+		return NULL;
+	}
+
+	void *data = NULL;
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0) {
+		goto out;
+	}
+
+	data = malloc(st.st_size);
+	if (data == NULL) {
+		goto out;
+	}
+	if (fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+		wlr_log(WLR_DEBUG, "Failed to read %s", path);
+		free(data);
+		data = NULL;
+		goto out;
+	}
+	*size = st.st_size;
+
+out:
+	fclose(f);
+	return data;
+}
+
+bool vulkan_init_pipeline_cache(struct wlr_vk_renderer *renderer) {
+	VkPhysicalDevice phdev = renderer->dev->phdev;
+
+	void *data = NULL;
+	size_t size = 0;
+	if (!env_parse_bool("WLR_RENDER_NO_PIPELINE_CACHE")) {
+		renderer->pipeline_cache.path = get_cache_path(phdev);
+	}
+	if (renderer->pipeline_cache.path != NULL) {
+		data = read_cache_file(renderer->pipeline_cache.path, &size);
+		if (data != NULL && !check_header(phdev, data, size)) {
+			wlr_log(WLR_DEBUG, "Ignoring stale Vulkan pipeline cache %s",
+				renderer->pipeline_cache.path);
+			free(data);
+			data = NULL;
+			size = 0;
+		}
+	}
+
+	VkPipelineCacheCreateInfo info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = data,
+	};
+	VkResult res = vkCreatePipelineCache(renderer->dev->dev, &info, NULL,
+		&renderer->pipeline_cache.cache);
+	free(data);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreatePipelineCache", res);
+		return false;
+	}
+
+	if (size > 0) {
+		wlr_log(WLR_DEBUG, "Loaded Vulkan pipeline cache %s (%zu bytes)",
+			renderer->pipeline_cache.path, size);
+	}
+	return true;
+}
+
+void vulkan_save_pipeline_cache(struct wlr_vk_renderer *renderer) {
+	VkDevice dev = renderer->dev->dev;
+	const char *path = renderer->pipeline_cache.path;
+	if (renderer->pipeline_cache.cache == VK_NULL_HANDLE || path == NULL ||
+			!renderer->pipeline_cache.dirty) {
+		return;
+	}
+	// Don't retry right away if saving fails
+	renderer->pipeline_cache.settled_passes = 0;
+
+	size_t size = 0;
+	VkResult res = vkGetPipelineCacheData(dev, renderer->pipeline_cache.cache,
+		&size, NULL);
+	if (res != VK_SUCCESS || size == 0) {
+		return;
+	}
+	void *data = malloc(size);
+	if (data == NULL) {
+		return;
+	}
+	res = vkGetPipelineCacheData(dev, renderer->pipeline_cache.cache,
+		&size, data);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetPipelineCacheData", res);
+		free(data);
+		return;
+	}
+
+	// Write to a temporary file and rename it, so that concurrent compositor
+	// instances never read a partially written cache
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open %s", tmp_path);
+		free(data);
+		return;
+	}
+
+	bool ok = true;
+	size_t written = 0;
+	while (written < size) {
+		ssize_t n = write(fd, (const char *)data + written, size - written);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			wlr_log_errno(WLR_DEBUG, "Failed to write %s", tmp_path);
+			ok = false;
+			break;
+		}
+		written += n;
+	}
+	close(fd);
+	free(data);
+
+	if (ok && rename(tmp_path, path) != 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to rename %s", tmp_path);
+		ok = false;
+	}
+	if (!ok) {
+		unlink(tmp_path);
+		return;
+	}
+
+	renderer->pipeline_cache.dirty = false;
+	wlr_log(WLR_DEBUG, "Saved Vulkan pipeline cache %s (%zu bytes)", path, size);
+}
+
+VkResult vulkan_create_cached_pipeline(struct wlr_vk_renderer *renderer,
+		VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline) {
+	VkPipelineCreationFeedbackEXT feedback = {0};
+	VkPipelineCreationFeedbackCreateInfoEXT feedback_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT,
+		.pNext = info->pNext,
+		.pPipelineCreationFeedback = &feedback,
+	};
+	if (renderer->dev->pipeline_creation_feedback) {
+		info->pNext = &feedback_info;
+	}
+
+	VkResult res = vkCreateGraphicsPipelines(renderer->dev->dev,
+		renderer->pipeline_cache.cache, 1, info, NULL, pipeline);
+	info->pNext = feedback_info.pNext;
+	if (res != VK_SUCCESS) {
+		return res;
+	}
+
+	// Without feedback, assume that the pipeline wasn't cached
+	bool cache_hit = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) &&
+		(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT);
+	if (!cache_hit) {
+		renderer->pipeline_cache.dirty = true;
+		renderer->pipeline_cache.settled_passes = 0;
+	}
+	return VK_SUCCESS;
+}
+
+void vulkan_pipeline_cache_handle_pass(struct wlr_vk_renderer *renderer) {
+	if (!renderer->pipeline_cache.dirty) {
+		return;
+	}
+
+	// Pipelines are created on first use, so most of them are created during
+	// the first frames. Saving then means the cache survives crashes, while
+	// not writing it again for every new pipeline.
+	renderer->pipeline_cache.settled_passes++;
+	if (renderer->pipeline_cache.settled_passes >= SETTLED_PASSES) {
+		vulkan_save_pipeline_cache(renderer);
+	}
+}
+
+void vulkan_finish_pipeline_cache(struct wlr_vk_renderer *renderer) {
+	vulkan_save_pipeline_cache(renderer);
+	vkDestroyPipelineCache(renderer->dev->dev, renderer->pipeline_cache.cache, NULL);
+	free(renderer->pipeline_cache.path);
+}
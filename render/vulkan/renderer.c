@@ -29,9 +29,6 @@
 #include "types/wlr_matrix.h"
 
 // TODO:
-// - simplify stage allocation, don't track allocations but use ringbuffer-like
-// - use a pipeline cache (not sure when to save though, after every pipeline
-//   creation?)
 // - create pipelines as derivatives of each other
 // - evaluate if creating VkDeviceMemory pools is a good idea.
 //   We can expect wayland client images to be fairly large (and shouldn't
@@ -39,7 +36,7 @@
 //   might still be a good idea.
 
 static const VkDeviceSize min_stage_size = 1024 * 1024; // 1MB
-static const VkDeviceSize max_stage_size = 256 * min_stage_size; // 256MB
+static const VkDeviceSize default_stage_budget = 256 * min_stage_size; // 256MB
 static const size_t start_descriptor_pool_size = 256u;
 static bool default_debug = true;
 
@@ -169,18 +166,18 @@ static void destroy_render_format_setup(struct wlr_vk_renderer *renderer,
 	free(setup);
 }
 
-static void shared_buffer_destroy(struct wlr_vk_renderer *r,
-		struct wlr_vk_shared_buffer *buffer) {
+static void stage_buffer_destroy(struct wlr_vk_renderer *r,
+		struct wlr_vk_stage_buffer *buffer) {
 	if (!buffer) {
 		return;
 	}
 
-	if (buffer->allocs.size > 0) {
-		wlr_log(WLR_ERROR, "shared_buffer_finish: %zu allocations left",
-			buffer->allocs.size / sizeof(struct wlr_vk_allocation));
+	if (buffer->head != buffer->tail) {
+		wlr_log(WLR_ERROR, "stage_buffer_destroy: %" PRIu64 " bytes in use",
+			buffer->head - buffer->tail);
 	}
 
-	wl_array_release(&buffer->allocs);
+	wl_array_release(&buffer->fences);
 	if (buffer->cpu_mapping) {
 		vkUnmapMemory(r->dev->dev, buffer->memory);
 		buffer->cpu_mapping = NULL;
@@ -192,80 +189,20 @@ static void shared_buffer_destroy(struct wlr_vk_renderer *r,
 		vkFreeMemory(r->dev->dev, buffer->memory, NULL);
 	}
 
+	r->stage.stats.bytes_allocated -= buffer->buf_size;
 	wl_list_remove(&buffer->link);
 	free(buffer);
 }
 
-struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
-		VkDeviceSize size, VkDeviceSize alignment) {
-	// try to find free span
-	// simple greedy allocation algorithm - should be enough for this usecase
-	// since all allocations are freed together after the frame
-	struct wlr_vk_shared_buffer *buf;
-	wl_list_for_each_reverse(buf, &r->stage.buffers, link) {
-		VkDeviceSize start = 0u;
-		if (buf->allocs.size > 0) {
-			const struct wlr_vk_allocation *allocs = buf->allocs.data;
-			size_t allocs_len = buf->allocs.size / sizeof(struct wlr_vk_allocation);
-			const struct wlr_vk_allocation *last = &allocs[allocs_len - 1];
-			start = last->start + last->size;
-		}
-
-		assert(start <= buf->buf_size);
-
-		// ensure the proposed start is a multiple of alignment
-		start += alignment - 1 - ((start + alignment - 1) % alignment);
-
-		if (buf->buf_size - start < size) {
-			continue;
-		}
-
-		struct wlr_vk_allocation *a = wl_array_add(&buf->allocs, sizeof(*a));
-		if (a == NULL) {
-			wlr_log_errno(WLR_ERROR, "Allocation failed");
-			goto error_alloc;
-		}
-
-		*a = (struct wlr_vk_allocation){
-			.start = start,
-			.size = size,
-		};
-		return (struct wlr_vk_buffer_span) {
-			.buffer = buf,
-			.alloc = *a,
-		};
-	}
-
-	if (size > max_stage_size) {
-		wlr_log(WLR_ERROR, "cannot vulkan stage buffer: "
-			"requested size (%zu bytes) exceeds maximum (%zu bytes)",
-			(size_t)size, (size_t)max_stage_size);
-		goto error_alloc;
-	}
-
-	// we didn't find a free buffer - create one
-	// size = clamp(max(size * 2, prev_size * 2), min_size, max_size)
-	VkDeviceSize bsize = size * 2;
-	bsize = bsize < min_stage_size ? min_stage_size : bsize;
-	if (!wl_list_empty(&r->stage.buffers)) {
-		struct wl_list *last_link = r->stage.buffers.prev;
-		struct wlr_vk_shared_buffer *prev = wl_container_of(
-			last_link, prev, link);
-		VkDeviceSize last_size = 2 * prev->buf_size;
-		bsize = bsize < last_size ? last_size : bsize;
-	}
-
-	if (bsize > max_stage_size) {
-		wlr_log(WLR_INFO, "vulkan stage buffers have reached max size");
-		bsize = max_stage_size;
-	}
-
-	// create buffer
-	buf = calloc(1, sizeof(*buf));
+static struct wlr_vk_stage_buffer *stage_buffer_create(
+		struct wlr_vk_renderer *r, VkDeviceSize bsize) {
+	struct wlr_vk_stage_buffer *buf = calloc(1, sizeof(*buf));
 	if (!buf) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		goto error_alloc;
+		return NULL;
 	}
+	wl_list_init(&buf->link);
+	wl_array_init(&buf->fences);
 
 	VkResult res;
 	VkBufferCreateInfo buf_info = {
@@ -275,6 +212,13 @@ struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 	};
+	// Uploads use the transfer queue, read-backs the graphics queue
+	uint32_t queue_families[] = { r->dev->queue_family, r->dev->transfer_queue_family };
+	if (r->dev->transfer_queue != VK_NULL_HANDLE) {
+		buf_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		buf_info.queueFamilyIndexCount = 2;
+		buf_info.pQueueFamilyIndices = queue_families;
+	}
 	res = vkCreateBuffer(r->dev->dev, &buf_info, NULL, &buf->buffer);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkCreateBuffer", res);
@@ -315,35 +259,260 @@ struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
 		goto error;
 	}
 
-	struct wlr_vk_allocation *a = wl_array_add(&buf->allocs, sizeof(*a));
-	if (a == NULL) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
-		goto error;
-	}
-
 	wlr_log(WLR_DEBUG, "Created new vk staging buffer of size %" PRIu64, bsize);
 	buf->buf_size = bsize;
-	wl_list_insert(&r->stage.buffers, &buf->link);
+	r->stage.stats.bytes_allocated += bsize;
+	return buf;
+
+error:
+	stage_buffer_destroy(r, buf);
+	return NULL;
+}
+
+static struct wlr_vk_stage_buffer *get_current_stage_buffer(
+		struct wlr_vk_renderer *r) {
+	if (wl_list_empty(&r->stage.buffers)) {
+		return NULL;
+	}
+	struct wlr_vk_stage_buffer *buf =
+		wl_container_of(r->stage.buffers.next, buf, link);
+	return buf;
+}
+
+static bool stage_buffer_alloc(struct wlr_vk_stage_buffer *buf,
+		VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *start) {
+	if (buf->head == buf->tail) {
+		// Idle, start over from the beginning to avoid wrapping
+		buf->head = buf->tail = buf->submitted = 0;
+	}
+
+	uint64_t head = buf->head;
+	VkDeviceSize offset = head % buf->buf_size;
+	// ensure the proposed start is a multiple of alignment
+	VkDeviceSize aligned = offset + alignment - 1 -
+		((offset + alignment - 1) % alignment);
+	if (aligned + size > buf->buf_size) {
+		// doesn't fit until the end of the buffer, wrap around
+		head += buf->buf_size - offset;
+		offset = aligned = 0;
+	}
+
+	uint64_t end = head + (aligned - offset) + size;
+	if (end - buf->tail > buf->buf_size) {
+		return false;
+	}
+
+	buf->head = end;
+	*start = aligned;
+	return true;
+}
+
+// Releases the allocations of completed submissions and destroys idle
+// retired buffers
+static bool reclaim_stage_buffers(struct wlr_vk_renderer *r) {
+	uint64_t current_point;
+	VkResult res = r->dev->api.vkGetSemaphoreCounterValueKHR(r->dev->dev,
+		r->timeline_semaphore, &current_point);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetSemaphoreCounterValueKHR", res);
+		return false;
+	}
+
+	struct wlr_vk_stage_buffer *current = get_current_stage_buffer(r);
+	struct wlr_vk_stage_buffer *buf, *buf_tmp;
+	wl_list_for_each_safe(buf, buf_tmp, &r->stage.buffers, link) {
+		struct wlr_vk_stage_fence *fences = buf->fences.data;
+		size_t fences_len = buf->fences.size / sizeof(fences[0]);
+		size_t done = 0;
+		while (done < fences_len && fences[done].timeline_point <= current_point) {
+			buf->tail = fences[done].end;
+			done++;
+		}
+		if (done > 0) {
+			memmove(fences, &fences[done], (fences_len - done) * sizeof(fences[0]));
+			buf->fences.size -= done * sizeof(fences[0]);
+		}
 
-	*a = (struct wlr_vk_allocation){
-		.start = 0,
-		.size = size,
+		if (buf != current && buf->head == buf->tail) {
+			stage_buffer_destroy(r, buf);
+		}
+	}
+
+	return true;
+}
+
+static bool wait_timeline_point(struct wlr_vk_renderer *r, uint64_t point) {
+	VkSemaphoreWaitInfoKHR wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+		.semaphoreCount = 1,
+		.pSemaphores = &r->timeline_semaphore,
+		.pValues = &point,
 	};
+	VkResult res = r->dev->api.vkWaitSemaphoresKHR(r->dev->dev,
+		&wait_info, UINT64_MAX);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkWaitSemaphoresKHR", res);
+		return false;
+	}
+	return true;
+}
+
+// Returns the oldest timeline point stage allocations are waiting on, or 0
+// if there is none
+static uint64_t get_oldest_stage_fence(struct wlr_vk_renderer *r) {
+	uint64_t oldest = 0;
+	struct wlr_vk_stage_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		if (buf->fences.size == 0) {
+			continue;
+		}
+		const struct wlr_vk_stage_fence *fence = buf->fences.data;
+		if (oldest == 0 || fence->timeline_point < oldest) {
+			oldest = fence->timeline_point;
+		}
+	}
+	return oldest;
+}
+
+// Replaces the current buffer with a bigger one if the budget allows it
+static struct wlr_vk_stage_buffer *grow_stage_buffer(struct wlr_vk_renderer *r,
+		VkDeviceSize size, bool *failed) {
+	struct wlr_vk_stage_buffer *current = get_current_stage_buffer(r);
+	VkDeviceSize available = 0;
+	if (r->stage.budget > r->stage.stats.bytes_allocated) {
+		available = r->stage.budget - r->stage.stats.bytes_allocated;
+	}
+	if (current != NULL && current->head == current->tail) {
+		// the idle current buffer is destroyed before creating the new one
+		available += current->buf_size;
+	}
+
+	// size = clamp(max(size * 2, prev_size * 2), min_size, available)
+	VkDeviceSize bsize = size * 2;
+	bsize = bsize < min_stage_size ? min_stage_size : bsize;
+	if (current != NULL && bsize < 2 * current->buf_size) {
+		bsize = 2 * current->buf_size;
+	}
+	if (bsize > available) {
+		bsize = available;
+	}
+	if (bsize < size) {
+		return NULL;
+	}
+
+	if (current != NULL && current->head == current->tail) {
+		stage_buffer_destroy(r, current);
+	}
+
+	struct wlr_vk_stage_buffer *buf = stage_buffer_create(r, bsize);
+	if (buf == NULL) {
+		*failed = true;
+		return NULL;
+	}
+	wl_list_insert(&r->stage.buffers, &buf->link);
+	return buf;
+}
+
+struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
+		VkDeviceSize size, VkDeviceSize alignment) {
+	if (size > r->stage.budget) {
+		wlr_log(WLR_ERROR, "cannot vulkan stage buffer: "
+			"requested size (%zu bytes) exceeds budget (%zu bytes)",
+			(size_t)size, (size_t)r->stage.budget);
+		goto error;
+	}
+
+	// Fast path: the current buffer has enough free space
+	VkDeviceSize start;
+	struct wlr_vk_stage_buffer *buf = get_current_stage_buffer(r);
+	if (buf != NULL && stage_buffer_alloc(buf, size, alignment, &start)) {
+		goto out;
+	}
+
+	while (true) {
+		if (!reclaim_stage_buffers(r)) {
+			goto error;
+		}
+
+		buf = get_current_stage_buffer(r);
+		if (buf != NULL && stage_buffer_alloc(buf, size, alignment, &start)) {
+			goto out;
+		}
+
+		bool failed = false;
+		buf = grow_stage_buffer(r, size, &failed);
+		if (failed) {
+			goto error;
+		} else if (buf != NULL &&
+				stage_buffer_alloc(buf, size, alignment, &start)) {
+			goto out;
+		}
+
+		// Out of budget, wait for the oldest submission using staging memory
+		uint64_t point = get_oldest_stage_fence(r);
+		if (point == 0) {
+			wlr_log(WLR_ERROR, "vulkan staging budget exhausted by "
+				"pending uploads");
+			goto error;
+		}
+
+		wlr_log(WLR_DEBUG, "Waiting for staging memory (%zu bytes)",
+			(size_t)size);
+		r->stage.stats.stalls++;
+		if (!wait_timeline_point(r, point)) {
+			goto error;
+		}
+	}
+
+out:
+	r->stage.stats.bytes_uploaded += size;
+
+	uint64_t in_use = 0;
+	struct wlr_vk_stage_buffer *iter;
+	wl_list_for_each(iter, &r->stage.buffers, link) {
+		in_use += iter->head - iter->tail;
+	}
+	if (in_use > r->stage.stats.high_water_mark) {
+		r->stage.stats.high_water_mark = in_use;
+	}
+
 	return (struct wlr_vk_buffer_span) {
 		.buffer = buf,
-		.alloc = *a,
+		.alloc = (struct wlr_vk_allocation) {
+			.start = start,
+			.size = size,
+		},
 	};
 
 error:
-	shared_buffer_destroy(r, buf);
-
-error_alloc:
 	return (struct wlr_vk_buffer_span) {
 		.buffer = NULL,
 		.alloc = (struct wlr_vk_allocation) {0, 0},
 	};
 }
 
+void vulkan_stage_fence(struct wlr_vk_renderer *r, uint64_t timeline_point) {
+	struct wlr_vk_stage_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		if (buf->submitted == buf->head) {
+			continue;
+		}
+
+		// On failure the allocations stay pending and get tied to the next
+		// submission, which is later on the timeline
+		struct wlr_vk_stage_fence *fence = wl_array_add(&buf->fences, sizeof(*fence));
+		if (fence == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			continue;
+		}
+		*fence = (struct wlr_vk_stage_fence){
+			.end = buf->head,
+			.timeline_point = timeline_point,
+		};
+		buf->submitted = buf->head;
+	}
+}
+
 VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer) {
 	if (renderer->stage.cb == NULL) {
 		renderer->stage.cb = vulkan_acquire_command_buffer(renderer);
@@ -360,40 +529,71 @@ VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer) {
 	return renderer->stage.cb->vk;
 }
 
-bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
+// Submits the current stage command buffer. If binary_semaphore isn't
+// VK_NULL_HANDLE, it is signalled along with the timeline semaphore.
+static struct wlr_vk_command_buffer *submit_stage(
+		struct wlr_vk_renderer *renderer, VkSemaphore binary_semaphore) {
 	if (renderer->stage.cb == NULL) {
-		return false;
+		return NULL;
 	}
 
 	struct wlr_vk_command_buffer *cb = renderer->stage.cb;
 	renderer->stage.cb = NULL;
 
+	// Pending uploads are tied to the stage command buffer
+	VkSemaphoreSubmitInfoKHR transfer_wait;
+	if (!vulkan_submit_transfer_cb(renderer, &transfer_wait)) {
+		vulkan_reset_command_buffer(cb);
+		return NULL;
+	}
+
 	uint64_t timeline_point = vulkan_end_command_buffer(cb, renderer);
 	if (timeline_point == 0) {
-		return false;
+		return NULL;
 	}
 
+	VkSemaphore signal_semaphores[] = { renderer->timeline_semaphore, binary_semaphore };
+	uint64_t signal_values[] = { timeline_point, 0 };
+	uint32_t signal_len = binary_semaphore != VK_NULL_HANDLE ? 2 : 1;
 	VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {
 		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
-		.signalSemaphoreValueCount = 1,
-		.pSignalSemaphoreValues = &timeline_point,
+		.signalSemaphoreValueCount = signal_len,
+		.pSignalSemaphoreValues = signal_values,
 	};
 	VkSubmitInfo submit_info = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
 		.pNext = &timeline_submit_info,
 		.commandBufferCount = 1,
 		.pCommandBuffers = &cb->vk,
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = &renderer->timeline_semaphore,
+		.signalSemaphoreCount = signal_len,
+		.pSignalSemaphores = signal_semaphores,
 	};
+	VkPipelineStageFlags transfer_wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	if (transfer_wait.semaphore != VK_NULL_HANDLE) {
+		timeline_submit_info.waitSemaphoreValueCount = 1;
+		timeline_submit_info.pWaitSemaphoreValues = &transfer_wait.value;
+		submit_info.waitSemaphoreCount = 1;
+		submit_info.pWaitSemaphores = &transfer_wait.semaphore;
+		submit_info.pWaitDstStageMask = &transfer_wait_stage;
+	}
 	VkResult res = vkQueueSubmit(renderer->dev->queue, 1, &submit_info, VK_NULL_HANDLE);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkQueueSubmit", res);
-		return false;
+		return NULL;
 	}
 
-	// NOTE: don't release stage allocations here since they may still be
-	// used for reading. Will be done next frame.
+	// Stage allocations are reclaimed in vulkan_get_stage_span() at the
+	// earliest, so the caller can still read them back
+	vulkan_stage_fence(renderer, timeline_point);
+
+	return cb;
+}
+
+bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
+	struct wlr_vk_command_buffer *cb = submit_stage(renderer, VK_NULL_HANDLE);
+	if (cb == NULL) {
+		return false;
+	}
 
 	return vulkan_wait_command_buffer(cb, renderer);
 }
@@ -409,13 +609,13 @@ struct wlr_vk_format_props *vulkan_format_props_from_drm(
 }
 
 static bool init_command_buffer(struct wlr_vk_command_buffer *cb,
-		struct wlr_vk_renderer *renderer) {
+		struct wlr_vk_renderer *renderer, VkCommandPool command_pool) {
 	VkResult res;
 
 	VkCommandBuffer vk_cb = VK_NULL_HANDLE;
 	VkCommandBufferAllocateInfo cmd_buf_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = renderer->command_pool,
+		.commandPool = command_pool,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
 		.commandBufferCount = 1,
 	};
@@ -429,7 +629,6 @@ static bool init_command_buffer(struct wlr_vk_command_buffer *cb,
 		.vk = vk_cb,
 	};
 	wl_list_init(&cb->destroy_textures);
-	wl_list_init(&cb->stage_buffers);
 	return true;
 }
 
@@ -463,14 +662,6 @@ static void release_command_buffer_resources(struct wlr_vk_command_buffer *cb,
 		wlr_texture_destroy(&texture->wlr_texture);
 	}
 
-	struct wlr_vk_shared_buffer *buf, *buf_tmp;
-	wl_list_for_each_safe(buf, buf_tmp, &cb->stage_buffers, link) {
-		buf->allocs.size = 0;
-
-		wl_list_remove(&buf->link);
-		wl_list_insert(&renderer->stage.buffers, &buf->link);
-	}
-
 	if (cb->color_transform) {
 		wlr_color_transform_unref(cb->color_transform);
 		cb->color_transform = NULL;
@@ -521,7 +712,7 @@ static struct wlr_vk_command_buffer *get_command_buffer(
 
 	// If there is an unused slot, initialize it
 	if (unused != NULL) {
-		if (!init_command_buffer(unused, renderer)) {
+		if (!init_command_buffer(unused, renderer, renderer->command_pool)) {
 			return NULL;
 		}
 		return unused;
@@ -563,6 +754,151 @@ uint64_t vulkan_end_command_buffer(struct wlr_vk_command_buffer *cb,
 	return cb->timeline_point;
 }
 
+static struct wlr_vk_command_buffer *get_transfer_command_buffer(
+		struct wlr_vk_renderer *renderer) {
+	VkResult res;
+
+	uint64_t current_point;
+	res = renderer->dev->api.vkGetSemaphoreCounterValueKHR(renderer->dev->dev,
+		renderer->transfer.timeline_semaphore, &current_point);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetSemaphoreCounterValueKHR", res);
+		return NULL;
+	}
+
+	struct wlr_vk_command_buffer *wait = NULL;
+	for (size_t i = 0; i < VULKAN_TRANSFER_COMMAND_BUFFERS_CAP; i++) {
+		struct wlr_vk_command_buffer *cb = &renderer->transfer.command_buffers[i];
+		if (cb->vk == VK_NULL_HANDLE) {
+			if (!init_command_buffer(cb, renderer, renderer->transfer.command_pool)) {
+				return NULL;
+			}
+			return cb;
+		}
+		if (cb->recording) {
+			continue;
+		}
+
+		if (cb->timeline_point <= current_point) {
+			return cb;
+		}
+		if (wait == NULL || cb->timeline_point < wait->timeline_point) {
+			wait = cb;
+		}
+	}
+
+	// Block until a busy command buffer becomes available
+	VkSemaphoreWaitInfoKHR wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+		.semaphoreCount = 1,
+		.pSemaphores = &renderer->transfer.timeline_semaphore,
+		.pValues = &wait->timeline_point,
+	};
+	res = renderer->dev->api.vkWaitSemaphoresKHR(renderer->dev->dev, &wait_info, UINT64_MAX);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkWaitSemaphoresKHR", res);
+		return NULL;
+	}
+	return wait;
+}
+
+VkCommandBuffer vulkan_record_transfer_cb(struct wlr_vk_renderer *renderer) {
+	// The stage command buffer is still needed to track the lifetime of the
+	// resources used by the upload
+	VkCommandBuffer stage_cb = vulkan_record_stage_cb(renderer);
+	if (renderer->dev->transfer_queue == VK_NULL_HANDLE ||
+			stage_cb == VK_NULL_HANDLE) {
+		return stage_cb;
+	}
+
+	if (renderer->transfer.cb == NULL) {
+		struct wlr_vk_command_buffer *cb = get_transfer_command_buffer(renderer);
+		if (cb == NULL) {
+			return VK_NULL_HANDLE;
+		}
+
+		VkCommandBufferBeginInfo begin_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		};
+		vkBeginCommandBuffer(cb->vk, &begin_info);
+		cb->recording = true;
+		renderer->transfer.cb = cb;
+	}
+
+	return renderer->transfer.cb->vk;
+}
+
+bool vulkan_submit_transfer_cb(struct wlr_vk_renderer *renderer,
+		VkSemaphoreSubmitInfoKHR *wait) {
+	*wait = (VkSemaphoreSubmitInfoKHR){0};
+
+	struct wlr_vk_command_buffer *cb = renderer->transfer.cb;
+	if (cb == NULL) {
+		return true;
+	}
+	renderer->transfer.cb = NULL;
+
+	uint64_t wait_point = renderer->transfer.wait_point;
+	renderer->transfer.wait_point = 0;
+
+	cb->recording = false;
+	VkResult res = vkEndCommandBuffer(cb->vk);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkEndCommandBuffer", res);
+		vulkan_reset_command_buffer(cb);
+		return false;
+	}
+
+	uint64_t prev_timeline_point = cb->timeline_point;
+	renderer->transfer.timeline_point++;
+	cb->timeline_point = renderer->transfer.timeline_point;
+
+	VkCommandBufferSubmitInfoKHR cb_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO_KHR,
+		.commandBuffer = cb->vk,
+	};
+	// Wait for previous rendering still reading from the updated textures
+	VkSemaphoreSubmitInfoKHR render_wait = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.semaphore = renderer->timeline_semaphore,
+		.value = wait_point,
+		.stageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+	};
+	VkSemaphoreSubmitInfoKHR signal = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.semaphore = renderer->transfer.timeline_semaphore,
+		.value = cb->timeline_point,
+	};
+	VkSubmitInfo2KHR submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2_KHR,
+		.waitSemaphoreInfoCount = wait_point > 0 ? 1 : 0,
+		.pWaitSemaphoreInfos = &render_wait,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cb_info,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signal,
+	};
+	res = renderer->dev->api.vkQueueSubmit2KHR(renderer->dev->transfer_queue,
+		1, &submit_info, VK_NULL_HANDLE);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkQueueSubmit2KHR", res);
+		// Nothing will signal the point, don't leave it behind for
+		// get_transfer_command_buffer() to block on
+		renderer->transfer.timeline_point--;
+		cb->timeline_point = prev_timeline_point;
+		vulkan_reset_command_buffer(cb);
+		return false;
+	}
+
+	*wait = (VkSemaphoreSubmitInfoKHR){
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.semaphore = renderer->transfer.timeline_semaphore,
+		.value = cb->timeline_point,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+	};
+	return true;
+}
+
 void vulkan_reset_command_buffer(struct wlr_vk_command_buffer *cb) {
 	if (cb == NULL) {
 		return;
@@ -926,7 +1262,7 @@ bool vulkan_sync_foreign_texture(struct wlr_vk_texture *texture) {
 	VkResult res;
 
 	struct wlr_dmabuf_attributes dmabuf = {0};
-	if (!wlr_buffer_get_dmabuf(texture->buffer, &dmabuf)) {
+	if (!buffer_get_texture_dmabuf(texture->buffer, &dmabuf)) {
 		wlr_log(WLR_ERROR, "Failed to get texture DMA-BUF");
 		return false;
 	}
@@ -1051,6 +1387,24 @@ static const struct wlr_drm_format_set *vulkan_get_render_formats(
 	return &renderer->dev->dmabuf_render_formats;
 }
 
+struct wlr_vk_read_pixels_request {
+	struct wlr_texture_read_pixels_request base;
+	struct wlr_vk_renderer *renderer; // NULL if destroyed
+	struct wl_list link; // wlr_vk_renderer.read_pixels_requests
+	VkImage image;
+	VkDeviceMemory memory;
+	VkSemaphore semaphore; // signalled by the submission, may be VK_NULL_HANDLE
+	uint64_t timeline_point; // 0 if not submitted
+	uint32_t bytes_per_pixel;
+};
+
+static void read_pixels_request_release(struct wlr_vk_read_pixels_request *request) {
+	VkDevice dev = request->renderer->dev->dev;
+	vkDestroySemaphore(dev, request->semaphore, NULL);
+	vkFreeMemory(dev, request->memory, NULL);
+	vkDestroyImage(dev, request->image, NULL);
+}
+
 static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
 	struct wlr_vk_device *dev = renderer->dev;
@@ -1076,9 +1430,22 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	}
 
 	// stage.cb automatically freed with command pool
-	struct wlr_vk_shared_buffer *buf, *tmp_buf;
+	struct wlr_vk_stage_buffer *buf, *tmp_buf;
 	wl_list_for_each_safe(buf, tmp_buf, &renderer->stage.buffers, link) {
-		shared_buffer_destroy(renderer, buf);
+		// the device is idle, all allocations have completed
+		buf->tail = buf->head;
+		stage_buffer_destroy(renderer, buf);
+	}
+
+	// Read-back requests may outlive the renderer, their copies fail from
+	// now on
+	struct wlr_vk_read_pixels_request *request, *request_tmp;
+	wl_list_for_each_safe(request, request_tmp,
+			&renderer->read_pixels_requests, link) {
+		read_pixels_request_release(request);
+		request->renderer = NULL;
+		wl_list_remove(&request->link);
+		wl_list_init(&request->link);
 	}
 
 	struct wlr_vk_texture *tex, *tex_tmp;
@@ -1133,7 +1500,11 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	vkDestroyImage(dev->dev, renderer->dummy3d_image, NULL);
 	vkFreeMemory(dev->dev, renderer->dummy3d_mem, NULL);
 
+	vulkan_finish_pipeline_cache(renderer);
+
 	vkDestroySemaphore(dev->dev, renderer->timeline_semaphore, NULL);
+	vkDestroySemaphore(dev->dev, renderer->transfer.timeline_semaphore, NULL);
+	vkDestroyCommandPool(dev->dev, renderer->transfer.command_pool, NULL);
 	vkDestroyPipelineLayout(dev->dev, renderer->output_pipe_layout, NULL);
 	vkDestroyDescriptorSetLayout(dev->dev, renderer->output_ds_srgb_layout, NULL);
 	vkDestroyDescriptorSetLayout(dev->dev, renderer->output_ds_lut3d_layout, NULL);
@@ -1151,13 +1522,11 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	free(renderer);
 }
 
-bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
-		VkFormat src_format, VkImage src_image,
-		uint32_t drm_format, uint32_t stride,
-		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
-		uint32_t dst_x, uint32_t dst_y, void *data) {
-	VkDevice dev = vk_renderer->dev->dev;
-
+// Checks that pixels of src_format can be read back as drm_format, and
+// whether a blit is needed for the conversion
+static bool get_read_pixels_format(struct wlr_vk_renderer *vk_renderer,
+		VkFormat src_format, uint32_t drm_format, VkFormat *dst_format,
+		bool *blit_supported) {
 	const struct wlr_pixel_format_info *pixel_format_info = drm_get_pixel_format_info(drm_format);
 	if (!pixel_format_info) {
 		wlr_log(WLR_ERROR, "vulkan_read_pixels: could not find pixel format info "
@@ -1174,92 +1543,96 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 				"matching drm format 0x%08x available", drm_format);
 		return false;
 	}
-	VkFormat dst_format = wlr_vk_format->vk;
+	*dst_format = wlr_vk_format->vk;
 	VkFormatProperties dst_format_props = {0}, src_format_props = {0};
-	vkGetPhysicalDeviceFormatProperties(vk_renderer->dev->phdev, dst_format, &dst_format_props);
+	vkGetPhysicalDeviceFormatProperties(vk_renderer->dev->phdev, *dst_format, &dst_format_props);
 	vkGetPhysicalDeviceFormatProperties(vk_renderer->dev->phdev, src_format, &src_format_props);
 
-	bool blit_supported = src_format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT &&
+	*blit_supported = src_format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT &&
 		dst_format_props.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT;
-	if (!blit_supported && src_format != dst_format) {
+	if (!*blit_supported && src_format != *dst_format) {
 		wlr_log(WLR_ERROR, "vulkan_read_pixels: blit unsupported and no manual "
 					"conversion available from src to dst format.");
 		return false;
 	}
 
+	return true;
+}
+
+// Creates a host-visible linear image to read pixels into
+static bool create_read_pixels_image(struct wlr_vk_renderer *vk_renderer,
+		VkFormat format, uint32_t width, uint32_t height,
+		VkImage *image_ptr, VkDeviceMemory *memory_ptr) {
+	VkDevice dev = vk_renderer->dev->dev;
 	VkResult res;
+
 	VkImage dst_image;
-	VkDeviceMemory dst_img_memory;
-	bool use_cached = vk_renderer->read_pixels_cache.initialized &&
-		vk_renderer->read_pixels_cache.drm_format == drm_format &&
-		vk_renderer->read_pixels_cache.width == width &&
-		vk_renderer->read_pixels_cache.height == height;
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent.width = width,
+		.extent.height = height,
+		.extent.depth = 1,
+		.arrayLayers = 1,
+		.mipLevels = 1,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_LINEAR,
+		.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT
+	};
+	res = vkCreateImage(dev, &image_create_info, NULL, &dst_image);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateImage", res);
+		return false;
+	}
 
-	if (use_cached) {
-		dst_image = vk_renderer->read_pixels_cache.dst_image;
-		dst_img_memory = vk_renderer->read_pixels_cache.dst_img_memory;
-	} else {
-		VkImageCreateInfo image_create_info = {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-			.imageType = VK_IMAGE_TYPE_2D,
-			.format = dst_format,
-			.extent.width = width,
-			.extent.height = height,
-			.extent.depth = 1,
-			.arrayLayers = 1,
-			.mipLevels = 1,
-			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			.samples = VK_SAMPLE_COUNT_1_BIT,
-			.tiling = VK_IMAGE_TILING_LINEAR,
-			.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT
-		};
-		res = vkCreateImage(dev, &image_create_info, NULL, &dst_image);
-		if (res != VK_SUCCESS) {
-			wlr_vk_error("vkCreateImage", res);
-			return false;
-		}
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(dev, dst_image, &mem_reqs);
 
-		VkMemoryRequirements mem_reqs;
-		vkGetImageMemoryRequirements(dev, dst_image, &mem_reqs);
+	int mem_type = vulkan_find_mem_type(vk_renderer->dev,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+			mem_reqs.memoryTypeBits);
+	if (mem_type < 0) {
+		wlr_log(WLR_ERROR, "vulkan_read_pixels: could not find adequate memory type");
+		goto destroy_image;
+	}
 
-		int mem_type = vulkan_find_mem_type(vk_renderer->dev,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-				VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
-				mem_reqs.memoryTypeBits);
-		if (mem_type < 0) {
-			wlr_log(WLR_ERROR, "vulkan_read_pixels: could not find adequate memory type");
-			goto destroy_image;
-		}
+	VkMemoryAllocateInfo mem_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	};
+	mem_alloc_info.allocationSize = mem_reqs.size;
+	mem_alloc_info.memoryTypeIndex = mem_type;
 
-		VkMemoryAllocateInfo mem_alloc_info = {
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		};
-		mem_alloc_info.allocationSize = mem_reqs.size;
-		mem_alloc_info.memoryTypeIndex = mem_type;
+	VkDeviceMemory dst_img_memory;
+	res = vkAllocateMemory(dev, &mem_alloc_info, NULL, &dst_img_memory);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkAllocateMemory", res);
+		goto destroy_image;
+	}
+	res = vkBindImageMemory(dev, dst_image, dst_img_memory, 0);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkBindImageMemory", res);
+		goto free_memory;
+	}
 
-		res = vkAllocateMemory(dev, &mem_alloc_info, NULL, &dst_img_memory);
-		if (res != VK_SUCCESS) {
-			wlr_vk_error("vkAllocateMemory", res);
-			goto destroy_image;
-		}
-		res = vkBindImageMemory(dev, dst_image, dst_img_memory, 0);
-		if (res != VK_SUCCESS) {
-			wlr_vk_error("vkBindImageMemory", res);
-			goto free_memory;
-		}
+	*image_ptr = dst_image;
+	*memory_ptr = dst_img_memory;
+	return true;
 
-		if (vk_renderer->read_pixels_cache.initialized) {
-			vkFreeMemory(dev, vk_renderer->read_pixels_cache.dst_img_memory, NULL);
-			vkDestroyImage(dev, vk_renderer->read_pixels_cache.dst_image, NULL);
-		}
-		vk_renderer->read_pixels_cache.initialized = true;
-		vk_renderer->read_pixels_cache.drm_format = drm_format;
-		vk_renderer->read_pixels_cache.dst_image = dst_image;
-		vk_renderer->read_pixels_cache.dst_img_memory = dst_img_memory;
-		vk_renderer->read_pixels_cache.width = width;
-		vk_renderer->read_pixels_cache.height = height;
-	}
+free_memory:
+	vkFreeMemory(dev, dst_img_memory, NULL);
+destroy_image:
+	vkDestroyImage(dev, dst_image, NULL);
+	return false;
+}
 
+// Records the copy of a region of src_image into dst_image on the stage
+// command buffer
+static bool record_read_pixels(struct wlr_vk_renderer *vk_renderer,
+		VkImage src_image, VkImage dst_image, bool blit_supported,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y) {
 	VkCommandBuffer cb = vulkan_record_stage_cb(vk_renderer);
 	if (cb == VK_NULL_HANDLE) {
 		return false;
@@ -1326,13 +1699,14 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 				dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_region);
 	}
 
+	// The host reads the image once the submission has completed
 	vulkan_change_layout(cb, dst_image,
 			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_ACCESS_TRANSFER_WRITE_BIT,
 			VK_IMAGE_LAYOUT_GENERAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0);
+			VK_PIPELINE_STAGE_HOST_BIT,
+			VK_ACCESS_HOST_READ_BIT);
 	vulkan_change_layout(cb, src_image,
 			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -1341,9 +1715,16 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_ACCESS_MEMORY_READ_BIT);
 
-	if (!vulkan_submit_stage_wait(vk_renderer)) {
-		return false;
-	}
+	return true;
+}
+
+// Copies the contents of a read-back image to memory
+static bool copy_read_pixels_image(struct wlr_vk_renderer *vk_renderer,
+		VkImage dst_image, VkDeviceMemory dst_img_memory,
+		uint32_t bytes_per_pixel, uint32_t stride, uint32_t width,
+		uint32_t height, uint32_t dst_x, uint32_t dst_y, void *data) {
+	VkDevice dev = vk_renderer->dev->dev;
+	VkResult res;
 
 	VkImageSubresource img_sub_res = {
 		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -1375,7 +1756,6 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 
 	const char *d = (const char *)v + img_sub_layout.offset;
 	unsigned char *p = (unsigned char *)data + dst_y * stride;
-	uint32_t bytes_per_pixel = pixel_format_info->bytes_per_block;
 	uint32_t pack_stride = img_sub_layout.rowPitch;
 	if (pack_stride == stride && dst_x == 0) {
 		memcpy(p, d, height * stride);
@@ -1386,15 +1766,203 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 	}
 
 	vkUnmapMemory(dev, dst_img_memory);
-	// Don't need to free anything else, since memory and image are cached
 	return true;
+}
 
-free_memory:
-	vkFreeMemory(dev, dst_img_memory, NULL);
-destroy_image:
-	vkDestroyImage(dev, dst_image, NULL);
+bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
+		VkFormat src_format, VkImage src_image,
+		uint32_t drm_format, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, void *data) {
+	VkDevice dev = vk_renderer->dev->dev;
 
-	return false;
+	VkFormat dst_format;
+	bool blit_supported;
+	if (!get_read_pixels_format(vk_renderer, src_format, drm_format,
+			&dst_format, &blit_supported)) {
+		return false;
+	}
+
+	VkImage dst_image;
+	VkDeviceMemory dst_img_memory;
+	bool use_cached = vk_renderer->read_pixels_cache.initialized &&
+		vk_renderer->read_pixels_cache.drm_format == drm_format &&
+		vk_renderer->read_pixels_cache.width == width &&
+		vk_renderer->read_pixels_cache.height == height;
+
+	if (use_cached) {
+		dst_image = vk_renderer->read_pixels_cache.dst_image;
+		dst_img_memory = vk_renderer->read_pixels_cache.dst_img_memory;
+	} else {
+		if (!create_read_pixels_image(vk_renderer, dst_format, width, height,
+				&dst_image, &dst_img_memory)) {
+			return false;
+		}
+
+		if (vk_renderer->read_pixels_cache.initialized) {
+			vkFreeMemory(dev, vk_renderer->read_pixels_cache.dst_img_memory, NULL);
+			vkDestroyImage(dev, vk_renderer->read_pixels_cache.dst_image, NULL);
+		}
+		vk_renderer->read_pixels_cache.initialized = true;
+		vk_renderer->read_pixels_cache.drm_format = drm_format;
+		vk_renderer->read_pixels_cache.dst_image = dst_image;
+		vk_renderer->read_pixels_cache.dst_img_memory = dst_img_memory;
+		vk_renderer->read_pixels_cache.width = width;
+		vk_renderer->read_pixels_cache.height = height;
+	}
+
+	if (!record_read_pixels(vk_renderer, src_image, dst_image, blit_supported,
+			width, height, src_x, src_y)) {
+		return false;
+	}
+
+	if (!vulkan_submit_stage_wait(vk_renderer)) {
+		return false;
+	}
+
+	const struct wlr_pixel_format_info *pixel_format_info = drm_get_pixel_format_info(drm_format);
+	// Don't need to free anything, since memory and image are cached
+	return copy_read_pixels_image(vk_renderer, dst_image, dst_img_memory,
+		pixel_format_info->bytes_per_block, stride, width, height,
+		dst_x, dst_y, data);
+}
+
+static struct wlr_vk_read_pixels_request *get_read_pixels_request(
+		struct wlr_texture_read_pixels_request *wlr_request) {
+	struct wlr_vk_read_pixels_request *request =
+		wl_container_of(wlr_request, request, base);
+	return request;
+}
+
+static bool read_pixels_request_copy(
+		struct wlr_texture_read_pixels_request *wlr_request, void *data,
+		uint32_t stride) {
+	struct wlr_vk_read_pixels_request *request = get_read_pixels_request(wlr_request);
+	if (request->renderer == NULL) {
+		wlr_log(WLR_ERROR, "Renderer destroyed before read-back was copied");
+		return false;
+	}
+	return copy_read_pixels_image(request->renderer, request->image,
+		request->memory, request->bytes_per_pixel, stride,
+		wlr_request->width, wlr_request->height, 0, 0, data);
+}
+
+static void read_pixels_request_destroy(
+		struct wlr_texture_read_pixels_request *wlr_request) {
+	struct wlr_vk_read_pixels_request *request = get_read_pixels_request(wlr_request);
+	struct wlr_vk_renderer *renderer = request->renderer;
+
+	if (renderer != NULL) {
+		// The copy may still be running if the request is cancelled
+		if (request->timeline_point != 0 && !wlr_request->ready) {
+			wait_timeline_point(renderer, request->timeline_point);
+		}
+		read_pixels_request_release(request);
+	}
+
+	wl_list_remove(&request->link);
+	free(request);
+}
+
+static const struct wlr_texture_read_pixels_request_impl read_pixels_request_impl = {
+	.copy = read_pixels_request_copy,
+	.destroy = read_pixels_request_destroy,
+};
+
+struct wlr_texture_read_pixels_request *vulkan_read_pixels_async(
+		struct wlr_vk_texture *texture, struct wl_event_loop *loop,
+		uint32_t drm_format, uint32_t width, uint32_t height,
+		uint32_t src_x, uint32_t src_y) {
+	struct wlr_vk_renderer *renderer = texture->renderer;
+	VkDevice dev = renderer->dev->dev;
+
+	VkFormat dst_format;
+	bool blit_supported;
+	if (!get_read_pixels_format(renderer, texture->format->vk, drm_format,
+			&dst_format, &blit_supported)) {
+		return NULL;
+	}
+
+	struct wlr_vk_read_pixels_request *request = calloc(1, sizeof(*request));
+	if (request == NULL) {
+		return NULL;
+	}
+	request->renderer = renderer;
+	request->bytes_per_pixel = drm_get_pixel_format_info(drm_format)->bytes_per_block;
+	wl_list_init(&request->link);
+
+	// Each request has its own image, since several ones may be in flight
+	if (!create_read_pixels_image(renderer, dst_format, width, height,
+			&request->image, &request->memory)) {
+		free(request);
+		return NULL;
+	}
+
+	if (renderer->dev->implicit_sync_interop) {
+		VkExportSemaphoreCreateInfo export_info = {
+			.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
+			.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+		};
+		VkSemaphoreCreateInfo semaphore_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &export_info,
+		};
+		VkResult res = vkCreateSemaphore(dev, &semaphore_info, NULL,
+			&request->semaphore);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateSemaphore", res);
+			goto error;
+		}
+	}
+
+	if (!record_read_pixels(renderer, texture->image, request->image,
+			blit_supported, width, height, src_x, src_y)) {
+		goto error;
+	}
+
+	struct wlr_vk_command_buffer *cb = submit_stage(renderer, request->semaphore);
+	if (cb == NULL) {
+		goto error;
+	}
+	request->timeline_point = cb->timeline_point;
+	// The texture may be destroyed before the copy completes
+	texture->last_used_cb = cb;
+	texture->last_read_cb = cb;
+
+	int sync_file_fd = -1;
+	if (request->semaphore != VK_NULL_HANDLE) {
+		const VkSemaphoreGetFdInfoKHR get_fence_fd_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+			.semaphore = request->semaphore,
+			.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+		};
+		VkResult res = renderer->dev->api.vkGetSemaphoreFdKHR(dev,
+			&get_fence_fd_info, &sync_file_fd);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkGetSemaphoreFdKHR", res);
+			sync_file_fd = -1;
+		}
+	}
+	if (sync_file_fd < 0) {
+		// Without a sync file, the request is ready on the next event loop
+		// iteration
+		if (!vulkan_wait_command_buffer(cb, renderer)) {
+			goto error;
+		}
+	}
+
+	if (!wlr_texture_read_pixels_request_init(&request->base,
+			&read_pixels_request_impl, loop, drm_format, width, height,
+			sync_file_fd)) {
+		goto error;
+	}
+
+	wl_list_insert(&renderer->read_pixels_requests, &request->link);
+	return &request->base;
+
+error:
+	read_pixels_request_destroy(&request->base);
+	return NULL;
 }
 
 static int vulkan_get_drm_fd(struct wlr_renderer *wlr_renderer) {
@@ -1657,7 +2225,6 @@ struct wlr_vk_pipeline *setup_get_or_create_pipeline(
 	pipeline->layout = pipeline_layout;
 
 	VkResult res;
-	VkDevice dev = renderer->dev->dev;
 
 	uint32_t color_transform_type = key->texture_transform;
 
@@ -1779,8 +2346,7 @@ struct wlr_vk_pipeline *setup_get_or_create_pipeline(
 		.pVertexInputState = &vertex,
 	};
 
-	VkPipelineCache cache = VK_NULL_HANDLE;
-	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, &pipeline->vk);
+	res = vulkan_create_cached_pipeline(renderer, &pinfo, &pipeline->vk);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("failed to create vulkan pipelines:", res);
 		free(pipeline);
@@ -1795,7 +2361,6 @@ static bool init_blend_to_output_pipeline(struct wlr_vk_renderer *renderer,
 		VkRenderPass rp, VkPipelineLayout pipe_layout, VkPipeline *pipe,
 		enum wlr_vk_output_transform transform) {
 	VkResult res;
-	VkDevice dev = renderer->dev->dev;
 
 	uint32_t output_transform_type = transform;
 	VkSpecializationMapEntry spec_entry = {
@@ -1896,8 +2461,7 @@ static bool init_blend_to_output_pipeline(struct wlr_vk_renderer *renderer,
 		.pVertexInputState = &vertex,
 	};
 
-	VkPipelineCache cache = VK_NULL_HANDLE;
-	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, pipe);
+	res = vulkan_create_cached_pipeline(renderer, &pinfo, pipe);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("failed to create vulkan pipelines:", res);
 		return false;
@@ -1906,6 +2470,32 @@ static bool init_blend_to_output_pipeline(struct wlr_vk_renderer *renderer,
 	return true;
 }
 
+VkPipeline setup_get_or_create_output_pipeline(
+		struct wlr_vk_render_format_setup *setup,
+		enum wlr_vk_output_transform transform) {
+	// only well defined if render pass has a 2nd subpass
+	assert(setup->use_blending_buffer);
+
+	VkPipeline *pipe = NULL;
+	switch (transform) {
+	case WLR_VK_OUTPUT_TRANSFORM_INVERSE_SRGB:
+		pipe = &setup->output_pipe_srgb;
+		break;
+	case WLR_VK_OUTPUT_TRANSFORM_LUT3D:
+		pipe = &setup->output_pipe_lut3d;
+		break;
+	}
+
+	if (*pipe == VK_NULL_HANDLE) {
+		struct wlr_vk_renderer *renderer = setup->renderer;
+		if (!init_blend_to_output_pipeline(renderer, setup->render_pass,
+				renderer->output_pipe_layout, pipe, transform)) {
+			return VK_NULL_HANDLE;
+		}
+	}
+	return *pipe;
+}
+
 struct wlr_vk_pipeline_layout *get_or_create_pipeline_layout(
 		struct wlr_vk_renderer *renderer,
 		const struct wlr_vk_pipeline_layout_key *key) {
@@ -2286,18 +2876,6 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 			wlr_vk_error("Failed to create 2-step render pass", res);
 			goto error;
 		}
-
-		// this is only well defined if render pass has a 2nd subpass
-		if (!init_blend_to_output_pipeline(
-				renderer, setup->render_pass, renderer->output_pipe_layout,
-				&setup->output_pipe_lut3d, WLR_VK_OUTPUT_TRANSFORM_LUT3D)) {
-			goto error;
-		}
-		if (!init_blend_to_output_pipeline(
-			renderer, setup->render_pass, renderer->output_pipe_layout,
-			&setup->output_pipe_srgb, WLR_VK_OUTPUT_TRANSFORM_INVERSE_SRGB)) {
-			goto error;
-		}
 	} else {
 		assert(format->vk_srgb);
 		VkAttachmentDescription attachment = {
@@ -2368,45 +2946,8 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 		}
 	}
 
-	if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
-		.source = WLR_VK_SHADER_SOURCE_SINGLE_COLOR,
-		.layout = { .ycbcr_format = NULL },
-	})) {
-		goto error;
-	}
-
-	if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
-		.source = WLR_VK_SHADER_SOURCE_TEXTURE,
-		.texture_transform = WLR_VK_TEXTURE_TRANSFORM_IDENTITY,
-		.layout = {.ycbcr_format = NULL },
-	})) {
-		goto error;
-	}
-
-	if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
-		.source = WLR_VK_SHADER_SOURCE_TEXTURE,
-		.texture_transform = WLR_VK_TEXTURE_TRANSFORM_SRGB,
-		.layout = {.ycbcr_format = NULL },
-	})) {
-		goto error;
-	}
-
-	for (size_t i = 0; i < renderer->dev->format_prop_count; i++) {
-		const struct wlr_vk_format *format = &renderer->dev->format_props[i].format;
-		const struct wlr_vk_pipeline_layout_key layout = {
-			.ycbcr_format = format,
-		};
-
-		if (format->is_ycbcr) {
-			if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
-				.texture_transform = WLR_VK_TEXTURE_TRANSFORM_SRGB,
-				.layout = layout
-			})) {
-				goto error;
-			}
-		}
-	}
-
+	// Pipelines are created on first use, so that the first frame doesn't
+	// wait for variants it doesn't need
 	wl_list_insert(&renderer->render_format_setups, &setup->link);
 	return setup;
 
@@ -2427,6 +2968,7 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl, WLR_BUFFER_CAP_DMABUF);
 	renderer->wlr_renderer.features.output_color_transform = true;
 	wl_list_init(&renderer->stage.buffers);
+	renderer->stage.budget = default_stage_budget;
 	wl_list_init(&renderer->foreign_textures);
 	wl_list_init(&renderer->textures);
 	wl_list_init(&renderer->descriptor_pools);
@@ -2434,8 +2976,13 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 	wl_list_init(&renderer->render_format_setups);
 	wl_list_init(&renderer->render_buffers);
 	wl_list_init(&renderer->color_transforms);
+	wl_list_init(&renderer->read_pixels_requests);
 	wl_list_init(&renderer->pipeline_layouts);
 
+	if (!vulkan_init_pipeline_cache(renderer)) {
+		goto error;
+	}
+
 	if (!init_static_render_data(renderer)) {
 		goto error;
 	}
@@ -2468,6 +3015,23 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 		goto error;
 	}
 
+	if (dev->transfer_queue != VK_NULL_HANDLE) {
+		cpool_info.queueFamilyIndex = dev->transfer_queue_family;
+		res = vkCreateCommandPool(dev->dev, &cpool_info, NULL,
+			&renderer->transfer.command_pool);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateCommandPool", res);
+			goto error;
+		}
+
+		res = vkCreateSemaphore(dev->dev, &semaphore_info, NULL,
+			&renderer->transfer.timeline_semaphore);
+		if (res != VK_SUCCESS) {
+			wlr_vk_error("vkCreateSemaphore", res);
+			goto error;
+		}
+	}
+
 	return &renderer->wlr_renderer;
 
 error:
@@ -2532,3 +3096,16 @@ uint32_t wlr_vk_renderer_get_queue_family(struct wlr_renderer *renderer) {
 	struct wlr_vk_renderer *vk_renderer = vulkan_get_renderer(renderer);
 	return vk_renderer->dev->queue_family;
 }
+
+void wlr_vk_renderer_set_staging_budget(struct wlr_renderer *renderer,
+		uint64_t budget) {
+	struct wlr_vk_renderer *vk_renderer = vulkan_get_renderer(renderer);
+	// Existing buffers are kept, the budget applies when growing
+	vk_renderer->stage.budget = budget;
+}
+
+void wlr_vk_renderer_get_staging_stats(struct wlr_renderer *renderer,
+		struct wlr_vk_staging_stats *stats) {
+	struct wlr_vk_renderer *vk_renderer = vulkan_get_renderer(renderer);
+	*stats = vk_renderer->stage.stats;
+}
@@ -12,6 +12,7 @@
 #include <xf86drm.h>
 #include "render/pixel_format.h"
 #include "render/vulkan.h"
+#include "types/wlr_buffer.h"
 
 static const struct wlr_texture_impl texture_impl;
 
@@ -126,14 +127,42 @@ static bool write_pixels(struct wlr_vk_texture *texture,
 		buf_off += height * packed_stride;
 	}
 
-	// record staging cb
+	// record transfer cb
 	// will be executed before next frame
-	VkCommandBuffer cb = vulkan_record_stage_cb(renderer);
+	VkCommandBuffer cb = vulkan_record_transfer_cb(renderer);
 	if (cb == VK_NULL_HANDLE) {
 		free(copies);
 		return false;
 	}
 
+	VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT;
+	VkAccessFlags dst_access = VK_ACCESS_SHADER_READ_BIT;
+	if (renderer->dev->transfer_queue != VK_NULL_HANDLE) {
+		// Graphics stages can't be used on the transfer queue. Previous
+		// reads by the graphics queue are waited for with the render
+		// timeline, subsequent ones by the graphics submission. Earlier
+		// uploads are ordered by the transfer queue itself, so only wait
+		// for a read which hasn't completed yet.
+		struct wlr_vk_command_buffer *last_cb = texture->last_read_cb;
+		if (last_cb != NULL && !last_cb->recording &&
+				last_cb->timeline_point > renderer->transfer.wait_point) {
+			uint64_t current_point;
+			VkResult res = renderer->dev->api.vkGetSemaphoreCounterValueKHR(
+				renderer->dev->dev, renderer->timeline_semaphore, &current_point);
+			if (res != VK_SUCCESS) {
+				wlr_vk_error("vkGetSemaphoreCounterValueKHR", res);
+				current_point = 0;
+			}
+			if (last_cb->timeline_point > current_point) {
+				renderer->transfer.wait_point = last_cb->timeline_point;
+			}
+		}
+		src_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		src_access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dst_access = 0;
+	}
+
 	vulkan_change_layout(cb, texture->image,
 		old_layout, src_stage, src_access,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -144,8 +173,7 @@ static bool write_pixels(struct wlr_vk_texture *texture,
 	vulkan_change_layout(cb, texture->image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VK_ACCESS_TRANSFER_WRITE_BIT,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT);
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, dst_stage, dst_access);
 	texture->last_used_cb = renderer->stage.cb;
 
 	free(copies);
@@ -157,6 +185,11 @@ static bool vulkan_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 
+	// Imported textures alias the buffer's memory, they can't be written
+	if (texture->buffer != NULL) {
+		return false;
+	}
+
 	void *data;
 	uint32_t format;
 	size_t stride;
@@ -247,6 +280,18 @@ static bool vulkan_texture_read_pixels(struct wlr_texture *wlr_texture,
 		options->format, options->stride, src.width, src.height, src.x, src.y, 0, 0, p);
 }
 
+static struct wlr_texture_read_pixels_request *vulkan_texture_read_pixels_async(
+		struct wlr_texture *wlr_texture, struct wl_event_loop *loop,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
+
+	struct wlr_box src;
+	wlr_texture_read_pixels_async_options_get_src_box(options, wlr_texture, &src);
+
+	return vulkan_read_pixels_async(texture, loop, options->format,
+		src.width, src.height, src.x, src.y);
+}
+
 static uint32_t vulkan_texture_preferred_read_format(struct wlr_texture *wlr_texture) {
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	return texture->format->drm;
@@ -257,6 +302,7 @@ static const struct wlr_texture_impl texture_impl = {
 	.read_pixels = vulkan_texture_read_pixels,
 	.preferred_read_format = vulkan_texture_preferred_read_format,
 	.destroy = vulkan_texture_unref,
+	.read_pixels_async = vulkan_texture_read_pixels_async,
 };
 
 static struct wlr_vk_texture *vulkan_texture_create(
@@ -429,6 +475,17 @@ static struct wlr_texture *vulkan_texture_from_pixels(
 	if (fmt->shm.has_mutable_srgb) {
 		img_info.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
 	}
+	// Written by the transfer queue and sampled by the graphics queue,
+	// without queue family ownership transfers
+	uint32_t queue_families[] = {
+		renderer->dev->queue_family,
+		renderer->dev->transfer_queue_family,
+	};
+	if (renderer->dev->transfer_queue != VK_NULL_HANDLE) {
+		img_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		img_info.queueFamilyIndexCount = 2;
+		img_info.pQueueFamilyIndices = queue_families;
+	}
 
 	res = vkCreateImage(dev, &img_info, NULL, &texture->image);
 	if (res != VK_SUCCESS) {
@@ -816,17 +873,21 @@ struct wlr_texture *vulkan_texture_from_buffer(struct wlr_renderer *wlr_renderer
 	uint32_t format;
 	size_t stride;
 	struct wlr_dmabuf_attributes dmabuf;
-	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
-		return vulkan_texture_from_dmabuf_buffer(renderer, buffer, &dmabuf);
-	} else if (wlr_buffer_begin_data_ptr_access(buffer,
+	if (buffer_get_texture_dmabuf(buffer, &dmabuf)) {
+		struct wlr_texture *tex = vulkan_texture_from_dmabuf_buffer(renderer, buffer, &dmabuf);
+		if (tex != NULL) {
+			return tex;
+		}
+		// Buffers which also expose their pixels can still be copied
+	}
+	if (wlr_buffer_begin_data_ptr_access(buffer,
 			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
 		struct wlr_texture *tex = vulkan_texture_from_pixels(renderer,
 			format, stride, buffer->width, buffer->height, data);
 		wlr_buffer_end_data_ptr_access(buffer);
 		return tex;
-	} else {
-		return NULL;
 	}
+	return NULL;
 }
 
 void wlr_vk_texture_get_image_attribs(struct wlr_texture *texture,
@@ -477,6 +477,7 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		}
 	}
 
+	bool has_transfer_queue = false;
 	{
 		uint32_t qfam_count;
 		vkGetPhysicalDeviceQueueFamilyProperties(phdev, &qfam_count, NULL);
@@ -494,6 +495,24 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 			}
 		}
 		assert(graphics_found);
+
+		// Look for a transfer-only queue family, usually backed by a DMA
+		// engine which can run uploads concurrently with rendering. Copies
+		// of damaged regions need a granularity of a single texel.
+		for (unsigned i = 0u; i < qfam_count; ++i) {
+			VkQueueFlags flags = queue_props[i].queueFlags;
+			VkExtent3D granularity = queue_props[i].minImageTransferGranularity;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+					!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+					granularity.width == 1 && granularity.height == 1 &&
+					granularity.depth == 1) {
+				dev->transfer_queue_family = i;
+				has_transfer_queue = true;
+				break;
+			}
+		}
+		wlr_log(WLR_DEBUG, "Dedicated transfer queue %s",
+			has_transfer_queue ? "found" : "not found");
 	}
 
 	bool exportable_semaphore = false, importable_semaphore = false;
@@ -550,12 +569,28 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		dev->sampler_ycbcr_conversion ? "supported" : "not supported");
 
 	const float prio = 1.f;
-	VkDeviceQueueCreateInfo qinfo = {
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = dev->queue_family,
-		.queueCount = 1,
-		.pQueuePriorities = &prio,
+	VkDeviceQueueCreateInfo qinfos[2] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = dev->queue_family,
+			.queueCount = 1,
+			.pQueuePriorities = &prio,
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = dev->transfer_queue_family,
+			.queueCount = 1,
+			.pQueuePriorities = &prio,
+		},
 	};
+	VkDeviceQueueCreateInfo *qinfo = &qinfos[0];
+
+	// Used to only save the pipeline cache when it actually grew
+	dev->pipeline_creation_feedback = check_extension(avail_ext_props,
+		avail_extc, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	if (dev->pipeline_creation_feedback) {
+		extensions[extensions_len++] = VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME;
+	}
 
 	VkDeviceQueueGlobalPriorityCreateInfoKHR global_priority;
 	bool has_global_priority = check_extension(avail_ext_props, avail_extc,
@@ -566,7 +601,7 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_GLOBAL_PRIORITY_CREATE_INFO_KHR,
 			.globalPriority = VK_QUEUE_GLOBAL_PRIORITY_HIGH_KHR,
 		};
-		qinfo.pNext = &global_priority;
+		qinfo->pNext = &global_priority;
 		extensions[extensions_len++] = VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME;
 		wlr_log(WLR_DEBUG, "Requesting a high-priority device queue");
 	} else {
@@ -591,8 +626,8 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 	VkDeviceCreateInfo dev_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 		.pNext = &timeline_features,
-		.queueCreateInfoCount = 1u,
-		.pQueueCreateInfos = &qinfo,
+		.queueCreateInfoCount = has_transfer_queue ? 2u : 1u,
+		.pQueueCreateInfos = qinfos,
 		.enabledExtensionCount = extensions_len,
 		.ppEnabledExtensionNames = extensions,
 	};
@@ -606,7 +641,7 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 		// Try to recover from the driver denying a global priority queue
 		wlr_log(WLR_DEBUG, "Failed to obtain a high-priority device queue, "
 			"falling back to regular queue priority");
-		qinfo.pNext = NULL;
+		qinfo->pNext = NULL;
 		res = vkCreateDevice(phdev, &dev_info, NULL, &dev->dev);
 	}
 
@@ -616,6 +651,10 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 	}
 
 	vkGetDeviceQueue(dev->dev, dev->queue_family, 0, &dev->queue);
+	if (has_transfer_queue) {
+		vkGetDeviceQueue(dev->dev, dev->transfer_queue_family, 0,
+			&dev->transfer_queue);
+	}
 
 	load_device_proc(dev, "vkGetMemoryFdPropertiesKHR",
 		&dev->api.vkGetMemoryFdPropertiesKHR);
@@ -297,6 +297,10 @@ int wlr_renderer_get_drm_fd(struct wlr_renderer *r) {
 	return r->impl->get_drm_fd(r);
 }
 
+void wlr_renderer_set_texture_budget(struct wlr_renderer *r, size_t budget) {
+	r->texture_budget = budget;
+}
+
 struct wlr_render_pass *wlr_renderer_begin_buffer_pass(struct wlr_renderer *renderer,
 		struct wlr_buffer *buffer, const struct wlr_buffer_pass_options *options) {
 	struct wlr_buffer_pass_options default_options = {0};
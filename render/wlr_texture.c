@@ -3,8 +3,10 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/wlr_texture.h>
+#include <wlr/util/log.h>
 #include "render/pixel_format.h"
 #include "types/wlr_buffer.h"
 
@@ -62,6 +64,221 @@ bool wlr_texture_read_pixels(struct wlr_texture *texture,
 	return texture->impl->read_pixels(texture, options);
 }
 
+void wlr_texture_read_pixels_async_options_get_src_box(
+		const struct wlr_texture_read_pixels_async_options *options,
+		const struct wlr_texture *texture, struct wlr_box *box) {
+	if (wlr_box_empty(&options->src_box)) {
+		*box = (struct wlr_box){
+			.x = 0,
+			.y = 0,
+			.width = texture->width,
+			.height = texture->height,
+		};
+		return;
+	}
+
+	*box = options->src_box;
+}
+
+static void read_pixels_request_finish(
+		struct wlr_texture_read_pixels_request *request) {
+	if (request->event_source != NULL) {
+		wl_event_source_remove(request->event_source);
+	}
+	if (request->sync_file_fd >= 0) {
+		close(request->sync_file_fd);
+	}
+	request->impl->destroy(request);
+}
+
+static void read_pixels_request_set_ready(
+		struct wlr_texture_read_pixels_request *request) {
+	request->ready = true;
+
+	// Listeners may destroy the request, which is deferred until the signal
+	// emission is over
+	request->emitting_ready = true;
+	wl_signal_emit_mutable(&request->events.ready, NULL);
+	request->emitting_ready = false;
+
+	if (request->destroy_pending) {
+		read_pixels_request_finish(request);
+	}
+}
+
+static int read_pixels_request_handle_sync_file(int fd, uint32_t mask,
+		void *data) {
+	struct wlr_texture_read_pixels_request *request = data;
+
+	wl_event_source_remove(request->event_source);
+	request->event_source = NULL;
+	close(request->sync_file_fd);
+	request->sync_file_fd = -1;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_log(WLR_ERROR, "Failed to wait for read-back sync file");
+	}
+	read_pixels_request_set_ready(request);
+	return 0;
+}
+
+static void read_pixels_request_handle_idle(void *data) {
+	struct wlr_texture_read_pixels_request *request = data;
+	request->event_source = NULL;
+	read_pixels_request_set_ready(request);
+}
+
+bool wlr_texture_read_pixels_request_init(
+		struct wlr_texture_read_pixels_request *request,
+		const struct wlr_texture_read_pixels_request_impl *impl,
+		struct wl_event_loop *loop, uint32_t format, uint32_t width,
+		uint32_t height, int sync_file_fd) {
+	assert(impl->copy && impl->destroy);
+
+	*request = (struct wlr_texture_read_pixels_request){
+		.impl = impl,
+		.format = format,
+		.width = width,
+		.height = height,
+		.sync_file_fd = sync_file_fd,
+	};
+	wl_signal_init(&request->events.ready);
+
+	// A sync file becomes readable once it's signalled
+	if (sync_file_fd >= 0) {
+		request->event_source = wl_event_loop_add_fd(loop, sync_file_fd,
+			WL_EVENT_READABLE, read_pixels_request_handle_sync_file, request);
+	} else {
+		request->event_source = wl_event_loop_add_idle(loop,
+			read_pixels_request_handle_idle, request);
+	}
+	if (request->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add read-back event source");
+		if (sync_file_fd >= 0) {
+			close(sync_file_fd);
+			request->sync_file_fd = -1;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+struct cpu_read_pixels_request {
+	struct wlr_texture_read_pixels_request base;
+	void *data;
+	uint32_t stride;
+};
+
+static bool cpu_read_pixels_request_copy(
+		struct wlr_texture_read_pixels_request *wlr_request, void *data,
+		uint32_t stride) {
+	struct cpu_read_pixels_request *request =
+		wl_container_of(wlr_request, request, base);
+	const char *src = request->data;
+	char *dst = data;
+	for (uint32_t y = 0; y < wlr_request->height; y++) {
+		memcpy(dst + y * stride, src + y * request->stride, request->stride);
+	}
+	return true;
+}
+
+static void cpu_read_pixels_request_destroy(
+		struct wlr_texture_read_pixels_request *wlr_request) {
+	struct cpu_read_pixels_request *request =
+		wl_container_of(wlr_request, request, base);
+	free(request->data);
+	free(request);
+}
+
+static const struct wlr_texture_read_pixels_request_impl cpu_read_pixels_request_impl = {
+	.copy = cpu_read_pixels_request_copy,
+	.destroy = cpu_read_pixels_request_destroy,
+};
+
+// Fallback for renderers without asynchronous read-back, or when it fails:
+// read the pixels right away into system memory, the request is ready on the
+// next event loop iteration
+static struct wlr_texture_read_pixels_request *cpu_read_pixels_async(
+		struct wlr_texture *texture, struct wl_event_loop *loop,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	const struct wlr_pixel_format_info *fmt =
+		drm_get_pixel_format_info(options->format);
+	if (fmt == NULL) {
+		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format");
+		return NULL;
+	}
+
+	struct wlr_box src;
+	wlr_texture_read_pixels_async_options_get_src_box(options, texture, &src);
+
+	struct cpu_read_pixels_request *request = calloc(1, sizeof(*request));
+	if (request == NULL) {
+		return NULL;
+	}
+
+	request->stride = pixel_format_info_min_stride(fmt, src.width);
+	request->data = malloc((size_t)request->stride * src.height);
+	if (request->data == NULL) {
+		free(request);
+		return NULL;
+	}
+
+	if (!wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options){
+			.data = request->data,
+			.format = options->format,
+			.stride = request->stride,
+			.src_box = src,
+		})) {
+		goto error;
+	}
+
+	if (!wlr_texture_read_pixels_request_init(&request->base,
+			&cpu_read_pixels_request_impl, loop, options->format,
+			src.width, src.height, -1)) {
+		goto error;
+	}
+
+	return &request->base;
+
+error:
+	free(request->data);
+	free(request);
+	return NULL;
+}
+
+struct wlr_texture_read_pixels_request *wlr_texture_read_pixels_async(
+		struct wlr_texture *texture, struct wl_event_loop *loop,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	if (texture->impl->read_pixels_async) {
+		struct wlr_texture_read_pixels_request *request =
+			texture->impl->read_pixels_async(texture, loop, options);
+		if (request != NULL) {
+			return request;
+		}
+	}
+	return cpu_read_pixels_async(texture, loop, options);
+}
+
+bool wlr_texture_read_pixels_request_copy(
+		struct wlr_texture_read_pixels_request *request, void *data,
+		uint32_t stride) {
+	assert(request->ready);
+	return request->impl->copy(request, data, stride);
+}
+
+void wlr_texture_read_pixels_request_destroy(
+		struct wlr_texture_read_pixels_request *request) {
+	if (request == NULL) {
+		return;
+	}
+	if (request->emitting_ready) {
+		request->destroy_pending = true;
+		return;
+	}
+	read_pixels_request_finish(request);
+}
+
 uint32_t wlr_texture_preferred_read_format(struct wlr_texture *texture) {
 	if (!texture->impl->preferred_read_format) {
 		return DRM_FORMAT_INVALID;
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+
+#include "common.h"
+
+struct test_buffer {
+	struct wlr_buffer base;
+	uint32_t format;
+	size_t stride;
+	void *data;
+};
+
+static void test_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool test_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = buffer->format;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void test_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl test_buffer_impl = {
+	.destroy = test_buffer_destroy,
+	.begin_data_ptr_access = test_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = test_buffer_end_data_ptr_access,
+};
+
+struct wlr_buffer *test_buffer_create(int width, int height, uint32_t format,
+		uint32_t pixel) {
+	struct test_buffer *buffer = calloc(1, sizeof(*buffer));
+	assert(buffer != NULL);
+	wlr_buffer_init(&buffer->base, &test_buffer_impl, width, height);
+	buffer->format = format;
+	buffer->stride = (size_t)width * sizeof(uint32_t);
+
+	uint32_t *data = malloc(buffer->stride * height);
+	assert(data != NULL);
+	for (size_t i = 0; i < (size_t)width * height; i++) {
+		data[i] = pixel;
+	}
+	buffer->data = data;
+
+	return &buffer->base;
+}
+
+static struct wlr_buffer *test_allocator_create_buffer(
+		struct wlr_allocator *alloc, int width, int height,
+		const struct wlr_drm_format *format) {
+	return test_buffer_create(width, height, format->format, 0);
+}
+
+static void test_allocator_destroy(struct wlr_allocator *alloc) {
+	free(alloc);
+}
+
+static const struct wlr_allocator_interface test_allocator_impl = {
+	.create_buffer = test_allocator_create_buffer,
+	.destroy = test_allocator_destroy,
+};
+
+struct wlr_allocator *test_allocator_create(void) {
+	struct wlr_allocator *alloc = calloc(1, sizeof(*alloc));
+	assert(alloc != NULL);
+	wlr_allocator_init(alloc, &test_allocator_impl, WLR_BUFFER_CAP_DATA_PTR);
+	return alloc;
+}
+
+void test_output_init(struct test_output *test, int width, int height) {
+	*test = (struct test_output){0};
+
+	test->loop = wl_event_loop_create();
+	assert(test->loop != NULL);
+	test->backend = wlr_headless_backend_create(test->loop);
+	assert(test->backend != NULL);
+	test->renderer = wlr_pixman_renderer_create();
+	assert(test->renderer != NULL);
+	test->allocator = wlr_allocator_autocreate(test->backend, test->renderer);
+	assert(test->allocator != NULL);
+
+	test->output = wlr_headless_add_output(test->backend, width, height);
+	assert(test->output != NULL);
+	assert(wlr_output_init_render(test->output, test->allocator, test->renderer));
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	assert(wlr_output_commit_state(test->output, &state));
+	wlr_output_state_finish(&state);
+}
+
+void test_output_finish(struct test_output *test) {
+	wlr_backend_destroy(test->backend);
+	wlr_allocator_destroy(test->allocator);
+	wlr_renderer_destroy(test->renderer);
+	wl_event_loop_destroy(test->loop);
+}
@@ -0,0 +1,39 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct wlr_allocator;
+struct wlr_backend;
+struct wlr_buffer;
+struct wlr_output;
+struct wlr_renderer;
+
+/**
+ * Create a buffer in system memory filled with a single pixel value. Only
+ * 32-bit formats are supported.
+ */
+struct wlr_buffer *test_buffer_create(int width, int height, uint32_t format,
+	uint32_t pixel);
+
+/**
+ * Create an allocator of zero-filled system memory buffers.
+ */
+struct wlr_allocator *test_allocator_create(void);
+
+/**
+ * An enabled headless output, rendered with the pixman renderer.
+ */
+struct test_output {
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_output *output;
+};
+
+void test_output_init(struct test_output *test, int width, int height);
+void test_output_finish(struct test_output *test);
+
+#endif
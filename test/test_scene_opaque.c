@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "common.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+#define RECT_SIZE 8
+
+static bool region_covers(const pixman_region32_t *region,
+		int width, int height) {
+	pixman_box32_t box = { .x2 = width, .y2 = height };
+	return pixman_region32_contains_rectangle(region, &box) == PIXMAN_REGION_IN;
+}
+
+static void build_frame(struct wlr_scene_output *scene_output) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	assert(wlr_scene_output_build_state(scene_output, &state, NULL));
+	assert(wlr_output_commit_state(scene_output->output, &state));
+	wlr_output_state_finish(&state);
+}
+
+int main(void) {
+	struct test_output test;
+	test_output_init(&test, WIDTH, HEIGHT);
+
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+	struct wlr_scene_output *scene_output =
+		wlr_scene_output_create(scene, test.output);
+	assert(scene_output != NULL);
+
+	// A second entry keeps the render list from being scanned out directly
+	struct wlr_scene_rect *rect = wlr_scene_rect_create(&scene->tree,
+		RECT_SIZE, RECT_SIZE, (float[4]){ 0.5, 0.5, 0.5, 1 });
+	assert(rect != NULL);
+
+	struct wlr_buffer *translucent =
+		test_buffer_create(WIDTH, HEIGHT, DRM_FORMAT_ARGB8888, 0x00000000);
+	struct wlr_buffer *opaque =
+		test_buffer_create(WIDTH, HEIGHT, DRM_FORMAT_XRGB8888, 0xFF000000);
+	struct wlr_scene_buffer *scene_buffer =
+		wlr_scene_buffer_create(&scene->tree, translucent);
+	assert(scene_buffer != NULL);
+
+	// Only the rect is opaque
+	struct wlr_scene_output *outputs[] = { scene_output };
+	wlr_scene_outputs_prepare(outputs, 1);
+	assert(scene_output->render_list_prepared);
+	build_frame(scene_output);
+	assert(!scene_output->render_list_prepared);
+	assert(region_covers(&scene_output->render_list_opaque, RECT_SIZE, RECT_SIZE));
+	assert(!region_covers(&scene_output->render_list_opaque, WIDTH, HEIGHT));
+
+	// Nothing changed since the prepare step, its result is used as is
+	wlr_scene_outputs_prepare(outputs, 1);
+	build_frame(scene_output);
+	assert(!region_covers(&scene_output->render_list_opaque, WIDTH, HEIGHT));
+
+	// A same-size buffer changing the opacity must not reuse the opaque
+	// region computed by the prepare step
+	wlr_scene_outputs_prepare(outputs, 1);
+	wlr_scene_buffer_set_buffer(scene_buffer, opaque);
+	build_frame(scene_output);
+	assert(region_covers(&scene_output->render_list_opaque, WIDTH, HEIGHT));
+
+	wlr_scene_outputs_prepare(outputs, 1);
+	wlr_scene_buffer_set_buffer(scene_buffer, translucent);
+	build_frame(scene_output);
+	assert(!region_covers(&scene_output->render_list_opaque, WIDTH, HEIGHT));
+
+	// So must an opaque region change
+	wlr_scene_outputs_prepare(outputs, 1);
+	pixman_region32_t opaque_region;
+	pixman_region32_init_rect(&opaque_region, 0, 0, WIDTH, HEIGHT);
+	wlr_scene_buffer_set_opaque_region(scene_buffer, &opaque_region);
+	pixman_region32_fini(&opaque_region);
+	build_frame(scene_output);
+	assert(region_covers(&scene_output->render_list_opaque, WIDTH, HEIGHT));
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	wlr_buffer_drop(translucent);
+	wlr_buffer_drop(opaque);
+	test_output_finish(&test);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "common.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+#define LAYER_SIZE 16
+
+/**
+ * Build a frame and check that the damage committed along with it covers the
+ * whole output if expected to.
+ */
+static void build_frame(struct wlr_scene_output *scene_output,
+		bool expect_whole_damage) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	assert(wlr_scene_output_build_state(scene_output, &state, NULL));
+
+	assert(state.committed & WLR_OUTPUT_STATE_BUFFER);
+	assert(state.committed & WLR_OUTPUT_STATE_DAMAGE);
+	pixman_box32_t output_box = { .x2 = WIDTH, .y2 = HEIGHT };
+	bool whole = pixman_region32_contains_rectangle(&state.damage,
+		&output_box) == PIXMAN_REGION_IN;
+	assert(whole == expect_whole_damage);
+
+	assert(wlr_output_commit_state(scene_output->output, &state));
+	wlr_output_state_finish(&state);
+}
+
+int main(void) {
+	// Read when the scene is created
+	setenv("WLR_SCENE_ENABLE_OUTPUT_LAYERS", "1", true);
+
+	struct test_output test;
+	test_output_init(&test, WIDTH, HEIGHT);
+
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+	assert(scene->output_layers);
+	struct wlr_scene_output *scene_output =
+		wlr_scene_output_create(scene, test.output);
+	assert(scene_output != NULL);
+
+	// Black rects are left out of the render list, use another color
+	struct wlr_scene_rect *background = wlr_scene_rect_create(&scene->tree,
+		WIDTH, HEIGHT, (float[4]){ 0.5, 0.5, 0.5, 1 });
+	assert(background != NULL);
+
+	struct wlr_buffer *buffer = test_buffer_create(LAYER_SIZE, LAYER_SIZE,
+		DRM_FORMAT_XRGB8888, 0xFFFF0000);
+	struct wlr_scene_buffer *scene_buffer =
+		wlr_scene_buffer_create(&scene->tree, buffer);
+	assert(scene_buffer != NULL);
+	wlr_scene_node_set_position(&scene_buffer->node, 8, 8);
+
+	// The topmost buffer goes to a layer, the first frame is fully damaged
+	build_frame(scene_output, true);
+	assert(scene_output->layers_offloaded == 1);
+
+	// Damage unrelated to the layers is committed as is
+	wlr_scene_rect_set_size(background, WIDTH, HEIGHT / 2);
+	build_frame(scene_output, false);
+	assert(scene_output->layers_offloaded == 1);
+
+	// A moved layer leaves stale contents in the composited buffer, the
+	// commit must carry the resulting damage and not only the scene's
+	wlr_scene_node_set_position(&scene_buffer->node, 24, 24);
+	build_frame(scene_output, true);
+	assert(scene_output->layers_offloaded == 1);
+
+	// So must a change in the number of offloaded layers
+	wlr_scene_node_set_enabled(&scene_buffer->node, false);
+	build_frame(scene_output, true);
+	assert(scene_output->layers_offloaded == 0);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	wlr_buffer_drop(buffer);
+	test_output_finish(&test);
+	return EXIT_SUCCESS;
+}
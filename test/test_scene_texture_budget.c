@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "common.h"
+
+#define TILE_SIZE 32
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE * 4)
+
+static void build_frame(struct wlr_scene_output *scene_output) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	assert(wlr_scene_output_build_state(scene_output, &state, NULL));
+	assert(wlr_output_commit_state(scene_output->output, &state));
+	wlr_output_state_finish(&state);
+}
+
+static struct wlr_scene_buffer *create_tile(struct wlr_scene *scene,
+		int x, int y, struct wlr_buffer **buffer_ptr) {
+	// Keep the buffer locked like a client would until it is released,
+	// so that the scene can re-upload it after an eviction
+	struct wlr_buffer *buffer = test_buffer_create(TILE_SIZE, TILE_SIZE,
+		DRM_FORMAT_XRGB8888, 0xFF808080);
+	wlr_buffer_lock(buffer);
+	*buffer_ptr = buffer;
+
+	struct wlr_scene_buffer *scene_buffer =
+		wlr_scene_buffer_create(&scene->tree, buffer);
+	assert(scene_buffer != NULL);
+	wlr_scene_node_set_position(&scene_buffer->node, x, y);
+	return scene_buffer;
+}
+
+int main(void) {
+	struct test_output test;
+	test_output_init(&test, 2 * TILE_SIZE, 2 * TILE_SIZE);
+	wlr_renderer_set_texture_budget(test.renderer, 2 * TILE_BYTES);
+
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+	struct wlr_scene_output *scene_output =
+		wlr_scene_output_create(scene, test.output);
+	assert(scene_output != NULL);
+
+	// Rendered bottom to top, so a is the least recently used
+	struct wlr_buffer *buffers[3];
+	struct wlr_scene_buffer *a = create_tile(scene, 0, 0, &buffers[0]);
+	struct wlr_scene_buffer *b = create_tile(scene, TILE_SIZE, 0, &buffers[1]);
+	struct wlr_scene_buffer *c = create_tile(scene, 0, TILE_SIZE, &buffers[2]);
+
+	// Visible textures are never evicted, even over the budget
+	build_frame(scene_output);
+	wl_event_loop_dispatch(test.loop, 0);
+	assert(a->texture != NULL && b->texture != NULL && c->texture != NULL);
+	assert(scene->texture_stats.textures_evicted == 0);
+
+	// Hidden textures are evicted least recently used first, only as far
+	// as needed to meet the budget
+	wlr_scene_node_set_enabled(&a->node, false);
+	wlr_scene_node_set_enabled(&b->node, false);
+	build_frame(scene_output);
+	wl_event_loop_dispatch(test.loop, 0);
+	assert(a->texture == NULL);
+	assert(b->texture != NULL && c->texture != NULL);
+	assert(scene->texture_stats.textures_evicted == 1);
+	assert(scene->texture_stats.bytes_evicted == TILE_BYTES);
+
+	// Evicting every hidden texture can't meet a smaller budget, the
+	// visible one stays
+	wlr_renderer_set_texture_budget(test.renderer, TILE_BYTES / 2);
+	wlr_scene_node_set_position(&c->node, TILE_SIZE, TILE_SIZE);
+	build_frame(scene_output);
+	wl_event_loop_dispatch(test.loop, 0);
+	assert(a->texture == NULL && b->texture == NULL);
+	assert(c->texture != NULL);
+	assert(scene->texture_stats.textures_evicted == 2);
+	assert(scene->texture_stats.bytes_evicted == 2 * TILE_BYTES);
+
+	// Evicted textures are uploaded again once visible
+	wlr_renderer_set_texture_budget(test.renderer, 0);
+	wlr_scene_node_set_enabled(&a->node, true);
+	build_frame(scene_output);
+	assert(a->texture != NULL);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+		wlr_buffer_unlock(buffers[i]);
+		wlr_buffer_drop(buffers[i]);
+	}
+	test_output_finish(&test);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/swapchain.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+
+#include "common.h"
+
+#define IDLE_MSEC 20
+
+static struct wlr_swapchain *create_swapchain(struct wlr_allocator *alloc) {
+	struct wlr_drm_format_set set = {0};
+	assert(wlr_drm_format_set_add(&set, DRM_FORMAT_XRGB8888,
+		DRM_FORMAT_MOD_INVALID));
+	const struct wlr_drm_format *format =
+		wlr_drm_format_set_get(&set, DRM_FORMAT_XRGB8888);
+	struct wlr_swapchain *swapchain = wlr_swapchain_create(alloc, 16, 16, format);
+	assert(swapchain != NULL);
+	wlr_drm_format_set_finish(&set);
+	return swapchain;
+}
+
+static size_t count_buffers(struct wlr_swapchain *swapchain) {
+	size_t n = 0;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].buffer != NULL) {
+			n++;
+		}
+	}
+	return n;
+}
+
+static void sleep_msec(int msec) {
+	struct timespec ts = {
+		.tv_sec = msec / 1000,
+		.tv_nsec = (long)(msec % 1000) * 1000000,
+	};
+	nanosleep(&ts, NULL);
+}
+
+static void test_trim_on_acquire(void) {
+	struct wlr_allocator *alloc = test_allocator_create();
+	struct wlr_swapchain *swapchain = create_swapchain(alloc);
+	wlr_swapchain_set_idle_trim(swapchain, NULL, IDLE_MSEC, 0);
+
+	struct wlr_buffer *locked = wlr_swapchain_acquire(swapchain);
+	struct wlr_buffer *idle = wlr_swapchain_acquire(swapchain);
+	assert(locked != NULL && idle != NULL);
+	wlr_buffer_unlock(idle);
+	assert(swapchain->stats.allocations == 2);
+
+	// Only the idle buffer expires, the one still in use is kept
+	sleep_msec(2 * IDLE_MSEC);
+	struct wlr_buffer *buffer = wlr_swapchain_acquire(swapchain);
+	assert(buffer != NULL);
+	assert(swapchain->stats.trims == 1);
+	assert(swapchain->stats.allocations == 3);
+	assert(wlr_swapchain_has_buffer(swapchain, locked));
+	assert(count_buffers(swapchain) == 2);
+
+	wlr_buffer_unlock(buffer);
+	wlr_buffer_unlock(locked);
+	wlr_swapchain_destroy(swapchain);
+	wlr_allocator_destroy(alloc);
+}
+
+static void test_trim_on_timer(void) {
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wlr_allocator *alloc = test_allocator_create();
+	struct wlr_swapchain *swapchain = create_swapchain(alloc);
+	wlr_swapchain_set_idle_trim(swapchain, loop, IDLE_MSEC, 2);
+
+	// The timer only runs while there is something to trim
+	struct wlr_buffer *buffers[3];
+	for (size_t i = 0; i < 3; i++) {
+		assert(swapchain->idle_trim_deadline_msec == 0);
+		buffers[i] = wlr_swapchain_acquire(swapchain);
+		assert(buffers[i] != NULL);
+	}
+	assert(swapchain->idle_trim_deadline_msec != 0);
+	for (size_t i = 0; i < 3; i++) {
+		wlr_buffer_unlock(buffers[i]);
+	}
+
+	// Acquiring doesn't re-arm the timer
+	int64_t deadline = swapchain->idle_trim_deadline_msec;
+	struct wlr_buffer *buffer = wlr_swapchain_acquire(swapchain);
+	assert(buffer != NULL);
+	wlr_buffer_unlock(buffer);
+	assert(swapchain->idle_trim_deadline_msec == deadline);
+
+	for (int i = 0; i < 100 && swapchain->stats.trims == 0; i++) {
+		wl_event_loop_dispatch(loop, IDLE_MSEC);
+	}
+	assert(swapchain->stats.trims == 1);
+	assert(count_buffers(swapchain) == 2);
+	assert(swapchain->idle_trim_deadline_msec == 0);
+
+	wlr_swapchain_destroy(swapchain);
+	wlr_allocator_destroy(alloc);
+	wl_event_loop_destroy(loop);
+}
+
+static void test_output_setting(void) {
+	unsetenv("WLR_SWAPCHAIN_IDLE_TRIM");
+
+	struct test_output test;
+	test_output_init(&test, 16, 16);
+	struct wlr_output *output = test.output;
+	assert(output->swapchain_idle_trim_msec == 0);
+	assert(output->swapchain != NULL);
+	assert(output->swapchain->idle_trim_msec == 0);
+
+	wlr_output_set_swapchain_idle_trim(output, IDLE_MSEC);
+	assert(output->swapchain_idle_trim_msec == IDLE_MSEC);
+	assert(output->swapchain->idle_trim_msec == IDLE_MSEC);
+	assert(output->swapchain->idle_trim_min_buffers == 2);
+
+	wlr_output_set_swapchain_idle_trim(output, 0);
+	assert(output->swapchain->idle_trim_msec == 0);
+
+	test_output_finish(&test);
+}
+
+int main(void) {
+	test_trim_on_acquire();
+	test_trim_on_timer();
+	test_output_setting();
+	return EXIT_SUCCESS;
+}
@@ -128,3 +128,9 @@ bool buffer_is_opaque(struct wlr_buffer *buffer) {
 
 	return !pixel_format_has_alpha(format);
 }
+
+bool buffer_get_texture_dmabuf(struct wlr_buffer *buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	return wlr_buffer_get_dmabuf(buffer, attribs) ||
+		shm_buffer_get_udmabuf(buffer, attribs);
+}
@@ -1,8 +1,10 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/interfaces/wlr_buffer.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/util/log.h>
+#include "render/pixel_format.h"
 #include "types/wlr_buffer.h"
 
 static const struct wlr_buffer_impl client_buffer_impl;
@@ -22,10 +24,30 @@ static struct wlr_client_buffer *client_buffer_from_buffer(
 	return client_buffer;
 }
 
+static void client_buffer_cancel_evict(struct wlr_client_buffer *client_buffer) {
+	if (client_buffer->evict_request == NULL) {
+		return;
+	}
+	wl_list_remove(&client_buffer->evict_ready.link);
+	wlr_texture_read_pixels_request_destroy(client_buffer->evict_request);
+	client_buffer->evict_request = NULL;
+}
+
+static void client_buffer_drop_pending(struct wlr_client_buffer *client_buffer) {
+	if (client_buffer->pending != NULL) {
+		wlr_buffer_unlock(client_buffer->pending);
+		client_buffer->pending = NULL;
+	}
+	pixman_region32_clear(&client_buffer->pending_damage);
+}
+
 static void client_buffer_destroy(struct wlr_buffer *buffer) {
 	struct wlr_client_buffer *client_buffer = client_buffer_from_buffer(buffer);
 	wl_list_remove(&client_buffer->source_destroy.link);
 	wl_list_remove(&client_buffer->renderer_destroy.link);
+	client_buffer_cancel_evict(client_buffer);
+	client_buffer_drop_pending(client_buffer);
+	pixman_region32_fini(&client_buffer->pending_damage);
 	wlr_texture_destroy(client_buffer->texture);
 	free(client_buffer);
 }
@@ -62,30 +84,28 @@ static void client_buffer_handle_renderer_destroy(struct wl_listener *listener,
 	wl_list_remove(&client_buffer->renderer_destroy.link);
 	wl_list_init(&client_buffer->renderer_destroy.link);
 	client_buffer->texture = NULL;
+	client_buffer->renderer = NULL;
+	client_buffer_cancel_evict(client_buffer);
+	client_buffer_drop_pending(client_buffer);
 }
 
-struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
-		struct wlr_renderer *renderer) {
-	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
-	if (texture == NULL) {
-		wlr_log(WLR_ERROR, "Failed to create texture");
-		return NULL;
-	}
-
+static struct wlr_client_buffer *client_buffer_create(struct wlr_buffer *buffer,
+		struct wlr_renderer *renderer, struct wlr_texture *texture) {
 	struct wlr_client_buffer *client_buffer = calloc(1, sizeof(*client_buffer));
 	if (client_buffer == NULL) {
-		wlr_texture_destroy(texture);
 		return NULL;
 	}
 	wlr_buffer_init(&client_buffer->base, &client_buffer_impl,
-		texture->width, texture->height);
+		buffer->width, buffer->height);
 	client_buffer->source = buffer;
 	client_buffer->texture = texture;
+	client_buffer->renderer = renderer;
+	pixman_region32_init(&client_buffer->pending_damage);
 
 	wl_signal_add(&buffer->events.destroy, &client_buffer->source_destroy);
 	client_buffer->source_destroy.notify = client_buffer_handle_source_destroy;
 
-	wl_signal_add(&texture->renderer->events.destroy, &client_buffer->renderer_destroy);
+	wl_signal_add(&renderer->events.destroy, &client_buffer->renderer_destroy);
 	client_buffer->renderer_destroy.notify = client_buffer_handle_renderer_destroy;
 
 	// Ensure the buffer will be released before being destroyed
@@ -95,15 +115,295 @@ struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
 	return client_buffer;
 }
 
+struct wlr_client_buffer *wlr_client_buffer_create(struct wlr_buffer *buffer,
+		struct wlr_renderer *renderer) {
+	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, buffer);
+	if (texture == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create texture");
+		return NULL;
+	}
+
+	struct wlr_client_buffer *client_buffer =
+		client_buffer_create(buffer, renderer, texture);
+	if (client_buffer == NULL) {
+		wlr_texture_destroy(texture);
+		return NULL;
+	}
+
+	return client_buffer;
+}
+
+struct wlr_client_buffer *wlr_client_buffer_create_deferred(
+		struct wlr_buffer *buffer, struct wlr_renderer *renderer) {
+	struct wlr_client_buffer *client_buffer =
+		client_buffer_create(buffer, renderer, NULL);
+	if (client_buffer == NULL) {
+		return NULL;
+	}
+
+	client_buffer->pending = wlr_buffer_lock(buffer);
+	pixman_region32_union_rect(&client_buffer->pending_damage,
+		&client_buffer->pending_damage, 0, 0, buffer->width, buffer->height);
+
+	return client_buffer;
+}
+
 bool wlr_client_buffer_apply_damage(struct wlr_client_buffer *client_buffer,
 		struct wlr_buffer *next, const pixman_region32_t *damage) {
 	if (client_buffer->base.n_locks - client_buffer->n_ignore_locks > 1) {
 		// Someone else still has a reference to the buffer
 		return false;
 	}
+	if (client_buffer->pending != NULL) {
+		// The pending contents would be lost
+		return false;
+	}
 	if (client_buffer->texture == NULL) {
 		return false;
 	}
 
+	// The read-back would miss the new contents
+	client_buffer_cancel_evict(client_buffer);
 	return wlr_texture_update_from_buffer(client_buffer->texture, next, damage);
 }
+
+// Number of bytes copied when uploading a region of a buffer
+static size_t get_upload_size(struct wlr_buffer *buffer,
+		const pixman_region32_t *region) {
+	// Only shared memory buffers are copied, other buffers are imported
+	struct wlr_shm_attributes shm;
+	if (!wlr_buffer_get_shm(buffer, &shm)) {
+		return 0;
+	}
+	const struct wlr_pixel_format_info *fmt =
+		drm_get_pixel_format_info(shm.format);
+	if (fmt == NULL) {
+		return 0;
+	}
+
+	size_t pixels = 0;
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		pixels += (size_t)(rects[i].x2 - rects[i].x1) *
+			(size_t)(rects[i].y2 - rects[i].y1);
+	}
+	return pixels * fmt->bytes_per_block /
+		pixel_format_info_pixels_per_block(fmt);
+}
+
+bool wlr_client_buffer_defer_damage(struct wlr_client_buffer *client_buffer,
+		struct wlr_buffer *next, const pixman_region32_t *damage,
+		size_t *saved_bytes) {
+	*saved_bytes = 0;
+
+	if (client_buffer->base.n_locks - client_buffer->n_ignore_locks > 1) {
+		// Someone else still has a reference to the buffer
+		return false;
+	}
+	if (client_buffer->renderer == NULL ||
+			(client_buffer->texture == NULL && client_buffer->pending == NULL)) {
+		return false;
+	}
+	if (next->width != client_buffer->base.width ||
+			next->height != client_buffer->base.height) {
+		return false;
+	}
+
+	// Textures imported from DMA-BUFs can't be updated
+	struct wlr_dmabuf_attributes dmabuf;
+	if (buffer_get_texture_dmabuf(next, &dmabuf)) {
+		return false;
+	}
+
+	// Keep the buffer contents around until the upload. Replacing a pending
+	// buffer is fine, since the damage accumulates.
+	client_buffer_cancel_evict(client_buffer);
+	wlr_buffer_lock(next);
+	if (client_buffer->pending != NULL) {
+		// Overlapping damage is only uploaded once
+		size_t prev_size = get_upload_size(next, &client_buffer->pending_damage) +
+			get_upload_size(next, damage);
+		pixman_region32_union(&client_buffer->pending_damage,
+			&client_buffer->pending_damage, damage);
+		*saved_bytes = prev_size -
+			get_upload_size(next, &client_buffer->pending_damage);
+		wlr_buffer_unlock(client_buffer->pending);
+	} else {
+		pixman_region32_union(&client_buffer->pending_damage,
+			&client_buffer->pending_damage, damage);
+	}
+	client_buffer->pending = next;
+	return true;
+}
+
+size_t wlr_client_buffer_get_pending_upload_size(
+		struct wlr_client_buffer *client_buffer) {
+	if (client_buffer->pending == NULL) {
+		return 0;
+	}
+	return get_upload_size(client_buffer->pending, &client_buffer->pending_damage);
+}
+
+/**
+ * Copy the damaged parts of the pending buffer on top of the texture contents
+ * read back in pixels, so that they can replace the texture altogether.
+ */
+static bool client_buffer_merge_pending(struct wlr_client_buffer *client_buffer,
+		const struct wlr_pixel_format_info *fmt, void *pixels, uint32_t stride) {
+	void *data;
+	uint32_t format;
+	size_t pending_stride;
+	if (!wlr_buffer_begin_data_ptr_access(client_buffer->pending,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &pending_stride)) {
+		return false;
+	}
+	if (format != fmt->drm_format) {
+		wlr_buffer_end_data_ptr_access(client_buffer->pending);
+		return false;
+	}
+
+	int rects_len;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&client_buffer->pending_damage, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *r = &rects[i];
+		size_t offset = pixel_format_info_min_stride(fmt, r->x1);
+		size_t len = pixel_format_info_min_stride(fmt, r->x2 - r->x1);
+		for (int y = r->y1; y < r->y2; y++) {
+			memcpy((char *)pixels + (size_t)y * stride + offset,
+				(const char *)data + (size_t)y * pending_stride + offset, len);
+		}
+	}
+
+	wlr_buffer_end_data_ptr_access(client_buffer->pending);
+	return true;
+}
+
+static void client_buffer_handle_evict_ready(struct wl_listener *listener,
+		void *data) {
+	struct wlr_client_buffer *client_buffer =
+		wl_container_of(listener, client_buffer, evict_ready);
+	struct wlr_texture_read_pixels_request *request = client_buffer->evict_request;
+	struct wlr_texture *texture = client_buffer->texture;
+
+	const struct wlr_pixel_format_info *fmt =
+		drm_get_pixel_format_info(request->format);
+	uint32_t stride = pixel_format_info_min_stride(fmt, request->width);
+	void *pixels = malloc((size_t)stride * request->height);
+	bool ok = pixels != NULL &&
+		wlr_texture_read_pixels_request_copy(request, pixels, stride);
+	client_buffer_cancel_evict(client_buffer);
+	if (ok && client_buffer->pending != NULL) {
+		ok = client_buffer_merge_pending(client_buffer, fmt, pixels, stride);
+	}
+	if (!ok) {
+		// Keep the texture
+		free(pixels);
+		return;
+	}
+
+	struct wlr_readonly_data_buffer *copy = readonly_data_buffer_create(
+		fmt->drm_format, stride, texture->width, texture->height, pixels);
+	if (copy == NULL) {
+		free(pixels);
+		return;
+	}
+	// The buffer owns the data from now on
+	copy->saved_data = pixels;
+
+	client_buffer_drop_pending(client_buffer);
+	client_buffer->pending = wlr_buffer_lock(&copy->base);
+	wlr_buffer_drop(&copy->base);
+	pixman_region32_union_rect(&client_buffer->pending_damage,
+		&client_buffer->pending_damage, 0, 0, texture->width, texture->height);
+
+	wlr_texture_destroy(texture);
+	client_buffer->texture = NULL;
+}
+
+bool wlr_client_buffer_evict_texture(struct wlr_client_buffer *client_buffer,
+		struct wl_event_loop *loop) {
+	struct wlr_texture *texture = client_buffer->texture;
+	if (texture == NULL || client_buffer->renderer == NULL ||
+			client_buffer->evict_request != NULL) {
+		return false;
+	}
+
+	// Imported textures are cached by the renderer as long as the buffer is
+	// alive, destroying them wouldn't free anything
+	struct wlr_dmabuf_attributes dmabuf;
+	if (client_buffer->source != NULL &&
+			buffer_get_texture_dmabuf(client_buffer->source, &dmabuf)) {
+		return false;
+	}
+
+	// If the pending upload replaces all of the contents, the texture can go
+	// right away
+	if (client_buffer->pending != NULL &&
+			pixman_region32_contains_rectangle(&client_buffer->pending_damage,
+				&(pixman_box32_t){
+					.x2 = client_buffer->base.width,
+					.y2 = client_buffer->base.height,
+				}) == PIXMAN_REGION_IN) {
+		wlr_texture_destroy(texture);
+		client_buffer->texture = NULL;
+		return true;
+	}
+
+	// The client may have re-used its buffer after the upload, so the texture
+	// holds the only copy of the contents: read it back into system memory.
+	// The texture is destroyed once the read-back is done. Pending contents
+	// are merged into the read-back, so it must use their format.
+	uint32_t format = wlr_texture_preferred_read_format(texture);
+	struct wlr_shm_attributes shm;
+	if (client_buffer->pending != NULL) {
+		if (!wlr_buffer_get_shm(client_buffer->pending, &shm)) {
+			return false;
+		}
+		format = shm.format;
+	}
+	const struct wlr_pixel_format_info *fmt = drm_get_pixel_format_info(format);
+	if (fmt == NULL || pixel_format_info_pixels_per_block(fmt) != 1) {
+		return false;
+	}
+	client_buffer->evict_request = wlr_texture_read_pixels_async(texture, loop,
+		&(struct wlr_texture_read_pixels_async_options){
+			.format = format,
+		});
+	if (client_buffer->evict_request == NULL) {
+		return false;
+	}
+
+	client_buffer->evict_ready.notify = client_buffer_handle_evict_ready;
+	wl_signal_add(&client_buffer->evict_request->events.ready,
+		&client_buffer->evict_ready);
+	return true;
+}
+
+struct wlr_texture *wlr_client_buffer_get_texture(
+		struct wlr_client_buffer *client_buffer) {
+	// The texture is in use again
+	client_buffer_cancel_evict(client_buffer);
+
+	if (client_buffer->pending == NULL) {
+		return client_buffer->texture;
+	}
+
+	struct wlr_buffer *pending = client_buffer->pending;
+	if (client_buffer->texture == NULL ||
+			!wlr_texture_update_from_buffer(client_buffer->texture, pending,
+				&client_buffer->pending_damage)) {
+		struct wlr_texture *texture =
+			wlr_texture_from_buffer(client_buffer->renderer, pending);
+		if (texture != NULL) {
+			wlr_texture_destroy(client_buffer->texture);
+			client_buffer->texture = texture;
+		} else {
+			wlr_log(WLR_ERROR, "Failed to create texture");
+		}
+	}
+
+	client_buffer_drop_pending(client_buffer);
+	return client_buffer->texture;
+}
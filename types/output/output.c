@@ -365,6 +365,8 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 		wlr_log(WLR_DEBUG, "WLR_NO_HARDWARE_CURSORS set, forcing software cursors");
 	}
 
+	output->swapchain_idle_trim_msec = output_swapchain_idle_trim_from_env();
+
 	wlr_addon_set_init(&output->addons);
 
 	wl_list_init(&output->display_destroy.link);
@@ -9,6 +9,26 @@
 #include "render/drm_format_set.h"
 #include "types/wlr_output.h"
 
+// Keep one buffer for the front buffer and one to render into
+#define IDLE_TRIM_MIN_BUFFERS 2
+
+int output_swapchain_idle_trim_from_env(void) {
+	const char *name = "WLR_SWAPCHAIN_IDLE_TRIM";
+	const char *str = getenv(name);
+	if (str == NULL) {
+		return 0;
+	}
+
+	char *end;
+	int idle_msec = (int)strtol(str, &end, 10);
+	if (*end || idle_msec < 0) {
+		wlr_log(WLR_ERROR, "%s specified with invalid integer, ignoring", name);
+		return 0;
+	}
+
+	return idle_msec;
+}
+
 static struct wlr_swapchain *create_swapchain(struct wlr_output *output,
 		int width, int height, uint32_t render_format, bool allow_modifiers) {
 	struct wlr_allocator *allocator = output->allocator;
@@ -45,9 +65,21 @@ static struct wlr_swapchain *create_swapchain(struct wlr_output *output,
 
 	struct wlr_swapchain *swapchain = wlr_swapchain_create(allocator, width, height, &format);
 	wlr_drm_format_finish(&format);
+	if (swapchain != NULL) {
+		wlr_swapchain_set_idle_trim(swapchain, output->event_loop,
+			output->swapchain_idle_trim_msec, IDLE_TRIM_MIN_BUFFERS);
+	}
 	return swapchain;
 }
 
+void wlr_output_set_swapchain_idle_trim(struct wlr_output *output, int idle_msec) {
+	output->swapchain_idle_trim_msec = idle_msec > 0 ? idle_msec : 0;
+	if (output->swapchain != NULL) {
+		wlr_swapchain_set_idle_trim(output->swapchain, output->event_loop,
+			output->swapchain_idle_trim_msec, IDLE_TRIM_MIN_BUFFERS);
+	}
+}
+
 static bool test_swapchain(struct wlr_output *output,
 		struct wlr_swapchain *swapchain, const struct wlr_output_state *state) {
 	struct wlr_buffer *buffer = wlr_swapchain_acquire(swapchain);
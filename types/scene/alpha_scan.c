@@ -0,0 +1,167 @@
+#include <drm_fourcc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+#include "types/wlr_scene.h"
+#include "util/time.h"
+
+// Contents are scanned in square tiles of this size
+#define TILE_SIZE 64
+// Minimum delay between two scans of the same scene buffer
+#define SCAN_INTERVAL_MSEC 100
+
+static bool get_alpha_mask(uint32_t format, uint32_t *mask) {
+	switch (format) {
+	case DRM_FORMAT_ARGB8888:
+	case DRM_FORMAT_ABGR8888:
+		*mask = 0xFF000000;
+		return true;
+	case DRM_FORMAT_RGBA8888:
+	case DRM_FORMAT_BGRA8888:
+		*mask = 0x000000FF;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Check whether all pixels of a tile have their alpha channel set. The inner
+ * loop is a branch-free AND reduction so that it gets vectorized.
+ */
+static bool tile_is_opaque(const uint8_t *data, size_t stride, uint32_t mask,
+		int x1, int y1, int x2, int y2) {
+	for (int y = y1; y < y2; y++) {
+		const uint32_t *row = (const uint32_t *)(data + y * stride) + x1;
+		uint32_t acc = mask;
+		for (int x = 0; x < x2 - x1; x++) {
+			acc &= row[x];
+		}
+		if ((acc & mask) != mask) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void region_align_to_tiles(pixman_region32_t *dst,
+		const pixman_region32_t *src, int width, int height) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(src, &rects_len);
+
+	pixman_region32_clear(dst);
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *r = &rects[i];
+		int x1 = r->x1 / TILE_SIZE * TILE_SIZE;
+		int y1 = r->y1 / TILE_SIZE * TILE_SIZE;
+		int x2 = (r->x2 + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+		int y2 = (r->y2 + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+		pixman_region32_union_rect(dst, dst, x1, y1, x2 - x1, y2 - y1);
+	}
+	pixman_region32_intersect_rect(dst, dst, 0, 0, width, height);
+}
+
+void scene_buffer_reset_scanned_opaque(struct wlr_scene_buffer *scene_buffer) {
+	pixman_region32_clear(&scene_buffer->scanned_opaque);
+	pixman_region32_clear(&scene_buffer->scan_pending);
+	scene_buffer->scanned_width = scene_buffer->scanned_height = 0;
+}
+
+int scene_buffer_scan_opaque(struct wlr_scene_buffer *scene_buffer,
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		scene_buffer_reset_scanned_opaque(scene_buffer);
+		return 0;
+	}
+
+	uint32_t mask;
+	if (!get_alpha_mask(format, &mask)) {
+		wlr_buffer_end_data_ptr_access(buffer);
+		scene_buffer_reset_scanned_opaque(scene_buffer);
+		return 0;
+	}
+
+	// Contents outside of the damage are only known if the previous scan was
+	// done on a buffer of the same size
+	if (scene_buffer->scanned_width != buffer->width ||
+			scene_buffer->scanned_height != buffer->height) {
+		scene_buffer_reset_scanned_opaque(scene_buffer);
+		pixman_region32_union_rect(&scene_buffer->scan_pending,
+			&scene_buffer->scan_pending, 0, 0, buffer->width, buffer->height);
+		scene_buffer->scanned_width = buffer->width;
+		scene_buffer->scanned_height = buffer->height;
+	} else {
+		pixman_region32_union(&scene_buffer->scan_pending,
+			&scene_buffer->scan_pending, damage);
+	}
+
+	pixman_region32_t tiles;
+	pixman_region32_init(&tiles);
+	region_align_to_tiles(&tiles, &scene_buffer->scan_pending,
+		buffer->width, buffer->height);
+
+	// Damaged tiles can't be trusted until they have been scanned again
+	pixman_region32_subtract(&scene_buffer->scanned_opaque,
+		&scene_buffer->scanned_opaque, &tiles);
+
+	if (!pixman_region32_not_empty(&tiles)) {
+		pixman_region32_fini(&tiles);
+		wlr_buffer_end_data_ptr_access(buffer);
+		return 0;
+	}
+
+	int64_t now = get_current_time_msec();
+	if (now - scene_buffer->last_scan_msec < SCAN_INTERVAL_MSEC) {
+		pixman_region32_fini(&tiles);
+		wlr_buffer_end_data_ptr_access(buffer);
+		return SCAN_INTERVAL_MSEC - (now - scene_buffer->last_scan_msec);
+	}
+	scene_buffer->last_scan_msec = now;
+
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&tiles, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *r = &rects[i];
+		for (int y = r->y1; y < r->y2; y += TILE_SIZE) {
+			int y2 = y + TILE_SIZE < r->y2 ? y + TILE_SIZE : r->y2;
+
+			// Merge runs of opaque tiles to keep the region small
+			int run_start = -1;
+			for (int x = r->x1; x < r->x2; x += TILE_SIZE) {
+				int x2 = x + TILE_SIZE < r->x2 ? x + TILE_SIZE : r->x2;
+				bool opaque_tile = tile_is_opaque(data, stride, mask,
+					x, y, x2, y2);
+				if (opaque_tile && run_start < 0) {
+					run_start = x;
+				} else if (!opaque_tile && run_start >= 0) {
+					pixman_region32_union_rect(&opaque, &opaque,
+						run_start, y, x - run_start, y2 - y);
+					run_start = -1;
+				}
+			}
+			if (run_start >= 0) {
+				pixman_region32_union_rect(&opaque, &opaque,
+					run_start, y, r->x2 - run_start, y2 - y);
+			}
+		}
+	}
+
+	wlr_buffer_end_data_ptr_access(buffer);
+
+	pixman_region32_union(&scene_buffer->scanned_opaque,
+		&scene_buffer->scanned_opaque, &opaque);
+	pixman_region32_clear(&scene_buffer->scan_pending);
+
+	pixman_region32_fini(&opaque);
+	pixman_region32_fini(&tiles);
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <wlr/types/wlr_alpha_modifier_v1.h>
 #include <wlr/types/wlr_compositor.h>
@@ -6,6 +7,7 @@
 #include <wlr/types/wlr_fractional_scale_v1.h>
 #include <wlr/types/wlr_linux_drm_syncobj_v1.h>
 #include <wlr/types/wlr_presentation_time.h>
+#include <wlr/util/region.h>
 #include <wlr/util/transform.h>
 #include "types/wlr_scene.h"
 
@@ -102,6 +104,91 @@ static int min(int a, int b) {
 	return a < b ? a : b;
 }
 
+/**
+ * Scale a region, only keeping the pixels which are entirely covered by the
+ * scaled rectangles.
+ */
+static void region_scale_inner(pixman_region32_t *region, double scale_x,
+		double scale_y) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+
+	pixman_region32_t scaled;
+	pixman_region32_init(&scaled);
+	for (int i = 0; i < rects_len; i++) {
+		int x1 = ceil(rects[i].x1 * scale_x);
+		int y1 = ceil(rects[i].y1 * scale_y);
+		int x2 = floor(rects[i].x2 * scale_x);
+		int y2 = floor(rects[i].y2 * scale_y);
+		if (x2 > x1 && y2 > y1) {
+			pixman_region32_union_rect(&scaled, &scaled, x1, y1, x2 - x1, y2 - y1);
+		}
+	}
+
+	pixman_region32_copy(region, &scaled);
+	pixman_region32_fini(&scaled);
+}
+
+/**
+ * Convert the opaque region derived from the buffer contents to surface-local
+ * coordinates and add it to opaque.
+ */
+static void surface_add_scanned_opaque(struct wlr_scene_surface *scene_surface,
+		const struct wlr_fbox *src_box, pixman_region32_t *opaque) {
+	struct wlr_scene_buffer *scene_buffer = scene_surface->buffer;
+	struct wlr_surface_state *state = &scene_surface->surface->current;
+	if (!pixman_region32_not_empty(&scene_buffer->scanned_opaque) ||
+			scene_buffer->scanned_width != state->buffer_width ||
+			scene_buffer->scanned_height != state->buffer_height) {
+		return;
+	}
+
+	struct wlr_fbox box;
+	wlr_fbox_transform(&box, src_box, state->transform,
+		state->buffer_width, state->buffer_height);
+	int buffer_width = state->buffer_width;
+	int buffer_height = state->buffer_height;
+	wlr_output_transform_coords(state->transform, &buffer_width, &buffer_height);
+
+	pixman_region32_t scanned;
+	pixman_region32_init(&scanned);
+	wlr_region_transform(&scanned, &scene_buffer->scanned_opaque,
+		state->transform, state->buffer_width, state->buffer_height);
+	pixman_region32_intersect_rect(&scanned, &scanned,
+		ceil(box.x), ceil(box.y),
+		floor(box.x + box.width) - ceil(box.x),
+		floor(box.y + box.height) - ceil(box.y));
+	pixman_region32_translate(&scanned, -ceil(box.x), -ceil(box.y));
+	region_scale_inner(&scanned, state->width / box.width,
+		state->height / box.height);
+
+	pixman_region32_union(opaque, opaque, &scanned);
+	pixman_region32_fini(&scanned);
+}
+
+/**
+ * Get the opaque region of the surface, clipped like the scene buffer. src_box
+ * is the unclipped buffer source box.
+ */
+static void surface_get_opaque_region(struct wlr_scene_surface *scene_surface,
+		const struct wlr_fbox *src_box, pixman_region32_t *opaque) {
+	struct wlr_surface *surface = scene_surface->surface;
+	struct wlr_surface_state *state = &surface->current;
+
+	pixman_region32_copy(opaque, &surface->opaque_region);
+	if (surface->buffer != NULL) {
+		surface_add_scanned_opaque(scene_surface, src_box, opaque);
+	}
+
+	if (!wlr_box_empty(&scene_surface->clip)) {
+		struct wlr_box *clip = &scene_surface->clip;
+		int width = min(clip->width, state->width - clip->x);
+		int height = min(clip->height, state->height - clip->y);
+		pixman_region32_translate(opaque, -clip->x, -clip->y);
+		pixman_region32_intersect_rect(opaque, opaque, 0, 0, width, height);
+	}
+}
+
 static void surface_reconfigure(struct wlr_scene_surface *scene_surface) {
 	struct wlr_scene_buffer *scene_buffer = scene_surface->buffer;
 	struct wlr_surface *surface = scene_surface->surface;
@@ -112,7 +199,7 @@ static void surface_reconfigure(struct wlr_scene_surface *scene_surface) {
 
 	pixman_region32_t opaque;
 	pixman_region32_init(&opaque);
-	pixman_region32_copy(&opaque, &surface->opaque_region);
+	surface_get_opaque_region(scene_surface, &src_box, &opaque);
 
 	int width = state->width;
 	int height = state->height;
@@ -136,9 +223,6 @@ static void surface_reconfigure(struct wlr_scene_surface *scene_surface) {
 
 		wlr_fbox_transform(&src_box, &src_box, wlr_output_transform_invert(state->transform),
 			buffer_width, buffer_height);
-
-		pixman_region32_translate(&opaque, -clip->x, -clip->y);
-		pixman_region32_intersect_rect(&opaque, &opaque, 0, 0, width, height);
 	}
 
 	if (width <= 0 || height <= 0) {
@@ -195,12 +279,97 @@ static void surface_reconfigure(struct wlr_scene_surface *scene_surface) {
 	pixman_region32_fini(&opaque);
 }
 
+static void surface_set_scan_buffer(struct wlr_scene_surface *surface,
+		struct wlr_buffer *buffer) {
+	if (buffer != NULL) {
+		wlr_buffer_lock(buffer);
+	}
+	wlr_buffer_unlock(surface->scan_buffer);
+	surface->scan_buffer = buffer;
+}
+
+static int surface_handle_scan_timer(void *data) {
+	struct wlr_scene_surface *surface = data;
+	struct wlr_buffer *buffer = surface->scan_buffer;
+	if (buffer == NULL) {
+		return 0;
+	}
+
+	// The damage is already pending in the scene buffer
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	int delay = scene_buffer_scan_opaque(surface->buffer, buffer, &damage);
+	pixman_region32_fini(&damage);
+
+	if (delay > 0) {
+		wl_event_source_timer_update(surface->scan_timer, delay);
+		return 0;
+	}
+	surface_set_scan_buffer(surface, NULL);
+
+	struct wlr_fbox src_box;
+	wlr_surface_get_buffer_source_box(surface->surface, &src_box);
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+	surface_get_opaque_region(surface, &src_box, &opaque);
+	if (!pixman_region32_equal(&surface->buffer->opaque_region, &opaque)) {
+		wlr_scene_buffer_set_opaque_region(surface->buffer, &opaque);
+		// Nothing else may trigger a frame, e.g. to try direct scan-out again
+		scene_buffer_damage_visible(surface->buffer);
+	}
+	pixman_region32_fini(&opaque);
+	return 0;
+}
+
+/**
+ * Keep the buffer until the rate-limited scan can be done, or drop it if delay
+ * is 0.
+ */
+static void surface_defer_scan(struct wlr_scene_surface *surface,
+		struct wlr_buffer *buffer, int delay) {
+	if (delay <= 0) {
+		surface_set_scan_buffer(surface, NULL);
+		if (surface->scan_timer != NULL) {
+			wl_event_source_timer_update(surface->scan_timer, 0);
+		}
+		return;
+	}
+
+	if (surface->scan_timer == NULL) {
+		struct wl_display *display =
+			wl_client_get_display(wl_resource_get_client(surface->surface->resource));
+		surface->scan_timer = wl_event_loop_add_timer(
+			wl_display_get_event_loop(display), surface_handle_scan_timer, surface);
+		if (surface->scan_timer == NULL) {
+			return;
+		}
+	}
+
+	// Keeping the buffer delays its release, but only for a short while
+	surface_set_scan_buffer(surface, buffer);
+	wl_event_source_timer_update(surface->scan_timer, delay);
+}
+
 static void handle_scene_surface_surface_commit(
 		struct wl_listener *listener, void *data) {
 	struct wlr_scene_surface *surface =
 		wl_container_of(listener, surface, surface_commit);
 	struct wlr_scene_buffer *scene_buffer = surface->buffer;
 
+	// The client buffer contents are only accessible during the commit, unless
+	// the buffer is kept locked for a deferred scan
+	struct wlr_surface_state *state = &surface->surface->current;
+	if (state->committed & WLR_SURFACE_STATE_BUFFER) {
+		int delay = 0;
+		if (state->buffer != NULL &&
+				scene_node_get_root(&scene_buffer->node)->alpha_scan &&
+				!surface->surface->opaque) {
+			delay = scene_buffer_scan_opaque(scene_buffer, state->buffer,
+				&surface->surface->buffer_damage);
+		}
+		surface_defer_scan(surface, state->buffer, delay);
+	}
+
 	surface_reconfigure(surface);
 
 	// If the surface has requested a frame done event, honour that. The
@@ -243,6 +412,11 @@ static void surface_addon_destroy(struct wlr_addon *addon) {
 	wl_list_remove(&surface->surface_destroy.link);
 	wl_list_remove(&surface->surface_commit.link);
 
+	if (surface->scan_timer != NULL) {
+		wl_event_source_remove(surface->scan_timer);
+	}
+	wlr_buffer_unlock(surface->scan_buffer);
+
 	free(surface);
 }
 
@@ -1,7 +1,10 @@
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <wlr/backend.h>
+#include <wlr/render/allocator.h>
 #include <wlr/render/swapchain.h>
 #include <wlr/render/drm_syncobj.h>
 #include <wlr/render/wlr_renderer.h>
@@ -9,6 +12,7 @@
 #include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/util/log.h>
@@ -18,7 +22,9 @@
 #include "types/wlr_output.h"
 #include "types/wlr_scene.h"
 #include "util/array.h"
+#include "util/bitset.h"
 #include "util/env.h"
+#include "util/thread_pool.h"
 #include "util/time.h"
 
 #include <wlr/config.h>
@@ -28,6 +34,8 @@
 #endif
 
 #define HIGHLIGHT_DAMAGE_FADEOUT_TIME 250
+#define SCENE_OUTPUT_MAX_LAYERS 4
+#define SCENE_MAX_THREADS 8
 
 struct wlr_scene_tree *wlr_scene_tree_from_node(struct wlr_scene_node *node) {
 	assert(node->type == WLR_SCENE_NODE_TREE);
@@ -93,6 +101,34 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_buffer *buffer);
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_texture *texture);
+static void scene_buffer_update_texture_link(struct wlr_scene_buffer *scene_buffer);
+static void scene_tree_cache_finish(struct wlr_scene_tree *tree);
+
+static struct wlr_scene_output *scene_get_output_by_index(
+		struct wlr_scene *scene, size_t index) {
+	struct wlr_scene_output **outputs = scene->outputs_by_index.data;
+	assert(index < scene->outputs_by_index.size / sizeof(*outputs));
+	assert(outputs[index] != NULL);
+	return outputs[index];
+}
+
+static bool scene_set_output_by_index(struct wlr_scene *scene,
+		struct wlr_scene_output *scene_output) {
+	size_t len = scene->outputs_by_index.size / sizeof(struct wlr_scene_output *);
+	if (scene_output->index >= len) {
+		size_t add = (scene_output->index + 1 - len) * sizeof(struct wlr_scene_output *);
+		void *ptr = wl_array_add(&scene->outputs_by_index, add);
+		if (ptr == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		memset(ptr, 0, add);
+	}
+
+	struct wlr_scene_output **outputs = scene->outputs_by_index.data;
+	outputs[scene_output->index] = scene_output;
+	return true;
+}
 
 void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node == NULL) {
@@ -108,23 +144,26 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	wlr_scene_node_set_enabled(node, false);
 
 	struct wlr_scene *scene = scene_node_get_root(node);
+	// Render lists may still reference this node
+	scene->generation++;
 	if (node->type == WLR_SCENE_NODE_BUFFER) {
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 
-		uint64_t active = scene_buffer->active_outputs;
-		if (active) {
-			struct wlr_scene_output *scene_output;
-			wl_list_for_each(scene_output, &scene->outputs, link) {
-				if (active & (1ull << scene_output->index)) {
-					wl_signal_emit_mutable(&scene_buffer->events.output_leave,
-						scene_output);
-				}
-			}
+		struct wl_array *active = &scene_buffer->active_outputs;
+		for (size_t i = bitset_next(active, 0); i != BITSET_NONE;
+				i = bitset_next(active, i + 1)) {
+			wl_signal_emit_mutable(&scene_buffer->events.output_leave,
+				scene_get_output_by_index(scene, i));
 		}
+		wl_array_release(active);
 
 		scene_buffer_set_buffer(scene_buffer, NULL);
 		scene_buffer_set_texture(scene_buffer, NULL);
+		wl_list_remove(&scene_buffer->texture_link);
 		pixman_region32_fini(&scene_buffer->opaque_region);
+		pixman_region32_fini(&scene_buffer->scanned_opaque);
+		pixman_region32_fini(&scene_buffer->scan_pending);
+		wl_list_remove(&scene_buffer->primary_output_link);
 		wlr_drm_syncobj_timeline_unref(scene_buffer->wait_timeline);
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
@@ -139,6 +178,11 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_set_gamma.link);
+			pixman_region32_fini(&scene->transaction_update_region);
+			pixman_region32_fini(&scene->transaction_damage);
+			thread_pool_destroy(scene->thread_pool);
+			wl_array_release(&scene->output_boxes);
+			wl_array_release(&scene->outputs_by_index);
 		} else {
 			assert(node->parent);
 		}
@@ -148,6 +192,8 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 				&scene_tree->children, link) {
 			wlr_scene_node_destroy(child);
 		}
+
+		scene_tree_cache_finish(scene_tree);
 	}
 
 	wl_list_remove(&node->link);
@@ -160,6 +206,7 @@ static void scene_tree_init(struct wlr_scene_tree *tree,
 	*tree = (struct wlr_scene_tree){0};
 	scene_node_init(&tree->node, WLR_SCENE_NODE_TREE, parent);
 	wl_list_init(&tree->children);
+	wl_list_init(&tree->cache_renderer_destroy.link);
 }
 
 struct wlr_scene *wlr_scene_create(void) {
@@ -169,11 +216,17 @@ struct wlr_scene *wlr_scene_create(void) {
 	}
 
 	scene_tree_init(&scene->tree, NULL);
+	scene->generation = 1;
 
 	wl_list_init(&scene->outputs);
+	wl_list_init(&scene->textures);
 	wl_list_init(&scene->linux_dmabuf_v1_destroy.link);
 	wl_list_init(&scene->gamma_control_manager_v1_destroy.link);
 	wl_list_init(&scene->gamma_control_manager_v1_set_gamma.link);
+	pixman_region32_init(&scene->transaction_update_region);
+	pixman_region32_init(&scene->transaction_damage);
+	wl_array_init(&scene->output_boxes);
+	wl_array_init(&scene->outputs_by_index);
 
 	const char *debug_damage_options[] = {
 		"none",
@@ -184,6 +237,8 @@ struct wlr_scene *wlr_scene_create(void) {
 
 	scene->debug_damage_option = env_parse_switch("WLR_SCENE_DEBUG_DAMAGE", debug_damage_options);
 	scene->direct_scanout = !env_parse_bool("WLR_SCENE_DISABLE_DIRECT_SCANOUT");
+	scene->output_layers = env_parse_bool("WLR_SCENE_ENABLE_OUTPUT_LAYERS");
+	scene->alpha_scan = env_parse_bool("WLR_SCENE_ENABLE_ALPHA_SCAN");
 	scene->calculate_visibility = !env_parse_bool("WLR_SCENE_DISABLE_VISIBILITY");
 	scene->highlight_transparent_region = env_parse_bool("WLR_SCENE_HIGHLIGHT_TRANSPARENT_REGION");
 
@@ -204,11 +259,81 @@ struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 
 static void scene_node_get_size(struct wlr_scene_node *node, int *lx, int *ly);
 
+static void scene_tree_invalidate_bounds(struct wlr_scene_tree *tree) {
+	// A dirty tree always has dirty ancestors, so we can stop as soon as we
+	// find one
+	while (tree != NULL && !tree->bounds_dirty) {
+		tree->bounds_dirty = true;
+		tree = tree->node.parent;
+	}
+}
+
+static void scene_node_invalidate_caches(struct wlr_scene_node *node) {
+	for (struct wlr_scene_tree *tree = node->parent; tree != NULL;
+			tree = tree->node.parent) {
+		tree->cache_dirty = true;
+	}
+}
+
+static void box_union(struct wlr_box *dest, const struct wlr_box *box) {
+	if (wlr_box_empty(box)) {
+		return;
+	}
+	if (wlr_box_empty(dest)) {
+		*dest = *box;
+		return;
+	}
+
+	int x1 = dest->x < box->x ? dest->x : box->x;
+	int y1 = dest->y < box->y ? dest->y : box->y;
+	int x2 = dest->x + dest->width > box->x + box->width ?
+		dest->x + dest->width : box->x + box->width;
+	int y2 = dest->y + dest->height > box->y + box->height ?
+		dest->y + dest->height : box->y + box->height;
+
+	*dest = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+}
+
+static const struct wlr_box *scene_tree_get_bounds(struct wlr_scene_tree *tree) {
+	if (!tree->bounds_dirty) {
+		return &tree->bounds;
+	}
+
+	struct wlr_box bounds = {0};
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		if (!child->enabled) {
+			continue;
+		}
+
+		struct wlr_box child_box = {0};
+		if (child->type == WLR_SCENE_NODE_TREE) {
+			child_box = *scene_tree_get_bounds(wlr_scene_tree_from_node(child));
+		} else {
+			scene_node_get_size(child, &child_box.width, &child_box.height);
+		}
+
+		child_box.x += child->x;
+		child_box.y += child->y;
+		box_union(&bounds, &child_box);
+	}
+
+	tree->bounds = bounds;
+	tree->bounds_dirty = false;
+	return &tree->bounds;
+}
+
 typedef bool (*scene_node_box_iterator_func_t)(struct wlr_scene_node *node,
 	int sx, int sy, void *data);
 
 static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
-		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly) {
+		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly,
+		bool cached_trees) {
 	if (!node->enabled) {
 		return false;
 	}
@@ -216,9 +341,23 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:;
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		// Skip the whole subtree if none of its descendants can intersect
+		struct wlr_box bounds = *scene_tree_get_bounds(scene_tree);
+		bounds.x += lx;
+		bounds.y += ly;
+		if (!wlr_box_intersection(&bounds, &bounds, box)) {
+			break;
+		}
+
+		if (cached_trees && scene_tree->cached) {
+			return iterator(node, lx, ly, user_data);
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each_reverse(child, &scene_tree->children, link) {
-			if (_scene_nodes_in_box(child, box, iterator, user_data, lx + child->x, ly + child->y)) {
+			if (_scene_nodes_in_box(child, box, iterator, user_data,
+					lx + child->x, ly + child->y, cached_trees)) {
 				return true;
 			}
 		}
@@ -238,12 +377,18 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	return false;
 }
 
+/**
+ * Call the iterator for each leaf node intersecting the box, from top to
+ * bottom. If cached_trees is true, cached trees are passed to the iterator
+ * as a whole instead of their children.
+ */
 static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
-		scene_node_box_iterator_func_t iterator, void *user_data) {
+		scene_node_box_iterator_func_t iterator, void *user_data,
+		bool cached_trees) {
 	int x, y;
 	wlr_scene_node_coords(node, &x, &y);
 
-	return _scene_nodes_in_box(node, box, iterator, user_data, x, y);
+	return _scene_nodes_in_box(node, box, iterator, user_data, x, y, cached_trees);
 }
 
 static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
@@ -283,9 +428,14 @@ struct scene_update_data {
 	pixman_region32_t *visible;
 	pixman_region32_t *update_region;
 	struct wlr_box update_box;
-	struct wl_list *outputs;
+	struct wlr_scene *scene;
 	bool calculate_visibility;
 
+	// May be NULL. Accumulates the areas which became visible.
+	pixman_region32_t *exposed;
+
+	size_t nodes_visited, nodes_updated;
+
 #if WLR_HAS_XWAYLAND
 	struct wlr_xwayland_surface *restack_above;
 #endif
@@ -358,6 +508,9 @@ static void scene_output_damage(struct wlr_scene_output *scene_output,
 		const pixman_region32_t *damage) {
 	struct wlr_output *output = scene_output->output;
 
+	// Damage means the contents changed, and possibly their opacity too
+	scene_output->render_list_prepared = false;
+
 	pixman_region32_t clipped;
 	pixman_region32_init(&clipped);
 	pixman_region32_intersect_rect(&clipped, damage, 0, 0, output->width, output->height);
@@ -387,6 +540,12 @@ static void scene_damage_outputs(struct wlr_scene *scene, pixman_region32_t *dam
 		return;
 	}
 
+	if (scene->transaction_depth > 0) {
+		pixman_region32_union(&scene->transaction_damage,
+			&scene->transaction_damage, damage);
+		return;
+	}
+
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
 		pixman_region32_t output_damage;
@@ -401,8 +560,67 @@ static void scene_damage_outputs(struct wlr_scene *scene, pixman_region32_t *dam
 	}
 }
 
+void scene_buffer_damage_visible(struct wlr_scene_buffer *scene_buffer) {
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &scene_buffer->node.visible);
+	scene_damage_outputs(scene_node_get_root(&scene_buffer->node), &damage);
+	pixman_region32_fini(&damage);
+}
+
+struct scene_output_box {
+	struct wlr_box box;
+	struct wlr_scene_output *scene_output;
+};
+
+static int scene_output_box_compare(const void *_a, const void *_b) {
+	const struct scene_output_box *a = _a, *b = _b;
+	return (a->box.x > b->box.x) - (a->box.x < b->box.x);
+}
+
+static const struct scene_output_box *scene_get_output_boxes(
+		struct wlr_scene *scene, size_t *len) {
+	if (scene->output_boxes_dirty) {
+		scene->output_boxes.size = 0;
+		scene->output_boxes_max_width = 0;
+
+		struct wlr_scene_output *scene_output;
+		wl_list_for_each(scene_output, &scene->outputs, link) {
+			if (!scene_output->output->enabled) {
+				continue;
+			}
+
+			struct scene_output_box *entry =
+				wl_array_add(&scene->output_boxes, sizeof(*entry));
+			if (entry == NULL) {
+				wlr_log(WLR_ERROR, "Allocation failed");
+				break;
+			}
+
+			*entry = (struct scene_output_box){
+				.box = { .x = scene_output->x, .y = scene_output->y },
+				.scene_output = scene_output,
+			};
+			wlr_output_effective_resolution(scene_output->output,
+				&entry->box.width, &entry->box.height);
+
+			if (entry->box.width > scene->output_boxes_max_width) {
+				scene->output_boxes_max_width = entry->box.width;
+			}
+		}
+
+		qsort(scene->output_boxes.data,
+			scene->output_boxes.size / sizeof(struct scene_output_box),
+			sizeof(struct scene_output_box), scene_output_box_compare);
+		scene->output_boxes_dirty = false;
+	}
+
+	*len = scene->output_boxes.size / sizeof(struct scene_output_box);
+	return scene->output_boxes.data;
+}
+
 static void update_node_update_outputs(struct wlr_scene_node *node,
-		struct wl_list *outputs, struct wlr_scene_output *ignore,
+		struct wlr_scene *scene, struct wlr_scene_output *ignore,
 		struct wlr_scene_output *force) {
 	if (node->type != WLR_SCENE_NODE_BUFFER) {
 		return;
@@ -415,7 +633,8 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 	scene_buffer->primary_output = NULL;
 
 	size_t count = 0;
-	uint64_t active_outputs = 0;
+	struct wl_array active_outputs;
+	wl_array_init(&active_outputs);
 
 	// let's update the outputs in two steps:
 	//  - the primary outputs
@@ -423,90 +642,126 @@ static void update_node_update_outputs(struct wlr_scene_node *node,
 	// This ensures that the enter/leave signals can rely on the primary output
 	// to have a reasonable value. Otherwise, they may get a value that's in
 	// the middle of a calculation.
-	struct wlr_scene_output *scene_output;
-	wl_list_for_each(scene_output, outputs, link) {
-		if (scene_output == ignore) {
-			continue;
+	if (pixman_region32_not_empty(&node->visible)) {
+		const pixman_box32_t *extents = pixman_region32_extents(&node->visible);
+
+		size_t boxes_len;
+		const struct scene_output_box *boxes =
+			scene_get_output_boxes(scene, &boxes_len);
+
+		// Outputs are sorted by x, so only those starting at most one output
+		// width left of the node can intersect it
+		int min_x = extents->x1 - scene->output_boxes_max_width;
+		size_t lo = 0, hi = boxes_len;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (boxes[mid].box.x <= min_x) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
 		}
 
-		if (!scene_output->output->enabled) {
-			continue;
-		}
+		for (size_t i = lo; i < boxes_len && boxes[i].box.x < extents->x2; i++) {
+			const struct wlr_box *output_box = &boxes[i].box;
+			struct wlr_scene_output *scene_output = boxes[i].scene_output;
+			if (scene_output == ignore ||
+					output_box->x + output_box->width <= extents->x1 ||
+					output_box->y >= extents->y2 ||
+					output_box->y + output_box->height <= extents->y1) {
+				continue;
+			}
 
-		struct wlr_box output_box = {
-			.x = scene_output->x,
-			.y = scene_output->y,
-		};
-		wlr_output_effective_resolution(scene_output->output,
-			&output_box.width, &output_box.height);
-
-		pixman_region32_t intersection;
-		pixman_region32_init(&intersection);
-		pixman_region32_intersect_rect(&intersection, &node->visible,
-			output_box.x, output_box.y, output_box.width, output_box.height);
-
-		if (pixman_region32_not_empty(&intersection)) {
-			uint32_t overlap = region_area(&intersection);
-			if (overlap >= largest_overlap) {
-				largest_overlap = overlap;
-				scene_buffer->primary_output = scene_output;
+			pixman_region32_t intersection;
+			pixman_region32_init(&intersection);
+			pixman_region32_intersect_rect(&intersection, &node->visible,
+				output_box->x, output_box->y, output_box->width, output_box->height);
+
+			if (pixman_region32_not_empty(&intersection)) {
+				// Ties go to the output with the highest index
+				uint32_t overlap = region_area(&intersection);
+				if (scene_buffer->primary_output == NULL ||
+						overlap > largest_overlap ||
+						(overlap == largest_overlap &&
+						scene_output->index > scene_buffer->primary_output->index)) {
+					largest_overlap = overlap;
+					scene_buffer->primary_output = scene_output;
+				}
+
+				if (bitset_set(&active_outputs, scene_output->index)) {
+					count++;
+				} else {
+					wlr_log(WLR_ERROR, "Allocation failed");
+				}
 			}
 
-			active_outputs |= 1ull << scene_output->index;
-			count++;
+			pixman_region32_fini(&intersection);
 		}
-
-		pixman_region32_fini(&intersection);
 	}
 
 	if (old_primary_output != scene_buffer->primary_output) {
 		scene_buffer->prev_feedback_options =
 			(struct wlr_linux_dmabuf_feedback_v1_init_options){0};
+
+		wl_list_remove(&scene_buffer->primary_output_link);
+		if (scene_buffer->primary_output != NULL) {
+			wl_list_insert(&scene_buffer->primary_output->primary_buffers,
+				&scene_buffer->primary_output_link);
+		} else {
+			wl_list_init(&scene_buffer->primary_output_link);
+		}
 	}
 
-	uint64_t old_active = scene_buffer->active_outputs;
+	struct wl_array old_active = scene_buffer->active_outputs;
 	scene_buffer->active_outputs = active_outputs;
 
-	wl_list_for_each(scene_output, outputs, link) {
-		uint64_t mask = 1ull << scene_output->index;
-		bool intersects = active_outputs & mask;
-		bool intersects_before = old_active & mask;
-
-		if (intersects && !intersects_before) {
+	for (size_t i = bitset_next_diff(&old_active, &active_outputs, 0);
+			i != BITSET_NONE;
+			i = bitset_next_diff(&old_active, &active_outputs, i + 1)) {
+		struct wlr_scene_output *scene_output = scene_get_output_by_index(scene, i);
+		if (bitset_test(&active_outputs, i)) {
 			wl_signal_emit_mutable(&scene_buffer->events.output_enter, scene_output);
-		} else if (!intersects && intersects_before) {
+		} else {
 			wl_signal_emit_mutable(&scene_buffer->events.output_leave, scene_output);
 		}
 	}
 
 	// if there are active outputs on this node, we should always have a primary
 	// output
-	assert(!scene_buffer->active_outputs || scene_buffer->primary_output);
+	assert(bitset_empty(&scene_buffer->active_outputs) || scene_buffer->primary_output);
 
 	// Skip output update event if nothing was updated
-	if (old_active == active_outputs &&
-			(!force || ((1ull << force->index) & ~active_outputs)) &&
+	if (bitset_equal(&old_active, &active_outputs) &&
+			(!force || !bitset_test(&active_outputs, force->index)) &&
 			old_primary_output == scene_buffer->primary_output) {
+		wl_array_release(&old_active);
 		return;
 	}
+	wl_array_release(&old_active);
+
+	struct wlr_scene_output **outputs_array = NULL;
+	if (count > 0) {
+		outputs_array = calloc(count, sizeof(*outputs_array));
+		if (outputs_array == NULL) {
+			wlr_log(WLR_ERROR, "Allocation failed");
+			return;
+		}
+	}
 
-	struct wlr_scene_output *outputs_array[64];
 	struct wlr_scene_outputs_update_event event = {
 		.active = outputs_array,
 		.size = count,
 	};
 
-	size_t i = 0;
-	wl_list_for_each(scene_output, outputs, link) {
-		if (~active_outputs & (1ull << scene_output->index)) {
-			continue;
-		}
-
-		assert(i < count);
-		outputs_array[i++] = scene_output;
+	size_t n = 0;
+	for (size_t i = bitset_next(&active_outputs, 0); i != BITSET_NONE;
+			i = bitset_next(&active_outputs, i + 1)) {
+		assert(n < count);
+		outputs_array[n++] = scene_get_output_by_index(scene, i);
 	}
 
 	wl_signal_emit_mutable(&scene_buffer->events.outputs_update, &event);
+	free(outputs_array);
 }
 
 #if WLR_HAS_XWAYLAND
@@ -572,6 +827,50 @@ static void restack_xwayland_surface_below(struct wlr_scene_node *node) {
 }
 #endif
 
+// Returns true if the visible region of the node changed
+static bool scene_node_update_visible(struct wlr_scene_node *node,
+		const struct wlr_box *box, struct scene_update_data *data) {
+	// Once everything in the update region is occluded, nodes further down
+	// only need work if they used to be visible inside the update region.
+	// Otherwise their visibility can't have changed.
+	bool occluded = !pixman_region32_not_empty(data->visible);
+	if (occluded && pixman_region32_contains_rectangle(data->update_region,
+			pixman_region32_extents(&node->visible)) == PIXMAN_REGION_OUT) {
+		return false;
+	}
+
+	pixman_region32_t visible;
+	pixman_region32_init(&visible);
+	pixman_region32_subtract(&visible, &node->visible, data->update_region);
+	pixman_region32_union(&visible, &visible, data->visible);
+	pixman_region32_intersect_rect(&visible, &visible,
+		box->x, box->y, box->width, box->height);
+
+	if (data->calculate_visibility && !occluded) {
+		pixman_region32_t opaque;
+		pixman_region32_init(&opaque);
+		scene_node_opaque_region(node, box->x, box->y, &opaque);
+		pixman_region32_subtract(data->visible, data->visible, &opaque);
+		pixman_region32_fini(&opaque);
+	}
+
+	bool changed = !pixman_region32_equal(&visible, &node->visible);
+	if (changed) {
+		if (data->exposed != NULL) {
+			pixman_region32_t exposed;
+			pixman_region32_init(&exposed);
+			pixman_region32_subtract(&exposed, &visible, &node->visible);
+			pixman_region32_union(data->exposed, data->exposed, &exposed);
+			pixman_region32_fini(&exposed);
+		}
+
+		pixman_region32_copy(&node->visible, &visible);
+	}
+
+	pixman_region32_fini(&visible);
+	return changed;
+}
+
 static bool scene_node_update_iterator(struct wlr_scene_node *node,
 		int lx, int ly, void *_data) {
 	struct scene_update_data *data = _data;
@@ -579,20 +878,12 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 	struct wlr_box box = { .x = lx, .y = ly };
 	scene_node_get_size(node, &box.width, &box.height);
 
-	pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
-	pixman_region32_union(&node->visible, &node->visible, data->visible);
-	pixman_region32_intersect_rect(&node->visible, &node->visible,
-		lx, ly, box.width, box.height);
-
-	if (data->calculate_visibility) {
-		pixman_region32_t opaque;
-		pixman_region32_init(&opaque);
-		scene_node_opaque_region(node, lx, ly, &opaque);
-		pixman_region32_subtract(data->visible, data->visible, &opaque);
-		pixman_region32_fini(&opaque);
+	data->nodes_visited++;
+	if (scene_node_update_visible(node, &box, data)) {
+		data->nodes_updated++;
+		update_node_update_outputs(node, data->scene, NULL, NULL);
 	}
 
-	update_node_update_outputs(node, data->outputs, NULL, NULL);
 #if WLR_HAS_XWAYLAND
 	restack_xwayland_surface(node, &box, data);
 #endif
@@ -638,8 +929,10 @@ static void scene_node_bounds(struct wlr_scene_node *node,
 	pixman_region32_union_rect(visible, visible, x, y, width, height);
 }
 
-static void scene_update_region(struct wlr_scene *scene,
-		pixman_region32_t *update_region) {
+static void scene_update_region_exposed(struct wlr_scene *scene,
+		pixman_region32_t *update_region, pixman_region32_t *exposed) {
+	scene->generation++;
+
 	pixman_region32_t visible;
 	pixman_region32_init(&visible);
 	pixman_region32_copy(&visible, update_region);
@@ -654,22 +947,92 @@ static void scene_update_region(struct wlr_scene *scene,
 			.width = region_box->x2 - region_box->x1,
 			.height = region_box->y2 - region_box->y1,
 		},
-		.outputs = &scene->outputs,
+		.scene = scene,
 		.calculate_visibility = scene->calculate_visibility,
+		.exposed = exposed,
 	};
 
 	// update node visibility and output enter/leave events
-	scene_nodes_in_box(&scene->tree.node, &data.update_box, scene_node_update_iterator, &data);
+	scene_nodes_in_box(&scene->tree.node, &data.update_box,
+		scene_node_update_iterator, &data, false);
+
+	scene->stats.visibility_nodes_visited = data.nodes_visited;
+	scene->stats.visibility_nodes_updated = data.nodes_updated;
 
 	pixman_region32_fini(&visible);
 }
 
+static void scene_update_region(struct wlr_scene *scene,
+		pixman_region32_t *update_region) {
+	if (scene->transaction_depth > 0) {
+		scene->generation++;
+		pixman_region32_union(&scene->transaction_update_region,
+			&scene->transaction_update_region, update_region);
+		return;
+	}
+
+	scene_update_region_exposed(scene, update_region, NULL);
+}
+
+void wlr_scene_transaction_begin(struct wlr_scene *scene) {
+	scene->transaction_depth++;
+}
+
+void wlr_scene_transaction_commit(struct wlr_scene *scene) {
+	assert(scene->transaction_depth > 0);
+	scene->transaction_depth--;
+	if (scene->transaction_depth > 0) {
+		return;
+	}
+
+	// Nodes which were visible before the transaction are covered by the
+	// accumulated damage, so we only need to add what became visible.
+	pixman_region32_t exposed;
+	pixman_region32_init(&exposed);
+	if (pixman_region32_not_empty(&scene->transaction_update_region)) {
+		scene_update_region_exposed(scene,
+			&scene->transaction_update_region, &exposed);
+	}
+
+	pixman_region32_union(&exposed, &exposed, &scene->transaction_damage);
+	pixman_region32_clear(&scene->transaction_update_region);
+	pixman_region32_clear(&scene->transaction_damage);
+
+	scene_damage_outputs(scene, &exposed);
+	pixman_region32_fini(&exposed);
+}
+
+static void scene_node_cleanup_when_disabled(struct wlr_scene_node *node,
+		struct wlr_scene *scene) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_cleanup_when_disabled(child, scene);
+		}
+		return;
+	}
+
+	// Disabled nodes are skipped by visibility updates, so make sure they
+	// don't keep a stale visible region and primary output around
+	if (!pixman_region32_not_empty(&node->visible)) {
+		return;
+	}
+
+	pixman_region32_clear(&node->visible);
+	update_node_update_outputs(node, scene, NULL, NULL);
+}
+
 static void scene_node_update(struct wlr_scene_node *node,
 		pixman_region32_t *damage) {
 	struct wlr_scene *scene = scene_node_get_root(node);
 
+	scene_tree_invalidate_bounds(node->parent);
+	scene_node_invalidate_caches(node);
+
 	int x, y;
 	if (!wlr_scene_node_coords(node, &x, &y)) {
+		scene_node_cleanup_when_disabled(node, scene);
 #if WLR_HAS_XWAYLAND
 		restack_xwayland_surface_below(node);
 #endif
@@ -755,6 +1118,13 @@ static void scene_buffer_handle_buffer_release(struct wl_listener *listener,
 
 static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 		struct wlr_buffer *buffer) {
+	int width = buffer != NULL ? buffer->width : 0;
+	int height = buffer != NULL ? buffer->height : 0;
+	if (scene_buffer->buffer_width != width ||
+			scene_buffer->buffer_height != height) {
+		scene_tree_invalidate_bounds(scene_buffer->node.parent);
+	}
+
 	wl_list_remove(&scene_buffer->buffer_release.link);
 	wl_list_init(&scene_buffer->buffer_release.link);
 	if (scene_buffer->own_buffer) {
@@ -766,6 +1136,7 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	scene_buffer->buffer_is_opaque = false;
 
 	if (!buffer) {
+		scene_buffer_reset_scanned_opaque(scene_buffer);
 		return;
 	}
 
@@ -783,6 +1154,10 @@ static void scene_buffer_handle_renderer_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_scene_buffer *scene_buffer = wl_container_of(listener, scene_buffer, renderer_destroy);
 	scene_buffer_set_texture(scene_buffer, NULL);
+
+	// The node may have become invisible
+	scene_node_get_root(&scene_buffer->node)->generation++;
+	scene_node_invalidate_caches(&scene_buffer->node);
 }
 
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
@@ -826,11 +1201,17 @@ struct wlr_scene_buffer *wlr_scene_buffer_create(struct wlr_scene_tree *parent,
 	wl_signal_init(&scene_buffer->events.output_sample);
 	wl_signal_init(&scene_buffer->events.frame_done);
 	pixman_region32_init(&scene_buffer->opaque_region);
+	pixman_region32_init(&scene_buffer->scanned_opaque);
+	pixman_region32_init(&scene_buffer->scan_pending);
+	wl_array_init(&scene_buffer->active_outputs);
+	wl_list_init(&scene_buffer->primary_output_link);
 	wl_list_init(&scene_buffer->buffer_release.link);
 	wl_list_init(&scene_buffer->renderer_destroy.link);
+	wl_list_init(&scene_buffer->texture_link);
 	scene_buffer->opacity = 1;
 
 	scene_buffer_set_buffer(scene_buffer, buffer);
+	scene_buffer_update_texture_link(scene_buffer);
 	scene_node_update(&scene_buffer->node, NULL);
 
 	return scene_buffer;
@@ -867,8 +1248,11 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 
 	scene_buffer_set_buffer(scene_buffer, buffer);
 	scene_buffer_set_texture(scene_buffer, NULL);
+	// A client buffer may keep its texture across commits
+	scene_buffer_update_texture_link(scene_buffer);
 	scene_buffer_set_wait_timeline(scene_buffer,
 		options->wait_timeline, options->wait_point);
+	scene_node_invalidate_caches(&scene_buffer->node);
 
 	if (update) {
 		scene_node_update(&scene_buffer->node, NULL);
@@ -918,6 +1302,26 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 	pixman_region32_translate(&trans_damage, -box.x, -box.y);
 
 	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+	if (scene->transaction_depth > 0) {
+		// The visible region of the node is only known once the transaction
+		// is committed: record the damage in scene coordinates instead, and
+		// let the commit damage the outputs
+		pixman_region32_t scene_damage;
+		pixman_region32_init(&scene_damage);
+		wlr_region_scale_xy(&scene_damage, &trans_damage, scale_x, scale_y);
+		// Linear filtering may bleed into adjacent pixels, see below
+		float max_scale = scale_x >= scale_y ? scale_x : scale_y;
+		int dist = (int)ceilf(max_scale / 2.0f);
+		wlr_region_expand(&scene_damage, &scene_damage, dist >= 1 ? dist : 1);
+		pixman_region32_translate(&scene_damage, lx, ly);
+		scene_damage_outputs(scene, &scene_damage);
+		pixman_region32_fini(&scene_damage);
+
+		pixman_region32_fini(&trans_damage);
+		pixman_region32_fini(&fallback_damage);
+		return;
+	}
+
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
 		float output_scale = scene_output->output->scale;
@@ -1063,7 +1467,7 @@ void wlr_scene_buffer_set_filter_mode(struct wlr_scene_buffer *scene_buffer,
 	scene_node_update(&scene_buffer->node, NULL);
 }
 
-static struct wlr_texture *scene_buffer_get_texture(
+static struct wlr_texture *scene_buffer_create_texture(
 		struct wlr_scene_buffer *scene_buffer, struct wlr_renderer *renderer) {
 	if (scene_buffer->buffer == NULL || scene_buffer->texture != NULL) {
 		return scene_buffer->texture;
@@ -1072,7 +1476,8 @@ static struct wlr_texture *scene_buffer_get_texture(
 	struct wlr_client_buffer *client_buffer =
 		wlr_client_buffer_get(scene_buffer->buffer);
 	if (client_buffer != NULL) {
-		return client_buffer->texture;
+		// Deferred uploads happen here, once the buffer is visible
+		return wlr_client_buffer_get_texture(client_buffer);
 	}
 
 	struct wlr_texture *texture =
@@ -1081,8 +1486,471 @@ static struct wlr_texture *scene_buffer_get_texture(
 		scene_buffer->own_buffer = false;
 		wlr_buffer_unlock(scene_buffer->buffer);
 	}
-	scene_buffer_set_texture(scene_buffer, texture);
-	return texture;
+	scene_buffer_set_texture(scene_buffer, texture);
+	return texture;
+}
+
+static struct wlr_texture *scene_buffer_get_texture(
+		struct wlr_scene_buffer *scene_buffer, struct wlr_renderer *renderer) {
+	struct wlr_texture *texture =
+		scene_buffer_create_texture(scene_buffer, renderer);
+	if (texture != NULL) {
+		// Mark the texture as most recently used
+		struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+		wl_list_remove(&scene_buffer->texture_link);
+		wl_list_insert(&scene->textures, &scene_buffer->texture_link);
+	}
+	return texture;
+}
+
+// Get the texture currently held for the scene buffer, without uploading
+static struct wlr_texture *scene_buffer_get_resident_texture(
+		struct wlr_scene_buffer *scene_buffer) {
+	if (scene_buffer->texture != NULL || scene_buffer->buffer == NULL) {
+		return scene_buffer->texture;
+	}
+	struct wlr_client_buffer *client_buffer =
+		wlr_client_buffer_get(scene_buffer->buffer);
+	if (client_buffer != NULL) {
+		return client_buffer->texture;
+	}
+	return NULL;
+}
+
+/**
+ * Keep the scene buffer in the texture LRU list as long as it holds a
+ * texture. Newly linked scene buffers haven't been rendered yet, so they are
+ * considered least recently used.
+ */
+static void scene_buffer_update_texture_link(struct wlr_scene_buffer *scene_buffer) {
+	if (scene_buffer_get_resident_texture(scene_buffer) == NULL) {
+		wl_list_remove(&scene_buffer->texture_link);
+		wl_list_init(&scene_buffer->texture_link);
+	} else if (wl_list_empty(&scene_buffer->texture_link)) {
+		struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+		wl_list_insert(scene->textures.prev, &scene_buffer->texture_link);
+	}
+}
+
+/**
+ * Check whether a scene buffer used more recently than scene_buffer holds the
+ * same texture. Scene buffers showing the same client buffer share its
+ * texture, which must only be accounted once.
+ */
+static bool scene_texture_used_before(struct wlr_scene *scene,
+		struct wlr_scene_buffer *scene_buffer, struct wlr_texture *texture) {
+	if (scene_buffer->texture == texture) {
+		// Not a client buffer texture, only held by this scene buffer
+		return false;
+	}
+
+	struct wlr_scene_buffer *other;
+	wl_list_for_each(other, &scene->textures, texture_link) {
+		if (other == scene_buffer) {
+			return false;
+		}
+		if (scene_buffer_get_resident_texture(other) == texture) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether any scene buffer holding the texture is visible on an output
+static bool scene_texture_is_visible(struct wlr_scene *scene,
+		struct wlr_texture *texture) {
+	struct wlr_scene_buffer *scene_buffer;
+	wl_list_for_each(scene_buffer, &scene->textures, texture_link) {
+		if (scene_buffer->primary_output != NULL &&
+				scene_buffer_get_resident_texture(scene_buffer) == texture) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t texture_get_size(struct wlr_texture *texture) {
+	return (size_t)texture->width * texture->height * 4;
+}
+
+// Maximum number of textures evicted per event loop iteration, since each
+// eviction may have to wait for a read-back
+#define TEXTURE_EVICTIONS_PER_IDLE 4
+
+// Whether the texture of the scene buffer is being read back before eviction
+static bool scene_buffer_is_evicting(struct wlr_scene_buffer *scene_buffer) {
+	if (scene_buffer->buffer == NULL) {
+		return false;
+	}
+	struct wlr_client_buffer *client_buffer =
+		wlr_client_buffer_get(scene_buffer->buffer);
+	return client_buffer != NULL && client_buffer->evict_request != NULL;
+}
+
+static bool scene_buffer_evict_texture(struct wlr_scene_buffer *scene_buffer,
+		struct wl_event_loop *loop) {
+	if (scene_buffer->buffer == NULL) {
+		// The texture holds the only copy of the contents
+		return false;
+	}
+
+	struct wlr_client_buffer *client_buffer =
+		wlr_client_buffer_get(scene_buffer->buffer);
+	if (client_buffer != NULL) {
+		// The buffer stays in the LRU list while the texture is read back,
+		// in case the eviction is cancelled
+		if (!wlr_client_buffer_evict_texture(client_buffer, loop)) {
+			return false;
+		}
+		scene_buffer_update_texture_link(scene_buffer);
+		return true;
+	} else if (scene_buffer->texture != NULL) {
+		// The buffer hasn't been released yet: keep it around to re-create
+		// the texture
+		if (!scene_buffer->own_buffer) {
+			scene_buffer->own_buffer = true;
+			wlr_buffer_lock(scene_buffer->buffer);
+		}
+		scene_buffer_set_texture(scene_buffer, NULL);
+	} else {
+		return false;
+	}
+
+	wl_list_remove(&scene_buffer->texture_link);
+	wl_list_init(&scene_buffer->texture_link);
+	return true;
+}
+
+/**
+ * Evict textures of scene buffers which aren't visible on any output, least
+ * recently used first, until the renderer's texture budget is met. At most
+ * TEXTURE_EVICTIONS_PER_IDLE textures are evicted per call.
+ */
+static void scene_enforce_texture_budget(struct wlr_scene *scene,
+		struct wlr_renderer *renderer, struct wl_event_loop *loop) {
+	if (renderer->texture_budget == 0) {
+		return;
+	}
+
+	// Textures being read back are about to be freed
+	size_t usage = 0;
+	struct wlr_scene_buffer *scene_buffer, *tmp;
+	wl_list_for_each(scene_buffer, &scene->textures, texture_link) {
+		struct wlr_texture *texture =
+			scene_buffer_get_resident_texture(scene_buffer);
+		if (texture != NULL && texture->renderer == renderer &&
+				!scene_buffer_is_evicting(scene_buffer) &&
+				!scene_texture_used_before(scene, scene_buffer, texture)) {
+			usage += texture_get_size(texture);
+		}
+	}
+
+	int evictions = 0;
+	wl_list_for_each_reverse_safe(scene_buffer, tmp, &scene->textures, texture_link) {
+		if (usage <= renderer->texture_budget ||
+				evictions == TEXTURE_EVICTIONS_PER_IDLE) {
+			break;
+		}
+
+		struct wlr_texture *texture =
+			scene_buffer_get_resident_texture(scene_buffer);
+		if (texture == NULL) {
+			// Evicted after an asynchronous read-back
+			wl_list_remove(&scene_buffer->texture_link);
+			wl_list_init(&scene_buffer->texture_link);
+			continue;
+		}
+		// The texture is accounted for the most recently used scene buffer
+		// holding it, and mustn't be evicted while any of them is visible
+		if (texture->renderer != renderer ||
+				scene_buffer_is_evicting(scene_buffer) ||
+				scene_texture_used_before(scene, scene_buffer, texture) ||
+				scene_texture_is_visible(scene, texture)) {
+			continue;
+		}
+
+		size_t size = texture_get_size(texture);
+		if (scene_buffer_evict_texture(scene_buffer, loop)) {
+			usage -= size;
+			evictions++;
+			scene->texture_stats.textures_evicted++;
+			scene->texture_stats.bytes_evicted += size;
+		}
+	}
+}
+
+static void scene_handle_texture_budget_idle(void *data) {
+	struct wlr_scene *scene = data;
+	scene->texture_budget_idle = NULL;
+
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		struct wlr_output *output = scene_output->output;
+		if (output->renderer == NULL) {
+			continue;
+		}
+
+		// Only enforce the budget once per renderer
+		bool seen = false;
+		struct wlr_scene_output *prev;
+		wl_list_for_each(prev, &scene->outputs, link) {
+			if (prev == scene_output) {
+				break;
+			}
+			if (prev->output->renderer == output->renderer) {
+				seen = true;
+				break;
+			}
+		}
+		if (!seen) {
+			scene_enforce_texture_budget(scene, output->renderer,
+				output->event_loop);
+		}
+	}
+}
+
+/**
+ * Enforce texture budgets once the current frames are done, so that evictions
+ * don't delay them.
+ */
+static void scene_schedule_texture_budget(struct wlr_scene *scene,
+		struct wlr_output *output) {
+	if (output->renderer->texture_budget == 0 ||
+			scene->texture_budget_idle != NULL) {
+		return;
+	}
+	scene->texture_budget_idle = wl_event_loop_add_idle(output->event_loop,
+		scene_handle_texture_budget_idle, scene);
+}
+
+size_t wlr_scene_get_client_texture_memory(struct wlr_scene *scene,
+		struct wl_client *client) {
+	size_t usage = 0;
+	struct wlr_scene_buffer *scene_buffer;
+	wl_list_for_each(scene_buffer, &scene->textures, texture_link) {
+		struct wlr_scene_surface *scene_surface =
+			wlr_scene_surface_try_from_buffer(scene_buffer);
+		if (scene_surface == NULL ||
+				wl_resource_get_client(scene_surface->surface->resource) != client) {
+			continue;
+		}
+		struct wlr_texture *texture =
+			scene_buffer_get_resident_texture(scene_buffer);
+		if (texture != NULL &&
+				!scene_texture_used_before(scene, scene_buffer, texture)) {
+			usage += texture_get_size(texture);
+		}
+	}
+	return usage;
+}
+
+static void scene_tree_handle_cache_renderer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_tree *tree = wl_container_of(listener, tree, cache_renderer_destroy);
+	scene_tree_cache_finish(tree);
+}
+
+static void scene_tree_set_cache_texture(struct wlr_scene_tree *tree,
+		struct wlr_texture *texture) {
+	wl_list_remove(&tree->cache_renderer_destroy.link);
+	wlr_texture_destroy(tree->cache_texture);
+	tree->cache_texture = texture;
+
+	if (texture != NULL) {
+		tree->cache_renderer_destroy.notify = scene_tree_handle_cache_renderer_destroy;
+		wl_signal_add(&texture->renderer->events.destroy, &tree->cache_renderer_destroy);
+	} else {
+		wl_list_init(&tree->cache_renderer_destroy.link);
+	}
+}
+
+static void scene_tree_cache_finish(struct wlr_scene_tree *tree) {
+	scene_tree_set_cache_texture(tree, NULL);
+	wlr_buffer_drop(tree->cache_buffer);
+	tree->cache_buffer = NULL;
+	tree->cache_dirty = true;
+}
+
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached) {
+	if (tree->cached == cached) {
+		return;
+	}
+
+	tree->cached = cached;
+	if (!cached) {
+		scene_tree_cache_finish(tree);
+	}
+
+	// The tree is now rendered differently, but the result is the same
+	scene_node_get_root(&tree->node)->generation++;
+}
+
+struct scene_tree_cache_render_data {
+	struct wlr_render_pass *render_pass;
+	struct wlr_scene_output *output;
+	float scale;
+};
+
+static void scene_tree_cache_render_node(struct wlr_scene_node *node,
+		int x, int y, const struct scene_tree_cache_render_data *data) {
+	if (!node->enabled) {
+		return;
+	}
+
+	x += node->x;
+	y += node->y;
+
+	struct wlr_box dst_box = { .x = x, .y = y };
+	scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	scale_box(&dst_box, data->scale);
+
+	switch (node->type) {
+	case WLR_SCENE_NODE_TREE:;
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_tree_cache_render_node(child, x, y, data);
+		}
+		break;
+	case WLR_SCENE_NODE_RECT:;
+		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
+
+		wlr_render_pass_add_rect(data->render_pass, &(struct wlr_render_rect_options){
+			.box = dst_box,
+			.color = {
+				.r = scene_rect->color[0],
+				.g = scene_rect->color[1],
+				.b = scene_rect->color[2],
+				.a = scene_rect->color[3],
+			},
+		});
+		break;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+
+		struct wlr_texture *texture = scene_buffer_get_texture(scene_buffer,
+			data->output->output->renderer);
+		if (texture == NULL) {
+			break;
+		}
+
+		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+			.texture = texture,
+			.src_box = scene_buffer->src_box,
+			.dst_box = dst_box,
+			.transform = wlr_output_transform_invert(scene_buffer->transform),
+			.alpha = &scene_buffer->opacity,
+			.filter_mode = scene_buffer->filter_mode,
+			.wait_timeline = scene_buffer->wait_timeline,
+			.wait_point = scene_buffer->wait_point,
+		});
+
+		struct wlr_scene_output_sample_event sample_event = {
+			.output = data->output,
+			.direct_scanout = false,
+		};
+		wl_signal_emit_mutable(&scene_buffer->events.output_sample, &sample_event);
+		break;
+	}
+}
+
+/**
+ * Get the cached contents of a tree, or NULL if they are out of date. The
+ * texture covers the tree bounds, untransformed and multiplied by the given
+ * scale.
+ */
+static struct wlr_texture *scene_tree_get_cache(struct wlr_scene_tree *tree,
+		struct wlr_renderer *renderer, float scale) {
+	if (!tree->cache_dirty && tree->cache_texture != NULL &&
+			tree->cache_texture->renderer == renderer && tree->cache_scale == scale) {
+		return tree->cache_texture;
+	}
+	return NULL;
+}
+
+/**
+ * Render the contents of a tree into its cache, if they are out of date. This
+ * uses a render pass of its own, so it must not be called while another one
+ * is in progress.
+ */
+static void scene_tree_update_cache(struct wlr_scene_tree *tree,
+		struct wlr_scene_output *scene_output, float scale) {
+	struct wlr_output *output = scene_output->output;
+	struct wlr_renderer *renderer = output->renderer;
+
+	if (scene_tree_get_cache(tree, renderer, scale) != NULL) {
+		return;
+	}
+
+	const struct wlr_box *bounds = scene_tree_get_bounds(tree);
+	struct wlr_box cache_box = { .width = bounds->width, .height = bounds->height };
+	scale_box(&cache_box, scale);
+	if (wlr_box_empty(&cache_box)) {
+		return;
+	}
+
+	if (tree->cache_buffer != NULL && (tree->cache_buffer->width != cache_box.width ||
+			tree->cache_buffer->height != cache_box.height ||
+			(tree->cache_texture != NULL && tree->cache_texture->renderer != renderer))) {
+		scene_tree_cache_finish(tree);
+	}
+
+	if (tree->cache_buffer == NULL) {
+		struct wlr_drm_format format = {0};
+		if (!output_pick_format(output, NULL, &format, DRM_FORMAT_ARGB8888)) {
+			wlr_log(WLR_DEBUG, "Failed to pick scene tree cache format");
+			return;
+		}
+
+		tree->cache_buffer = wlr_allocator_create_buffer(output->allocator,
+			cache_box.width, cache_box.height, &format);
+		wlr_drm_format_finish(&format);
+		if (tree->cache_buffer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to allocate scene tree cache buffer");
+			return;
+		}
+	}
+
+	// The texture is imported again once the buffer has been rendered
+	scene_tree_set_cache_texture(tree, NULL);
+
+	struct wlr_render_pass *render_pass =
+		wlr_renderer_begin_buffer_pass(renderer, tree->cache_buffer, NULL);
+	if (render_pass == NULL) {
+		scene_tree_cache_finish(tree);
+		return;
+	}
+
+	wlr_render_pass_add_rect(render_pass, &(struct wlr_render_rect_options){
+		.box = cache_box,
+		.color = { 0, 0, 0, 0 },
+		.blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+	});
+
+	struct scene_tree_cache_render_data data = {
+		.render_pass = render_pass,
+		.output = scene_output,
+		.scale = scale,
+	};
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		scene_tree_cache_render_node(child, -bounds->x, -bounds->y, &data);
+	}
+
+	if (!wlr_render_pass_submit(render_pass)) {
+		scene_tree_cache_finish(tree);
+		return;
+	}
+
+	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, tree->cache_buffer);
+	if (texture == NULL) {
+		scene_tree_cache_finish(tree);
+		return;
+	}
+
+	scene_tree_set_cache_texture(tree, texture);
+	tree->cache_scale = scale;
+	tree->cache_dirty = false;
 }
 
 static void scene_node_get_size(struct wlr_scene_node *node,
@@ -1206,6 +2074,8 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 		scene_node_visibility(node, &visible);
 	}
 
+	scene_tree_invalidate_bounds(node->parent);
+	scene_node_invalidate_caches(node);
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
@@ -1303,7 +2173,7 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 		.ly = ly
 	};
 
-	if (scene_nodes_in_box(node, &box, scene_node_at_iterator, &data)) {
+	if (scene_nodes_in_box(node, &box, scene_node_at_iterator, &data, false)) {
 		if (nx) {
 			*nx = data.rx;
 		}
@@ -1328,7 +2198,11 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 
 	pixman_region32_t render_region;
 	pixman_region32_init(&render_region);
-	pixman_region32_copy(&render_region, &node->visible);
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		scene_node_visibility(node, &render_region);
+	} else {
+		pixman_region32_copy(&render_region, &node->visible);
+	}
 	pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
 	logical_to_buffer_coords(&render_region, data);
 	pixman_region32_intersect(&render_region, &render_region, &data->damage);
@@ -1344,7 +2218,16 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		.x = x,
 		.y = y,
 	};
-	scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		const struct wlr_box *bounds =
+			scene_tree_get_bounds(wlr_scene_tree_from_node(node));
+		dst_box.x += bounds->x;
+		dst_box.y += bounds->y;
+		dst_box.width = bounds->width;
+		dst_box.height = bounds->height;
+	} else {
+		scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	}
 	transform_output_box(&dst_box, data);
 
 	pixman_region32_t opaque;
@@ -1354,8 +2237,22 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 	pixman_region32_subtract(&opaque, &render_region, &opaque);
 
 	switch (node->type) {
-	case WLR_SCENE_NODE_TREE:
-		assert(false);
+	case WLR_SCENE_NODE_TREE:;
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		struct wlr_texture *cache = scene_tree_get_cache(scene_tree,
+			data->output->output->renderer, data->scale);
+		if (cache == NULL) {
+			scene_output_damage(data->output, &render_region);
+			break;
+		}
+
+		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+			.texture = cache,
+			.dst_box = dst_box,
+			.transform = data->transform,
+			.clip = &render_region,
+		});
 		break;
 	case WLR_SCENE_NODE_RECT:;
 		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
@@ -1496,26 +2393,28 @@ static const struct wlr_addon_interface output_addon_impl = {
 };
 
 static void scene_node_output_update(struct wlr_scene_node *node,
-		struct wl_list *outputs, struct wlr_scene_output *ignore,
+		struct wlr_scene *scene, struct wlr_scene_output *ignore,
 		struct wlr_scene_output *force) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_output_update(child, outputs, ignore, force);
+			scene_node_output_update(child, scene, ignore, force);
 		}
 		return;
 	}
 
-	update_node_update_outputs(node, outputs, ignore, force);
+	update_node_update_outputs(node, scene, ignore, force);
 }
 
 static void scene_output_update_geometry(struct wlr_scene_output *scene_output,
 		bool force_update) {
 	scene_output_damage_whole(scene_output);
+	scene_output->render_list_generation = 0;
+	scene_output->scene->output_boxes_dirty = true;
 
 	scene_node_output_update(&scene_output->scene->tree.node,
-			&scene_output->scene->outputs, NULL, force_update ? scene_output : NULL);
+			scene_output->scene, NULL, force_update ? scene_output : NULL);
 }
 
 static void scene_output_handle_commit(struct wl_listener *listener, void *data) {
@@ -1597,18 +2496,21 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 
 	wlr_damage_ring_init(&scene_output->damage_ring);
 	pixman_region32_init(&scene_output->pending_commit_damage);
+	pixman_region32_init(&scene_output->render_list_opaque);
 	wl_list_init(&scene_output->damage_highlight_regions);
+	wl_list_init(&scene_output->primary_buffers);
 
-	int prev_output_index = -1;
+	// Pick the lowest free index, keeping the list sorted by index
+	size_t output_index = 0;
 	struct wl_list *prev_output_link = &scene->outputs;
 
 	struct wlr_scene_output *current_output;
 	wl_list_for_each(current_output, &scene->outputs, link) {
-		if (prev_output_index + 1 != current_output->index) {
+		if (output_index != current_output->index) {
 			break;
 		}
 
-		prev_output_index = current_output->index;
+		output_index = current_output->index + 1;
 		prev_output_link = &current_output->link;
 	}
 
@@ -1617,13 +2519,16 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 			output->renderer != NULL && output->renderer->features.timeline) {
 		scene_output->in_timeline = wlr_drm_syncobj_timeline_create(drm_fd);
 		if (scene_output->in_timeline == NULL) {
-			return NULL;
+			goto error;
 		}
 	}
 
-	scene_output->index = prev_output_index + 1;
-	assert(scene_output->index < 64);
+	scene_output->index = output_index;
+	if (!scene_set_output_by_index(scene, scene_output)) {
+		goto error;
+	}
 	wl_list_insert(prev_output_link, &scene_output->link);
+	scene->output_boxes_dirty = true;
 
 	wl_signal_init(&scene_output->events.destroy);
 
@@ -1639,6 +2544,15 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 	scene_output_update_geometry(scene_output, false);
 
 	return scene_output;
+
+error:
+	wlr_drm_syncobj_timeline_unref(scene_output->in_timeline);
+	pixman_region32_fini(&scene_output->render_list_opaque);
+	pixman_region32_fini(&scene_output->pending_commit_damage);
+	wlr_damage_ring_finish(&scene_output->damage_ring);
+	wlr_addon_finish(&scene_output->addon);
+	free(scene_output);
+	return NULL;
 }
 
 static void highlight_region_destroy(struct highlight_region *damage) {
@@ -1655,7 +2569,12 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 	wl_signal_emit_mutable(&scene_output->events.destroy, NULL);
 
 	scene_node_output_update(&scene_output->scene->tree.node,
-		&scene_output->scene->outputs, scene_output, NULL);
+		scene_output->scene, scene_output, NULL);
+	assert(wl_list_empty(&scene_output->primary_buffers));
+
+	struct wlr_scene_output **by_index = scene_output->scene->outputs_by_index.data;
+	by_index[scene_output->index] = NULL;
+	scene_output->scene->output_boxes_dirty = true;
 
 	struct highlight_region *damage, *tmp_damage;
 	wl_list_for_each_safe(damage, tmp_damage, &scene_output->damage_highlight_regions, link) {
@@ -1666,11 +2585,25 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 	wlr_damage_ring_finish(&scene_output->damage_ring);
 	pixman_region32_fini(&scene_output->pending_commit_damage);
 	wl_list_remove(&scene_output->link);
+	if (wl_list_empty(&scene_output->scene->outputs) &&
+			scene_output->scene->texture_budget_idle != NULL) {
+		// The idle source belongs to the event loop of the outputs
+		wl_event_source_remove(scene_output->scene->texture_budget_idle);
+		scene_output->scene->texture_budget_idle = NULL;
+	}
 	wl_list_remove(&scene_output->output_commit.link);
 	wl_list_remove(&scene_output->output_damage.link);
 	wl_list_remove(&scene_output->output_needs_frame.link);
 	wlr_drm_syncobj_timeline_unref(scene_output->in_timeline);
 	wl_array_release(&scene_output->render_list);
+	pixman_region32_fini(&scene_output->render_list_opaque);
+
+	struct wlr_output_layer_state *layer_state;
+	wl_array_for_each(layer_state, &scene_output->layers) {
+		wlr_output_layer_destroy(layer_state->layer);
+	}
+	wl_array_release(&scene_output->layers);
+
 	free(scene_output);
 }
 
@@ -1700,7 +2633,8 @@ void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 
 static bool scene_node_invisible(struct wlr_scene_node *node) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
-		return true;
+		// Only cached trees are rendered as a whole
+		return !wlr_scene_tree_from_node(node)->cached;
 	} else if (node->type == WLR_SCENE_NODE_RECT) {
 		struct wlr_scene_rect *rect = wlr_scene_rect_from_node(node);
 
@@ -1746,7 +2680,12 @@ static bool construct_render_list_iterator(struct wlr_scene_node *node,
 
 	pixman_region32_t intersection;
 	pixman_region32_init(&intersection);
-	pixman_region32_intersect_rect(&intersection, &node->visible,
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		scene_node_visibility(node, &intersection);
+	} else {
+		pixman_region32_copy(&intersection, &node->visible);
+	}
+	pixman_region32_intersect_rect(&intersection, &intersection,
 			data->box.x, data->box.y,
 			data->box.width, data->box.height);
 	if (!pixman_region32_not_empty(&intersection)) {
@@ -1892,6 +2831,187 @@ static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 	return true;
 }
 
+static bool scene_output_ensure_layers(struct wlr_scene_output *scene_output) {
+	if (scene_output->layers.size > 0) {
+		return true;
+	}
+
+	struct wlr_output_layer_state *layer_states = wl_array_add(&scene_output->layers,
+		SCENE_OUTPUT_MAX_LAYERS * sizeof(*layer_states));
+	if (layer_states == NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < SCENE_OUTPUT_MAX_LAYERS; i++) {
+		struct wlr_output_layer *layer = wlr_output_layer_create(scene_output->output);
+		if (layer == NULL) {
+			for (size_t j = 0; j < i; j++) {
+				wlr_output_layer_destroy(layer_states[j].layer);
+			}
+			wl_array_release(&scene_output->layers);
+			wl_array_init(&scene_output->layers);
+			return false;
+		}
+
+		layer_states[i] = (struct wlr_output_layer_state){ .layer = layer };
+	}
+
+	return true;
+}
+
+static void scene_output_state_disable_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state) {
+	if (scene_output->layers.size == 0) {
+		return;
+	}
+
+	// Backends require the state of all layers on every commit touching them
+	struct wlr_output_layer_state *layer_state;
+	wl_array_for_each(layer_state, &scene_output->layers) {
+		*layer_state = (struct wlr_output_layer_state){ .layer = layer_state->layer };
+	}
+
+	wlr_output_state_set_layers(state, scene_output->layers.data,
+		scene_output->layers.size / sizeof(*layer_state));
+}
+
+static bool scene_entry_can_offload(struct render_list_entry *entry,
+		const struct render_data *data) {
+	if (entry->node->type != WLR_SCENE_NODE_BUFFER ||
+			entry->highlight_transparent_region) {
+		return false;
+	}
+
+	// Nodes partially covered by something left out of the render list (e.g.
+	// a black rect) would be displayed above it
+	struct wlr_box node_box = { .x = entry->x, .y = entry->y };
+	scene_node_get_size(entry->node, &node_box.width, &node_box.height);
+	pixman_box32_t node_extents = {
+		.x1 = node_box.x,
+		.y1 = node_box.y,
+		.x2 = node_box.x + node_box.width,
+		.y2 = node_box.y + node_box.height,
+	};
+	if (pixman_region32_contains_rectangle(&entry->node->visible,
+			&node_extents) != PIXMAN_REGION_IN) {
+		return false;
+	}
+
+	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
+
+	// Output layers can't express opacity, transforms or explicit sync
+	return buffer->buffer != NULL && buffer->opacity == 1 &&
+		buffer->transform == data->transform && buffer->wait_timeline == NULL;
+}
+
+/**
+ * Try to display the topmost entries of the render list on output layers.
+ * The configuration is tested along with the primary buffer the rest of the
+ * list will be composited into. Returns the number of entries which don't need
+ * to be composited.
+ */
+static int scene_output_offload_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, struct render_list_entry *list_data,
+		int list_len, struct wlr_buffer *primary_buffer,
+		const struct render_data *data) {
+	if (state->committed & (WLR_OUTPUT_STATE_MODE |
+			WLR_OUTPUT_STATE_ENABLED |
+			WLR_OUTPUT_STATE_RENDER_FORMAT)) {
+		return 0;
+	}
+
+	// Software cursors are composited and would end up below the layers
+	if (!wlr_output_is_direct_scanout_allowed(scene_output->output)) {
+		return 0;
+	}
+
+	// Only a contiguous run of entries at the top of the stack can be
+	// offloaded, since the layers are displayed above the composited buffer
+	int candidates = 0;
+	while (candidates < list_len && candidates < SCENE_OUTPUT_MAX_LAYERS &&
+			scene_entry_can_offload(&list_data[candidates], data)) {
+		candidates++;
+	}
+	if (candidates == 0 || !scene_output_ensure_layers(scene_output)) {
+		return 0;
+	}
+
+	struct wlr_output_layer_state *layer_states = scene_output->layers.data;
+	size_t layers_len = scene_output->layers.size / sizeof(*layer_states);
+
+	// The layers may have just been created, after the state was set up
+	wlr_output_state_set_layers(state, layer_states, layers_len);
+
+	// Layers are ordered from bottom to top, the render list from top to
+	// bottom
+	for (int i = 0; i < candidates; i++) {
+		struct render_list_entry *entry = &list_data[i];
+		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
+
+		struct wlr_box dst_box = {
+			.x = entry->x - data->logical.x,
+			.y = entry->y - data->logical.y,
+		};
+		scene_node_get_size(entry->node, &dst_box.width, &dst_box.height);
+		transform_output_box(&dst_box, data);
+
+		struct wlr_output_layer_state *layer_state = &layer_states[layers_len - 1 - i];
+		layer_state->buffer = buffer->buffer;
+		layer_state->src_box = buffer->src_box;
+		layer_state->dst_box = dst_box;
+	}
+
+	int offloaded = 0;
+	while (candidates > 0) {
+		struct wlr_output_state pending;
+		wlr_output_state_init(&pending);
+		if (!wlr_output_state_copy(&pending, state)) {
+			return 0;
+		}
+		wlr_output_state_set_buffer(&pending, primary_buffer);
+
+		bool ok = wlr_output_test_state(scene_output->output, &pending);
+		wlr_output_state_finish(&pending);
+		if (!ok) {
+			return 0;
+		}
+
+		offloaded = 0;
+		while (offloaded < candidates &&
+				layer_states[layers_len - 1 - offloaded].accepted) {
+			offloaded++;
+		}
+		if (offloaded == candidates) {
+			break;
+		}
+
+		// Entries below a rejected one can't stay on a layer, since they'd be
+		// displayed above it. Drop them and test the remaining configuration.
+		for (int i = offloaded; i < candidates; i++) {
+			struct wlr_output_layer_state *layer_state = &layer_states[layers_len - 1 - i];
+			*layer_state = (struct wlr_output_layer_state){ .layer = layer_state->layer };
+		}
+		candidates = offloaded;
+	}
+
+	for (int i = 0; i < offloaded; i++) {
+		// A layer which moved leaves stale contents in the composited buffer
+		struct wlr_output_layer_state *layer_state = &layer_states[layers_len - 1 - i];
+		if (!wlr_box_equal(&layer_state->dst_box, &layer_state->layer->dst_box)) {
+			scene_output_damage_whole(scene_output);
+		}
+
+		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(list_data[i].node);
+		struct wlr_scene_output_sample_event sample_event = {
+			.output = scene_output,
+			.direct_scanout = true,
+		};
+		wl_signal_emit_mutable(&buffer->events.output_sample, &sample_event);
+	}
+
+	return offloaded;
+}
+
 bool wlr_scene_output_needs_frame(struct wlr_scene_output *scene_output) {
 	return scene_output->output->needs_frame || pixman_region32_not_empty(
 		&scene_output->pending_commit_damage) || scene_output->gamma_lut_changed;
@@ -1949,6 +3069,176 @@ static void scene_output_state_attempt_gamma(struct wlr_scene_output *scene_outp
 	wlr_output_state_finish(&gamma_pending);
 }
 
+static void scene_output_init_render_data(struct wlr_scene_output *scene_output,
+		const struct wlr_output_state *state, struct render_data *data) {
+	struct wlr_output *output = scene_output->output;
+
+	*data = (struct render_data){
+		.transform = output->transform,
+		.scale = output->scale,
+		.logical = { .x = scene_output->x, .y = scene_output->y },
+		.output = scene_output,
+	};
+
+	if (state->committed & WLR_OUTPUT_STATE_TRANSFORM) {
+		data->transform = state->transform;
+	}
+	if (state->committed & WLR_OUTPUT_STATE_SCALE) {
+		data->scale = state->scale;
+	}
+
+	output_pending_resolution(output, state,
+		&data->trans_width, &data->trans_height);
+	wlr_output_transform_coords(data->transform,
+		&data->trans_width, &data->trans_height);
+
+	data->logical.width = data->trans_width / data->scale;
+	data->logical.height = data->trans_height / data->scale;
+}
+
+static bool scene_output_render_list_is_current(
+		struct wlr_scene_output *scene_output, const struct render_data *render_data) {
+	return scene_output->render_list_generation == scene_output->scene->generation &&
+		wlr_box_equal(&scene_output->render_list_box, &render_data->logical) &&
+		scene_output->render_list_scale == render_data->scale &&
+		scene_output->render_list_transform == render_data->transform;
+}
+
+static void scene_output_build_render_list(struct wlr_scene_output *scene_output,
+		const struct render_data *render_data) {
+	struct wlr_scene *scene = scene_output->scene;
+
+	struct render_list_constructor_data list_con = {
+		.box = render_data->logical,
+		.render_list = &scene_output->render_list,
+		.calculate_visibility = scene->calculate_visibility,
+		.highlight_transparent_region = scene->highlight_transparent_region,
+		.fractional_scale = floor(render_data->scale) != render_data->scale,
+	};
+
+	list_con.render_list->size = 0;
+	scene_nodes_in_box(&scene->tree.node, &list_con.box,
+		construct_render_list_iterator, &list_con, true);
+	array_realloc(list_con.render_list, list_con.render_list->size);
+
+	scene_output->render_list_generation = scene->generation;
+	scene_output->render_list_box = render_data->logical;
+	scene_output->render_list_scale = render_data->scale;
+	scene_output->render_list_transform = render_data->transform;
+}
+
+/**
+ * Rebuild the render list if the scene structure or the output geometry
+ * changed since it was last built, and compute its opaque region.
+ *
+ * The opaque region is computed on every call: buffer commits may change the
+ * opacity of a node without changing the scene structure.
+ *
+ * This only reads the scene graph and writes to the scene output, so it may be
+ * called for different outputs concurrently as long as the bounds of the
+ * scene tree are up to date.
+ */
+static void scene_output_update_render_list(struct wlr_scene_output *scene_output,
+		const struct render_data *render_data) {
+	struct wlr_scene *scene = scene_output->scene;
+
+	if (!scene_output_render_list_is_current(scene_output, render_data)) {
+		scene_output_build_render_list(scene_output, render_data);
+	}
+
+	pixman_region32_clear(&scene_output->render_list_opaque);
+	if (scene->calculate_visibility) {
+		struct render_list_entry *entry;
+		wl_array_for_each(entry, &scene_output->render_list) {
+			// We must only cull opaque regions that are visible by the node.
+			// The node's visibility will have the knowledge of a black rect
+			// that may have been omitted from the render list via the black
+			// rect optimization. In order to ensure we don't cull background
+			// rendering in that black rect region, consider the node's visibility.
+			pixman_region32_t opaque;
+			pixman_region32_init(&opaque);
+			scene_node_opaque_region(entry->node, entry->x, entry->y, &opaque);
+			pixman_region32_intersect(&opaque, &opaque, &entry->node->visible);
+
+			pixman_region32_translate(&opaque,
+				-render_data->logical.x, -render_data->logical.y);
+			logical_to_buffer_coords(&opaque, render_data);
+			pixman_region32_union(&scene_output->render_list_opaque,
+				&scene_output->render_list_opaque, &opaque);
+			pixman_region32_fini(&opaque);
+		}
+	}
+}
+
+struct scene_outputs_prepare_data {
+	struct wlr_scene_output *const *scene_outputs;
+	const struct render_data *render_data;
+};
+
+static void scene_outputs_prepare_iterator(size_t i, void *_data) {
+	struct scene_outputs_prepare_data *data = _data;
+	scene_output_update_render_list(data->scene_outputs[i], &data->render_data[i]);
+	data->scene_outputs[i]->render_list_prepared = true;
+}
+
+static struct thread_pool *scene_get_thread_pool(struct wlr_scene *scene) {
+	if (scene->thread_pool != NULL) {
+		return scene->thread_pool;
+	}
+
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_threads = n_cpus > 1 ? (size_t)n_cpus - 1 : 0;
+	if (n_threads > SCENE_MAX_THREADS) {
+		n_threads = SCENE_MAX_THREADS;
+	}
+
+	scene->thread_pool = thread_pool_create(n_threads);
+	return scene->thread_pool;
+}
+
+void wlr_scene_outputs_prepare(struct wlr_scene_output *const *scene_outputs,
+		size_t scene_outputs_len) {
+	if (scene_outputs_len == 0) {
+		return;
+	}
+
+	struct wlr_scene *scene = scene_outputs[0]->scene;
+	struct thread_pool *pool = scene_get_thread_pool(scene);
+	if (pool == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create scene thread pool");
+		return;
+	}
+
+	struct render_data *render_data =
+		calloc(scene_outputs_len, sizeof(*render_data));
+	if (render_data == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	struct wlr_output_state empty_state;
+	wlr_output_state_init(&empty_state);
+	for (size_t i = 0; i < scene_outputs_len; i++) {
+		assert(scene_outputs[i]->scene == scene);
+		scene_output_init_render_data(scene_outputs[i], &empty_state,
+			&render_data[i]);
+	}
+	wlr_output_state_finish(&empty_state);
+
+	// Tree bounds are computed lazily: bring them up to date here so that the
+	// workers only ever read them
+	scene_tree_get_bounds(&scene->tree);
+
+	struct scene_outputs_prepare_data data = {
+		.scene_outputs = scene_outputs,
+		.render_data = render_data,
+	};
+	thread_pool_run(pool, scene_outputs_len,
+		scene_outputs_prepare_iterator, &data);
+
+	free(render_data);
+}
+
 bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
 	struct wlr_scene_output_state_options default_options = {0};
@@ -1972,57 +3262,39 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	enum wlr_scene_debug_damage_option debug_damage =
 		scene_output->scene->debug_damage_option;
 
-	struct render_data render_data = {
-		.transform = output->transform,
-		.scale = output->scale,
-		.logical = { .x = scene_output->x, .y = scene_output->y },
-		.output = scene_output,
-	};
+	if ((state->committed & WLR_OUTPUT_STATE_TRANSFORM) &&
+			output->transform != state->transform) {
+		scene_output_damage_whole(scene_output);
+	}
+	if ((state->committed & WLR_OUTPUT_STATE_SCALE) &&
+			output->scale != state->scale) {
+		scene_output_damage_whole(scene_output);
+	}
 
 	int resolution_width, resolution_height;
 	output_pending_resolution(output, state,
 		&resolution_width, &resolution_height);
 
-	if (state->committed & WLR_OUTPUT_STATE_TRANSFORM) {
-		if (render_data.transform != state->transform) {
-			scene_output_damage_whole(scene_output);
-		}
+	struct render_data render_data;
+	scene_output_init_render_data(scene_output, state, &render_data);
 
-		render_data.transform = state->transform;
+	// Reuse the render list and opaque region computed by
+	// wlr_scene_outputs_prepare() if nothing changed since
+	if (!scene_output->render_list_prepared ||
+			!scene_output_render_list_is_current(scene_output, &render_data)) {
+		scene_output_update_render_list(scene_output, &render_data);
 	}
+	scene_output->render_list_prepared = false;
 
-	if (state->committed & WLR_OUTPUT_STATE_SCALE) {
-		if (render_data.scale != state->scale) {
-			scene_output_damage_whole(scene_output);
-		}
+	struct render_list_entry *list_data = scene_output->render_list.data;
+	int list_len = scene_output->render_list.size / sizeof(*list_data);
 
-		render_data.scale = state->scale;
+	// Reset the per-frame state of the entries, which may have been reused
+	// from a previous frame
+	for (int i = 0; i < list_len; i++) {
+		list_data[i].sent_dmabuf_feedback = false;
 	}
 
-	render_data.trans_width = resolution_width;
-	render_data.trans_height = resolution_height;
-	wlr_output_transform_coords(render_data.transform,
-		&render_data.trans_width, &render_data.trans_height);
-
-	render_data.logical.width = render_data.trans_width / render_data.scale;
-	render_data.logical.height = render_data.trans_height / render_data.scale;
-
-	struct render_list_constructor_data list_con = {
-		.box = render_data.logical,
-		.render_list = &scene_output->render_list,
-		.calculate_visibility = scene_output->scene->calculate_visibility,
-		.highlight_transparent_region = scene_output->scene->highlight_transparent_region,
-		.fractional_scale = floor(render_data.scale) != render_data.scale,
-	};
-
-	list_con.render_list->size = 0;
-	scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
-		construct_render_list_iterator, &list_con);
-	array_realloc(list_con.render_list, list_con.render_list->size);
-
-	struct render_list_entry *list_data = list_con.render_list->data;
-	int list_len = list_con.render_list->size / sizeof(*list_data);
-
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
 		scene_output_damage_whole(scene_output);
 	}
@@ -2065,7 +3337,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		pixman_region32_fini(&acc_damage);
 	}
 
-	wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
+	scene_output_state_disable_layers(scene_output, state);
 
 	// We only want to try direct scanout if:
 	// - There is only one entry in the render list
@@ -2082,6 +3354,8 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	}
 
 	if (scanout) {
+		scene_output->layers_offloaded = 0;
+		wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
 		scene_output_state_attempt_gamma(scene_output, state);
 
 		if (timer) {
@@ -2109,6 +3383,26 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	assert(buffer->width == resolution_width && buffer->height == resolution_height);
 
+	int offloaded = 0;
+	if (scene_output->scene->output_layers && options->color_transform == NULL &&
+			debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+		offloaded = scene_output_offload_layers(scene_output, state,
+			list_data, list_len, buffer, &render_data);
+	}
+	if (offloaded == 0) {
+		scene_output_state_disable_layers(scene_output, state);
+	}
+
+	// Areas previously covered by layers need to be composited again, and
+	// vice versa
+	if (scene_output->layers_offloaded != offloaded) {
+		scene_output->layers_offloaded = offloaded;
+		scene_output_damage_whole(scene_output);
+	}
+
+	// Only set the damage now that the layer changes have added theirs
+	wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
+
 	if (timer) {
 		timer->render_timer = wlr_render_timer_create(output->renderer);
 
@@ -2118,6 +3412,16 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		timer->pre_render_duration = timespec_to_nsec(&duration);
 	}
 
+	// Cached trees are rendered with render passes of their own, which can't
+	// be nested in the output's
+	for (int i = list_len - 1; i >= offloaded; i--) {
+		struct wlr_scene_node *node = list_data[i].node;
+		if (node->type == WLR_SCENE_NODE_TREE) {
+			scene_tree_update_cache(wlr_scene_tree_from_node(node),
+				scene_output, render_data.scale);
+		}
+	}
+
 	scene_output->in_point++;
 	struct wlr_render_pass *render_pass = wlr_renderer_begin_buffer_pass(output->renderer, buffer,
 			&(struct wlr_buffer_pass_options){
@@ -2145,24 +3449,8 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	// scene nodes above. Those scene nodes will just render atop having us
 	// never see the background.
 	if (scene_output->scene->calculate_visibility) {
-		for (int i = list_len - 1; i >= 0; i--) {
-			struct render_list_entry *entry = &list_data[i];
-
-			// We must only cull opaque regions that are visible by the node.
-			// The node's visibility will have the knowledge of a black rect
-			// that may have been omitted from the render list via the black
-			// rect optimization. In order to ensure we don't cull background
-			// rendering in that black rect region, consider the node's visibility.
-			pixman_region32_t opaque;
-			pixman_region32_init(&opaque);
-			scene_node_opaque_region(entry->node, entry->x, entry->y, &opaque);
-			pixman_region32_intersect(&opaque, &opaque, &entry->node->visible);
-
-			pixman_region32_translate(&opaque, -scene_output->x, -scene_output->y);
-			logical_to_buffer_coords(&opaque, &render_data);
-			pixman_region32_subtract(&background, &background, &opaque);
-			pixman_region32_fini(&opaque);
-		}
+		pixman_region32_subtract(&background, &background,
+			&scene_output->render_list_opaque);
 
 		if (floor(render_data.scale) != render_data.scale) {
 			wlr_region_expand(&background, &background, 1);
@@ -2180,7 +3468,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	});
 	pixman_region32_fini(&background);
 
-	for (int i = list_len - 1; i >= 0; i--) {
+	for (int i = list_len - 1; i >= offloaded; i--) {
 		struct render_list_entry *entry = &list_data[i];
 		scene_entry_render(entry, &render_data);
 
@@ -2236,6 +3524,8 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	scene_output_state_attempt_gamma(scene_output, state);
 
+	scene_schedule_texture_budget(scene_output->scene, output);
+
 	return true;
 }
 
@@ -2254,32 +3544,13 @@ void wlr_scene_timer_finish(struct wlr_scene_timer *timer) {
 	}
 }
 
-static void scene_node_send_frame_done(struct wlr_scene_node *node,
-		struct wlr_scene_output *scene_output, struct timespec *now) {
-	if (!node->enabled) {
-		return;
-	}
-
-	if (node->type == WLR_SCENE_NODE_BUFFER) {
-		struct wlr_scene_buffer *scene_buffer =
-			wlr_scene_buffer_from_node(node);
-
-		if (scene_buffer->primary_output == scene_output) {
-			wlr_scene_buffer_send_frame_done(scene_buffer, now);
-		}
-	} else if (node->type == WLR_SCENE_NODE_TREE) {
-		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
-		struct wlr_scene_node *child;
-		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_send_frame_done(child, scene_output, now);
-		}
-	}
-}
-
 void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 		struct timespec *now) {
-	scene_node_send_frame_done(&scene_output->scene->tree.node,
-		scene_output, now);
+	struct wlr_scene_buffer *scene_buffer, *tmp;
+	wl_list_for_each_safe(scene_buffer, tmp, &scene_output->primary_buffers,
+			primary_output_link) {
+		wlr_scene_buffer_send_frame_done(scene_buffer, now);
+	}
 }
 
 static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
@@ -2304,6 +3575,15 @@ static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
 		}
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		// Skip whole subtrees which don't intersect the output
+		struct wlr_box bounds = *scene_tree_get_bounds(scene_tree);
+		bounds.x += lx;
+		bounds.y += ly;
+		if (!wlr_box_intersection(&bounds, output_box, &bounds)) {
+			return;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
 			scene_output_for_each_scene_buffer(output_box, child, lx, ly,
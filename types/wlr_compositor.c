@@ -404,10 +404,25 @@ static void surface_state_move(struct wlr_surface_state *state,
 	next->cached_state_locks = 0;
 }
 
+// Account for a deferred upload which won't happen because the surface's
+// client buffer is replaced
+static void surface_skip_pending_upload(struct wlr_surface *surface) {
+	if (surface->buffer == NULL || surface->buffer->pending == NULL) {
+		return;
+	}
+
+	struct wlr_compositor_upload_stats *stats = &surface->compositor->upload_stats;
+	stats->uploads_skipped++;
+	stats->bytes_saved += wlr_client_buffer_get_pending_upload_size(surface->buffer);
+}
+
 static void surface_apply_damage(struct wlr_surface *surface) {
+	struct wlr_compositor *compositor = surface->compositor;
+
 	if (surface->current.buffer == NULL) {
 		// NULL commit
 		if (surface->buffer != NULL) {
+			surface_skip_pending_upload(surface);
 			wlr_buffer_unlock(&surface->buffer->base);
 		}
 		surface->buffer = NULL;
@@ -417,21 +432,42 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 
 	surface->opaque = buffer_is_opaque(surface->current.buffer);
 
-	if (surface->buffer != NULL) {
+	if (surface->buffer != NULL && compositor->deferred_upload) {
+		bool had_pending = surface->buffer->pending != NULL;
+		size_t saved_bytes;
+		if (wlr_client_buffer_defer_damage(surface->buffer,
+				surface->current.buffer, &surface->buffer_damage, &saved_bytes)) {
+			// The buffer is released after the upload
+			compositor->upload_stats.uploads_deferred++;
+			if (had_pending) {
+				compositor->upload_stats.uploads_skipped++;
+				compositor->upload_stats.bytes_saved += saved_bytes;
+			}
+			return;
+		}
+	} else if (surface->buffer != NULL) {
 		if (wlr_client_buffer_apply_damage(surface->buffer,
 				surface->current.buffer, &surface->buffer_damage)) {
-			wlr_buffer_unlock(surface->current.buffer);
-			surface->current.buffer = NULL;
+			// The buffer is released after the commit event
 			return;
 		}
 	}
 
-	if (surface->compositor->renderer == NULL) {
+	if (compositor->renderer == NULL) {
 		return;
 	}
 
-	struct wlr_client_buffer *buffer = wlr_client_buffer_create(
-			surface->current.buffer, surface->compositor->renderer);
+	struct wlr_client_buffer *buffer;
+	if (compositor->deferred_upload) {
+		buffer = wlr_client_buffer_create_deferred(surface->current.buffer,
+			compositor->renderer);
+		if (buffer != NULL) {
+			compositor->upload_stats.uploads_deferred++;
+		}
+	} else {
+		buffer = wlr_client_buffer_create(surface->current.buffer,
+			compositor->renderer);
+	}
 
 	if (buffer == NULL) {
 		wlr_log(WLR_ERROR, "Failed to upload buffer");
@@ -439,6 +475,7 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 	}
 
 	if (surface->buffer != NULL) {
+		surface_skip_pending_upload(surface);
 		wlr_buffer_unlock(&surface->buffer->base);
 	}
 	surface->buffer = buffer;
@@ -802,7 +839,7 @@ struct wlr_texture *wlr_surface_get_texture(struct wlr_surface *surface) {
 	if (surface->buffer == NULL) {
 		return NULL;
 	}
-	return surface->buffer->texture;
+	return wlr_client_buffer_get_texture(surface->buffer);
 }
 
 bool wlr_surface_has_buffer(struct wlr_surface *surface) {
@@ -1350,6 +1387,16 @@ static void compositor_handle_renderer_destroy(
 	wlr_compositor_set_renderer(compositor, NULL);
 }
 
+void wlr_compositor_set_deferred_upload(struct wlr_compositor *compositor,
+		bool deferred) {
+	compositor->deferred_upload = deferred;
+}
+
+void wlr_compositor_get_upload_stats(struct wlr_compositor *compositor,
+		struct wlr_compositor_upload_stats *stats) {
+	*stats = compositor->upload_stats;
+}
+
 struct wlr_compositor *wlr_compositor_create(struct wl_display *display,
 		uint32_t version, struct wlr_renderer *renderer) {
 	assert(version <= COMPOSITOR_VERSION);
@@ -147,6 +147,8 @@ static void frame_destroy(struct wlr_screencopy_frame_v1 *frame) {
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_remove(&frame->output_destroy.link);
 	wl_list_remove(&frame->output_enable.link);
+	wl_list_remove(&frame->read_pixels_ready.link);
+	wlr_texture_read_pixels_request_destroy(frame->read_pixels);
 	// Make the frame resource inert
 	wl_resource_set_user_data(frame->resource, NULL);
 	wlr_buffer_unlock(frame->buffer);
@@ -191,45 +193,61 @@ static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
 		tv_sec_hi, tv_sec_lo, when->tv_nsec);
 }
 
-static bool frame_shm_copy(struct wlr_screencopy_frame_v1 *frame,
-		struct wlr_buffer *src_buffer) {
-	struct wlr_output *output = frame->output;
-	struct wlr_renderer *renderer = output->renderer;
-	assert(renderer);
+static void frame_handle_read_pixels_ready(struct wl_listener *listener,
+		void *data) {
+	struct wlr_screencopy_frame_v1 *frame =
+		wl_container_of(listener, frame, read_pixels_ready);
 
-	void *data;
+	bool ok = false;
+	void *ptr;
 	uint32_t format;
 	size_t stride;
-	if (!wlr_buffer_begin_data_ptr_access(frame->buffer,
-			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
-		return false;
+	if (wlr_buffer_begin_data_ptr_access(frame->buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &ptr, &format, &stride)) {
+		ok = wlr_texture_read_pixels_request_copy(frame->read_pixels,
+			ptr, stride);
+		wlr_buffer_end_data_ptr_access(frame->buffer);
 	}
 
-	bool ok = false;
+	if (ok) {
+		frame_send_ready(frame, &frame->when);
+	} else {
+		wlr_log(WLR_DEBUG, "Failed to copy to destination during shm screencopy");
+		zwlr_screencopy_frame_v1_send_failed(frame->resource);
+	}
+	frame_destroy(frame);
+}
+
+/**
+ * Start reading back the source buffer without waiting for the GPU. The
+ * frame is completed in frame_handle_read_pixels_ready().
+ */
+static bool frame_shm_copy_async(struct wlr_screencopy_frame_v1 *frame,
+		struct wlr_buffer *src_buffer) {
+	struct wlr_output *output = frame->output;
+	struct wlr_renderer *renderer = output->renderer;
+	assert(renderer);
 
 	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, src_buffer);
 	if (!texture) {
-		wlr_log(WLR_DEBUG, "Failed to grab a texture from a buffer during shm screencopy");
-		goto out;
+		return false;
 	}
 
-	ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options) {
-		.data = data,
-		.format = format,
-		.stride = stride,
-		.src_box = frame->box,
-	});
+	frame->read_pixels = wlr_texture_read_pixels_async(texture,
+		output->event_loop, &(struct wlr_texture_read_pixels_async_options) {
+			.format = frame->shm_format,
+			.src_box = frame->box,
+		});
 
 	wlr_texture_destroy(texture);
 
-out:
-	wlr_buffer_end_data_ptr_access(frame->buffer);
-
-	if (!ok) {
-		wlr_log(WLR_DEBUG, "Failed to copy to destination during shm screencopy");
+	if (frame->read_pixels == NULL) {
+		return false;
 	}
 
-	return ok;
+	frame->read_pixels_ready.notify = frame_handle_read_pixels_ready;
+	wl_signal_add(&frame->read_pixels->events.ready, &frame->read_pixels_ready);
+	return true;
 }
 
 static bool frame_dma_copy(struct wlr_screencopy_frame_v1 *frame,
@@ -321,10 +339,16 @@ static void frame_handle_output_commit(struct wl_listener *listener,
 		}
 		break;
 	case WLR_BUFFER_CAP_DATA_PTR:
-		if (!frame_shm_copy(frame, src_buffer)) {
+		// The read-back already falls back to a synchronous read, trying
+		// again wouldn't help
+		if (!frame_shm_copy_async(frame, src_buffer)) {
+			wlr_log(WLR_DEBUG, "Failed to copy to destination during shm screencopy");
 			goto err;
 		}
-		break;
+		zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+		frame_send_damage(frame);
+		frame->when = *event->when;
+		return;
 	default:
 		abort(); // unreachable
 	}
@@ -529,6 +553,7 @@ static void capture_output(struct wl_client *wl_client,
 
 	wl_list_init(&frame->output_commit.link);
 	wl_list_init(&frame->output_enable.link);
+	wl_list_init(&frame->read_pixels_ready.link);
 
 	wl_signal_add(&output->events.destroy, &frame->output_destroy);
 	frame->output_destroy.notify = frame_handle_output_destroy;
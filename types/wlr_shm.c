@@ -1,19 +1,25 @@
 #undef _POSIX_C_SOURCE
-#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+#define _GNU_SOURCE // for MAP_ANONYMOUS and F_GET_SEALS
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wayland-server-protocol.h>
 #include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_shm.h>
 #include <wlr/util/log.h>
+#include "render/dmabuf.h"
 #include "render/pixel_format.h"
+#include "types/wlr_buffer.h"
 
 #ifdef __STDC_NO_ATOMICS__
 #error "C11 atomics are required"
@@ -26,10 +32,20 @@
 
 struct wlr_shm_pool {
 	struct wl_resource *resource; // may be NULL
-	struct wlr_shm *shm;
+	struct wlr_shm *shm; // NULL once the wl_shm global is destroyed
+	struct wl_list link; // wlr_shm.pools
 	struct wl_list buffers; // wlr_shm_buffer.link
 	int fd;
 	struct wlr_shm_mapping *mapping;
+
+	// True if the client can't shrink the backing file below the size of the
+	// mapping, in which case accesses don't need the SIGBUS handler
+	bool sealed;
+	uint64_t accesses, sealed_accesses;
+
+	// Whether buffers may be wrapped into a DMA-BUF with udmabuf, cleared
+	// after the first failure
+	bool udmabuf;
 };
 
 /**
@@ -44,6 +60,7 @@ struct wlr_shm_mapping {
 	void *data;
 	size_t size;
 	bool dropped; // false while a wlr_shm_pool references this mapping
+	size_t sealed_accesses; // in-progress accesses without a SIGBUS handler
 };
 
 struct wlr_shm_sigbus_data {
@@ -64,6 +81,10 @@ struct wlr_shm_buffer {
 	struct wl_listener release;
 
 	struct wlr_shm_sigbus_data sigbus_data;
+	bool sealed_access; // true if the current access skipped the SIGBUS handler
+
+	int udmabuf_fd; // -1 if not created yet
+	uint32_t udmabuf_offset; // offset of the buffer inside the DMA-BUF
 };
 
 // Needs to be a lock-free atomic because it's accessed from a signal handler
@@ -117,7 +138,7 @@ static struct wlr_shm_mapping *mapping_create(int fd, size_t size) {
 }
 
 static void mapping_consider_destroy(struct wlr_shm_mapping *mapping) {
-	if (!mapping->dropped) {
+	if (!mapping->dropped || mapping->sealed_accesses > 0) {
 		return;
 	}
 
@@ -159,6 +180,9 @@ static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
 	wl_list_remove(&buffer->release.link);
 	wl_list_remove(&buffer->link);
 	pool_consider_destroy(buffer->pool);
+	if (buffer->udmabuf_fd >= 0) {
+		close(buffer->udmabuf_fd);
+	}
 	free(buffer);
 }
 
@@ -176,6 +200,56 @@ static bool buffer_get_shm(struct wlr_buffer *wlr_buffer,
 	return true;
 }
 
+static const struct wlr_buffer_impl buffer_impl;
+
+bool shm_buffer_get_udmabuf(struct wlr_buffer *wlr_buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	if (wlr_buffer->impl != &buffer_impl) {
+		return false;
+	}
+	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	struct wlr_shm_pool *pool = buffer->pool;
+
+	if (buffer->udmabuf_fd < 0) {
+		if (!pool->udmabuf || !pool->sealed) {
+			return false;
+		}
+
+		long page_size = sysconf(_SC_PAGESIZE);
+		if (page_size <= 0) {
+			return false;
+		}
+		uint64_t start = buffer->offset - buffer->offset % page_size;
+		uint64_t end = buffer->offset + (uint64_t)buffer->stride * buffer->base.height;
+		end = (end + page_size - 1) / page_size * page_size;
+
+		struct stat st;
+		if (fstat(pool->fd, &st) != 0 || (uint64_t)st.st_size < end) {
+			return false;
+		}
+
+		buffer->udmabuf_fd = dmabuf_create_from_memfd(pool->fd, start, end - start);
+		if (buffer->udmabuf_fd < 0) {
+			// Most likely not a memfd, don't try again for this pool
+			pool->udmabuf = false;
+			return false;
+		}
+		buffer->udmabuf_offset = buffer->offset - start;
+	}
+
+	*attribs = (struct wlr_dmabuf_attributes){
+		.width = buffer->base.width,
+		.height = buffer->base.height,
+		.format = buffer->drm_format,
+		.modifier = DRM_FORMAT_MOD_LINEAR,
+		.n_planes = 1,
+		.offset[0] = buffer->udmabuf_offset,
+		.stride[0] = buffer->stride,
+		.fd[0] = buffer->udmabuf_fd,
+	};
+	return true;
+}
+
 static void handle_sigbus(int sig, siginfo_t *info, void *context) {
 	assert(sigbus_data != NULL);
 	struct sigaction prev_action = sigbus_data->prev_action;
@@ -217,6 +291,28 @@ reraise:
 static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
 	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	struct wlr_shm_pool *pool = buffer->pool;
+
+	pool->accesses++;
+	if (pool->shm != NULL) {
+		pool->shm->stats.accesses++;
+	}
+	if (pool->sealed) {
+		// The mapping can't be truncated under us, so it can't SIGBUS
+		struct wlr_shm_mapping *mapping = pool->mapping;
+		mapping->sealed_accesses++;
+		pool->sealed_accesses++;
+		if (pool->shm != NULL) {
+			pool->shm->stats.sealed_accesses++;
+		}
+		buffer->sealed_access = true;
+		buffer->sigbus_data.mapping = mapping;
+
+		*data = (char *)mapping->data + buffer->offset;
+		*format = buffer->drm_format;
+		*stride = buffer->stride;
+		return true;
+	}
 
 	if (!atomic_is_lock_free(&sigbus_data)) {
 		wlr_log(WLR_ERROR, "Lock-free atomic pointers are required");
@@ -257,6 +353,13 @@ static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
 	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
 
+	if (buffer->sealed_access) {
+		buffer->sealed_access = false;
+		buffer->sigbus_data.mapping->sealed_accesses--;
+		mapping_consider_destroy(buffer->sigbus_data.mapping);
+		return;
+	}
+
 	if (sigbus_data == &buffer->sigbus_data) {
 		sigbus_data = buffer->sigbus_data.next;
 	} else {
@@ -308,6 +411,27 @@ static void buffer_handle_resource_destroy(struct wl_resource *resource) {
 
 static bool shm_has_format(struct wlr_shm *shm, uint32_t shm_format);
 
+/**
+ * Check whether the client has sealed the file against shrinking, and whether
+ * it's large enough to back a mapping of the given size.
+ */
+static bool fd_is_sealed(int fd, size_t size) {
+#ifdef F_GET_SEALS
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+	return st.st_size >= 0 && (uint64_t)st.st_size >= size;
+#else
+	return false;
+#endif
+}
+
 static void pool_handle_create_buffer(struct wl_client *client,
 		struct wl_resource *pool_resource, uint32_t id, int32_t offset,
 		int32_t width, int32_t height, int32_t stride, uint32_t shm_format) {
@@ -356,6 +480,7 @@ static void pool_handle_create_buffer(struct wl_client *client,
 	}
 
 	buffer->pool = pool;
+	buffer->udmabuf_fd = -1;
 	buffer->offset = offset;
 	buffer->stride = stride;
 	buffer->drm_format = drm_format;
@@ -369,6 +494,17 @@ static void pool_handle_create_buffer(struct wl_client *client,
 	wl_signal_add(&buffer->base.events.release, &buffer->release);
 }
 
+static void pool_set_sealed(struct wlr_shm_pool *pool, bool sealed) {
+	if (pool->shm != NULL && pool->sealed != sealed) {
+		if (sealed) {
+			pool->shm->stats.sealed_pools++;
+		} else {
+			pool->shm->stats.sealed_pools--;
+		}
+	}
+	pool->sealed = sealed;
+}
+
 static void pool_handle_resize(struct wl_client *client,
 		struct wl_resource *pool_resource, int32_t size) {
 	struct wlr_shm_pool *pool = pool_from_resource(pool_resource);
@@ -389,6 +525,9 @@ static void pool_handle_resize(struct wl_client *client,
 
 	mapping_drop(pool->mapping);
 	pool->mapping = mapping;
+
+	// The client may not have grown the file before resizing the pool
+	pool_set_sealed(pool, fd_is_sealed(pool->fd, mapping->size));
 }
 
 static const struct wl_shm_pool_interface pool_impl = {
@@ -402,6 +541,18 @@ static void pool_consider_destroy(struct wlr_shm_pool *pool) {
 		return;
 	}
 
+	wlr_log(WLR_DEBUG, "Destroying %s wl_shm_pool, %" PRIu64 " of %" PRIu64
+		" accesses without SIGBUS handler", pool->sealed ? "sealed" : "unsealed",
+		pool->sealed_accesses, pool->accesses);
+
+	if (pool->shm != NULL) {
+		pool->shm->stats.pools--;
+		if (pool->sealed) {
+			pool->shm->stats.sealed_pools--;
+		}
+		wl_list_remove(&pool->link);
+	}
+
 	mapping_drop(pool->mapping);
 	close(pool->fd);
 	free(pool);
@@ -449,7 +600,12 @@ static void shm_handle_create_pool(struct wl_client *client,
 	pool->mapping = mapping;
 	pool->shm = shm;
 	pool->fd = fd;
+	pool->udmabuf = shm->udmabuf;
 	wl_list_init(&pool->buffers);
+	wl_list_insert(&shm->pools, &pool->link);
+
+	shm->stats.pools++;
+	pool_set_sealed(pool, fd_is_sealed(fd, size));
 	return;
 
 error_pool:
@@ -490,11 +646,28 @@ static void shm_bind(struct wl_client *client, void *data, uint32_t version,
 static void handle_display_destroy(struct wl_listener *listener, void *data) {
 	struct wlr_shm *shm = wl_container_of(listener, shm, display_destroy);
 	wl_list_remove(&shm->display_destroy.link);
+
+	// Buffers may keep their pool alive for longer
+	struct wlr_shm_pool *pool, *pool_tmp;
+	wl_list_for_each_safe(pool, pool_tmp, &shm->pools, link) {
+		wl_list_remove(&pool->link);
+		wl_list_init(&pool->link);
+		pool->shm = NULL;
+	}
+
 	wl_global_destroy(shm->global);
 	free(shm->formats);
 	free(shm);
 }
 
+void wlr_shm_set_udmabuf(struct wlr_shm *shm, bool enabled) {
+	shm->udmabuf = enabled;
+}
+
+void wlr_shm_get_stats(struct wlr_shm *shm, struct wlr_shm_stats *stats) {
+	*stats = shm->stats;
+}
+
 struct wlr_shm *wlr_shm_create(struct wl_display *display, uint32_t version,
 		const uint32_t *formats, size_t formats_len) {
 	assert(version <= SHM_VERSION);
@@ -519,6 +692,8 @@ struct wlr_shm *wlr_shm_create(struct wl_display *display, uint32_t version,
 		return NULL;
 	}
 
+	wl_list_init(&shm->pools);
+
 	shm->formats_len = formats_len;
 	shm->formats = malloc(formats_len * sizeof(uint32_t));
 	if (shm->formats == NULL) {
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <string.h>
+#include "util/bitset.h"
+
+#define WORD_BITS 64
+
+static size_t bitset_len(const struct wl_array *set) {
+	return set->size / sizeof(uint64_t);
+}
+
+static uint64_t bitset_word(const struct wl_array *set, size_t i) {
+	if (i >= bitset_len(set)) {
+		return 0;
+	}
+	const uint64_t *words = set->data;
+	return words[i];
+}
+
+bool bitset_set(struct wl_array *set, size_t bit) {
+	size_t i = bit / WORD_BITS;
+	size_t len = bitset_len(set);
+	if (i >= len) {
+		size_t add = (i + 1 - len) * sizeof(uint64_t);
+		void *ptr = wl_array_add(set, add);
+		if (ptr == NULL) {
+			return false;
+		}
+		memset(ptr, 0, add);
+	}
+
+	uint64_t *words = set->data;
+	words[i] |= UINT64_C(1) << (bit % WORD_BITS);
+	return true;
+}
+
+bool bitset_test(const struct wl_array *set, size_t bit) {
+	return bitset_word(set, bit / WORD_BITS) & (UINT64_C(1) << (bit % WORD_BITS));
+}
+
+bool bitset_empty(const struct wl_array *set) {
+	return bitset_next(set, 0) == BITSET_NONE;
+}
+
+bool bitset_equal(const struct wl_array *a, const struct wl_array *b) {
+	return bitset_next_diff(a, b, 0) == BITSET_NONE;
+}
+
+size_t bitset_next_diff(const struct wl_array *a, const struct wl_array *b,
+		size_t start) {
+	size_t len = bitset_len(a);
+	if (bitset_len(b) > len) {
+		len = bitset_len(b);
+	}
+
+	size_t i = start / WORD_BITS;
+	if (i >= len) {
+		return BITSET_NONE;
+	}
+
+	// Mask out the bits below start in the first word
+	uint64_t word = (bitset_word(a, i) ^ bitset_word(b, i)) &
+		(~UINT64_C(0) << (start % WORD_BITS));
+	while (word == 0) {
+		i++;
+		if (i >= len) {
+			return BITSET_NONE;
+		}
+		word = bitset_word(a, i) ^ bitset_word(b, i);
+	}
+
+	return i * WORD_BITS + (size_t)__builtin_ctzll(word);
+}
+
+size_t bitset_next(const struct wl_array *set, size_t start) {
+	struct wl_array empty = {0};
+	return bitset_next_diff(set, &empty, start);
+}
@@ -0,0 +1,156 @@
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "util/thread_pool.h"
+
+struct thread_pool {
+	pthread_t *threads;
+	size_t n_threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond; // signalled when a job is started
+	pthread_cond_t done_cond; // signalled when the last item is finished
+
+	// Current job, protected by lock
+	void (*func)(size_t i, void *data);
+	void *data;
+	size_t n, next, done;
+	uint64_t job_seq;
+	bool stop;
+};
+
+// Must be called with the lock held, returns with the lock held
+static void run_items(struct thread_pool *pool) {
+	while (pool->next < pool->n) {
+		size_t i = pool->next++;
+		void (*func)(size_t i, void *data) = pool->func;
+		void *data = pool->data;
+
+		pthread_mutex_unlock(&pool->lock);
+		func(i, data);
+		pthread_mutex_lock(&pool->lock);
+
+		pool->done++;
+		if (pool->done == pool->n) {
+			pthread_cond_broadcast(&pool->done_cond);
+		}
+	}
+}
+
+static void *worker_run(void *data) {
+	struct thread_pool *pool = data;
+
+	pthread_mutex_lock(&pool->lock);
+	uint64_t seen_seq = pool->job_seq;
+	while (true) {
+		while (!pool->stop && pool->job_seq == seen_seq) {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		}
+		if (pool->stop) {
+			break;
+		}
+		seen_seq = pool->job_seq;
+		run_items(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct thread_pool *thread_pool_create(size_t n_threads) {
+	struct thread_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	if (n_threads > 0) {
+		pool->threads = calloc(n_threads, sizeof(*pool->threads));
+		if (pool->threads == NULL) {
+			free(pool);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	// Signals must keep being delivered to the compositor's main thread, so
+	// block all of them before spawning the workers: the mask is inherited
+	sigset_t set, old_set;
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+	for (size_t i = 0; i < n_threads; i++) {
+		int ret = pthread_create(&pool->threads[i], NULL, worker_run, pool);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "pthread_create failed: %s", strerror(ret));
+			break;
+		}
+		pool->n_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->n_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+size_t thread_pool_get_concurrency(struct thread_pool *pool) {
+	return pool->n_threads + 1;
+}
+
+void thread_pool_run(struct thread_pool *pool, size_t n,
+		void (*func)(size_t i, void *data), void *data) {
+	if (pool->n_threads == 0 || n <= 1) {
+		for (size_t i = 0; i < n; i++) {
+			func(i, data);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	assert(pool->next == pool->n);
+
+	pool->func = func;
+	pool->data = data;
+	pool->n = n;
+	pool->next = 0;
+	pool->done = 0;
+	pool->job_seq++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	run_items(pool);
+	while (pool->done < pool->n) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+
+	pool->func = NULL;
+	pool->data = NULL;
+	pthread_mutex_unlock(&pool->lock);
+}